@@ -0,0 +1,842 @@
+/**
+ * FILENAME :       ahci.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A driver for SATA disks on an AHCI controller, e.g. QEMU's ich9-ahci.
+ *  Every port has a list of 32 command slots. With native command queuing
+ *  (NCQ) a disk accepts a command in every free slot and completes them in
+ *  any order, so independent requests are in flight at the same time. Disks
+ *  without NCQ get one DMA command at a time. Every port keeps statistics of
+ *  its queue depth and the latency of its requests.
+ *  Disks are registered as block devices "sda", "sdb" and so on.
+ */
+
+#include "ahci.h"
+#include "block_device.h"
+#include "pci.h"
+#include "irq.h"
+#include "timer.h"
+#include "screen.h"
+#include "shell.h"
+#include "string.h"
+#include "low_level.h"
+#include "bool.h"
+
+/** Registers of the controller */
+#define AHCI_CAP 0x00
+#define AHCI_GHC 0x04
+#define AHCI_IS 0x08
+#define AHCI_PI 0x0c
+
+/** Bits of the global host control */
+#define AHCI_GHC_IE (1 << 1)
+#define AHCI_GHC_AE (1u << 31)
+
+/** Bits of the capabilities */
+#define AHCI_CAP_SNCQ (1 << 30)
+
+/** Registers of a port, relative to its base */
+#define AHCI_PORT_BASE(port) (0x100 + (port) * 0x80)
+#define AHCI_PX_CLB 0x00
+#define AHCI_PX_CLBU 0x04
+#define AHCI_PX_FB 0x08
+#define AHCI_PX_FBU 0x0c
+#define AHCI_PX_IS 0x10
+#define AHCI_PX_IE 0x14
+#define AHCI_PX_CMD 0x18
+#define AHCI_PX_TFD 0x20
+#define AHCI_PX_SIG 0x24
+#define AHCI_PX_SSTS 0x28
+#define AHCI_PX_SERR 0x30
+#define AHCI_PX_SACT 0x34
+#define AHCI_PX_CI 0x38
+
+/** Bits of the port command register */
+#define AHCI_PX_CMD_ST (1 << 0)
+#define AHCI_PX_CMD_FRE (1 << 4)
+#define AHCI_PX_CMD_FR (1 << 14)
+#define AHCI_PX_CMD_CR (1 << 15)
+
+/** Interrupt bits of a port */
+#define AHCI_PX_IS_DHRS (1 << 0)
+#define AHCI_PX_IS_SDBS (1 << 3)
+#define AHCI_PX_IS_ERRORS 0x7d800010
+#define AHCI_PX_IS_TFES (1 << 30)
+/** Interrupts enabled on a port: completed commands and errors */
+#define AHCI_PX_IE_USED (AHCI_PX_IS_DHRS | AHCI_PX_IS_SDBS | AHCI_PX_IS_ERRORS)
+
+/** Bits of the task file data */
+#define AHCI_TFD_ERR 0x01
+#define AHCI_TFD_DRQ 0x08
+#define AHCI_TFD_BSY 0x80
+
+/** Signature of a SATA disk */
+#define AHCI_SIG_ATA 0x00000101
+
+/** Commands */
+#define AHCI_CMD_READ_DMA_EXT 0x25
+#define AHCI_CMD_WRITE_DMA_EXT 0x35
+#define AHCI_CMD_READ_FPDMA_QUEUED 0x60
+#define AHCI_CMD_WRITE_FPDMA_QUEUED 0x61
+#define AHCI_CMD_FLUSH_CACHE_EXT 0xea
+#define AHCI_CMD_IDENTIFY 0xec
+
+/** Type of a register FIS sent to the device */
+#define AHCI_FIS_REG_H2D 0x27
+
+/** Physical region descriptors per command */
+#define AHCI_PRD_COUNT 2
+/** Bytes a single region descriptor can cover */
+#define AHCI_PRD_MAX_BYTES 0x400000
+
+/** Polls of a register until a synchronous command times out */
+#define AHCI_TIMEOUT_POLLS 3000000
+
+/**
+ * An entry of a port's command list
+ */
+typedef struct ahci_command_header
+{
+    // bits 0-4: length of the command FIS in double words, bit 6: write
+    unsigned short flags;
+    // amount of region descriptors
+    unsigned short prdt_length;
+    // bytes transferred, updated by the controller
+    volatile unsigned int prd_byte_count;
+    unsigned int table;
+    unsigned int table_high;
+    unsigned int reserved[4];
+} __attribute__((packed)) ahci_command_header;
+
+/**
+ * A physical region descriptor
+ */
+typedef struct ahci_prd
+{
+    unsigned int address;
+    unsigned int address_high;
+    unsigned int reserved;
+    // bits 0-21: byte count - 1, bit 31: interrupt on completion
+    unsigned int count;
+} __attribute__((packed)) ahci_prd;
+
+/**
+ * The command table of a slot: the command FIS and the region descriptors
+ */
+typedef struct ahci_command_table
+{
+    unsigned char fis[64];
+    unsigned char atapi[16];
+    unsigned char reserved[48];
+    ahci_prd prdt[AHCI_PRD_COUNT];
+} __attribute__((packed, aligned(128))) ahci_command_table;
+
+/**
+ * A disk on a port of the controller
+ */
+typedef struct ahci_port
+{
+    // registered block device, its data points to the port
+    block_device device;
+    // number of the port on the controller
+    int number;
+    // true if the disk supports native command queuing
+    bool ncq;
+    // amount of slots used, 1 without NCQ
+    unsigned int depth;
+    // queued requests not handed to the disk yet
+    block_request *queue_head;
+    block_request *queue_tail;
+    // per slot: request, sectors done by previous commands, sectors of the
+    // command in progress and the tick the request was started
+    block_request *slot_request[AHCI_SLOTS];
+    unsigned int slot_done[AHCI_SLOTS];
+    unsigned int slot_count[AHCI_SLOTS];
+    unsigned int slot_start[AHCI_SLOTS];
+    // bit mask of slots with a command in progress
+    unsigned int issued;
+    // an error was reported by an interrupt, ahci_poll_port recovers
+    volatile bool failed;
+    // statistics
+    unsigned int commands;
+    unsigned int requests;
+    unsigned int errors;
+    unsigned int latency_total;
+    unsigned int latency_max;
+    unsigned int depth_total;
+    unsigned int depth_max;
+} ahci_port;
+
+/** Memory shared with the controller, per port */
+static ahci_command_header ahci_command_lists[AHCI_MAX_PORTS][AHCI_SLOTS]
+    __attribute__((aligned(1024)));
+static unsigned char ahci_received_fis[AHCI_MAX_PORTS][256]
+    __attribute__((aligned(256)));
+static ahci_command_table ahci_tables[AHCI_MAX_PORTS][AHCI_SLOTS];
+
+/** Driven ports */
+static ahci_port ahci_ports[AHCI_MAX_PORTS];
+static int ahci_port_count = 0;
+
+/** Base address of the controller's registers */
+static volatile unsigned char *ahci_base = 0;
+
+/** Amount of command slots of the controller */
+static unsigned int ahci_slot_count = 0;
+
+/** Amount of interrupts raised by the controller */
+static unsigned int ahci_interrupts = 0;
+
+/** Buffer for IDENTIFY data */
+static unsigned short ahci_identify_data[256];
+
+/**
+ * Reads a register of the controller
+ *
+ * @param offset offset of the register
+ * @return unsigned int value
+ */
+static unsigned int ahci_read(unsigned int offset)
+{
+    return *(volatile unsigned int *)(ahci_base + offset);
+}
+
+/**
+ * Writes a register of the controller
+ *
+ * @param offset offset of the register
+ * @param value value to write
+ */
+static void ahci_write(unsigned int offset, unsigned int value)
+{
+    *(volatile unsigned int *)(ahci_base + offset) = value;
+}
+
+/**
+ * Reads a register of a port
+ *
+ * @param port the port
+ * @param offset offset of the register within the port's registers
+ * @return unsigned int value
+ */
+static unsigned int ahci_port_read(ahci_port *port, unsigned int offset)
+{
+    return ahci_read(AHCI_PORT_BASE(port->number) + offset);
+}
+
+/**
+ * Writes a register of a port
+ *
+ * @param port the port
+ * @param offset offset of the register within the port's registers
+ * @param value value to write
+ */
+static void ahci_port_write(ahci_port *port, unsigned int offset,
+                            unsigned int value)
+{
+    ahci_write(AHCI_PORT_BASE(port->number) + offset, value);
+}
+
+/**
+ * Index of a port in ahci_ports, which also selects its memory
+ *
+ * @param port the port
+ * @return int index
+ */
+static int ahci_port_index(ahci_port *port)
+{
+    return port - ahci_ports;
+}
+
+/**
+ * Stops a port from processing its command list
+ *
+ * @param port the port
+ */
+static void ahci_port_stop(ahci_port *port)
+{
+    unsigned int cmd = ahci_port_read(port, AHCI_PX_CMD);
+    ahci_port_write(port, AHCI_PX_CMD,
+                    cmd & ~(AHCI_PX_CMD_ST | AHCI_PX_CMD_FRE));
+    for (unsigned int i = 0; i < AHCI_TIMEOUT_POLLS; i++)
+    {
+        if (!(ahci_port_read(port, AHCI_PX_CMD) &
+              (AHCI_PX_CMD_CR | AHCI_PX_CMD_FR)))
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * Lets a port process its command list
+ *
+ * @param port the port
+ */
+static void ahci_port_start(ahci_port *port)
+{
+    // clear errors and pending interrupts
+    ahci_port_write(port, AHCI_PX_SERR, 0xffffffff);
+    ahci_port_write(port, AHCI_PX_IS, 0xffffffff);
+    ahci_port_write(port, AHCI_PX_CMD,
+                    ahci_port_read(port, AHCI_PX_CMD) | AHCI_PX_CMD_FRE);
+    for (unsigned int i = 0; i < AHCI_TIMEOUT_POLLS; i++)
+    {
+        if (!(ahci_port_read(port, AHCI_PX_TFD) &
+              (AHCI_TFD_BSY | AHCI_TFD_DRQ)))
+        {
+            break;
+        }
+    }
+    ahci_port_write(port, AHCI_PX_CMD,
+                    ahci_port_read(port, AHCI_PX_CMD) | AHCI_PX_CMD_ST);
+}
+
+/**
+ * Prepares a slot for a command: the command header, the register FIS and
+ * the region descriptors of the buffer
+ *
+ * @param port the port
+ * @param slot index of the slot
+ * @param command ATA command
+ * @param sector first sector
+ * @param count amount of sectors
+ * @param buffer buffer of the data, 0 for commands without data
+ * @param bytes size of the data in bytes
+ * @param write true if the data goes to the disk
+ */
+static void ahci_prepare(ahci_port *port, int slot, unsigned char command,
+                         unsigned int sector, unsigned int count,
+                         unsigned char *buffer, unsigned int bytes, bool write)
+{
+    int index = ahci_port_index(port);
+    ahci_command_header *header = &ahci_command_lists[index][slot];
+    ahci_command_table *table = &ahci_tables[index][slot];
+    memset(table->fis, 0, sizeof(table->fis));
+
+    unsigned short regions = 0;
+    while (bytes > 0 && regions < AHCI_PRD_COUNT)
+    {
+        unsigned int length =
+            bytes > AHCI_PRD_MAX_BYTES ? AHCI_PRD_MAX_BYTES : bytes;
+        table->prdt[regions].address = (unsigned int)buffer;
+        table->prdt[regions].address_high = 0;
+        table->prdt[regions].reserved = 0;
+        table->prdt[regions].count = length - 1;
+        buffer += length;
+        bytes -= length;
+        regions++;
+    }
+    header->flags = (5 /* FIS length in double words */) | (write ? 1 << 6 : 0);
+    header->prdt_length = regions;
+    header->prd_byte_count = 0;
+    header->table = (unsigned int)table;
+    header->table_high = 0;
+
+    unsigned char *fis = table->fis;
+    fis[0] = AHCI_FIS_REG_H2D;
+    // the command register is updated
+    fis[1] = 0x80;
+    fis[2] = command;
+    fis[4] = sector & 0xff;
+    fis[5] = (sector >> 8) & 0xff;
+    fis[6] = (sector >> 16) & 0xff;
+    // LBA mode
+    fis[7] = 0x40;
+    fis[8] = (sector >> 24) & 0xff;
+    if (command == AHCI_CMD_READ_FPDMA_QUEUED ||
+        command == AHCI_CMD_WRITE_FPDMA_QUEUED)
+    {
+        // the sector count goes into the features, the tag into the count
+        fis[3] = count & 0xff;
+        fis[11] = (count >> 8) & 0xff;
+        fis[12] = slot << 3;
+    }
+    else
+    {
+        fis[12] = count & 0xff;
+        fis[13] = (count >> 8) & 0xff;
+    }
+}
+
+/**
+ * Runs a command on an idle port and waits for it, used while setting up
+ *
+ * @param port the port
+ * @param command ATA command
+ * @param buffer buffer of the data, 0 for commands without data
+ * @param bytes size of the data in bytes
+ * @return int 0 on success, -1 on failure
+ */
+static int ahci_run(ahci_port *port, unsigned char command,
+                    unsigned char *buffer, unsigned int bytes)
+{
+    ahci_prepare(port, 0, command, 0, 0, buffer, bytes, false);
+    ahci_port_write(port, AHCI_PX_CI, 1);
+    for (unsigned int i = 0; i < AHCI_TIMEOUT_POLLS; i++)
+    {
+        if (ahci_port_read(port, AHCI_PX_IS) & AHCI_PX_IS_TFES)
+        {
+            break;
+        }
+        if (!(ahci_port_read(port, AHCI_PX_CI) & 1))
+        {
+            ahci_port_write(port, AHCI_PX_IS, 0xffffffff);
+            return 0;
+        }
+    }
+    ahci_port_stop(port);
+    ahci_port_start(port);
+    return -1;
+}
+
+/**
+ * Issues the next command of the request in a slot
+ *
+ * @param port the port
+ * @param slot index of the slot
+ */
+static void ahci_issue(ahci_port *port, int slot)
+{
+    block_request *request = port->slot_request[slot];
+    unsigned int count = request->count - port->slot_done[slot];
+    if (count > AHCI_MAX_SECTORS)
+    {
+        count = AHCI_MAX_SECTORS;
+    }
+    port->slot_count[slot] = count;
+    unsigned char command =
+        port->ncq ? (request->write ? AHCI_CMD_WRITE_FPDMA_QUEUED
+                                    : AHCI_CMD_READ_FPDMA_QUEUED)
+                  : (request->write ? AHCI_CMD_WRITE_DMA_EXT
+                                    : AHCI_CMD_READ_DMA_EXT);
+    ahci_prepare(port, slot, command, request->block + port->slot_done[slot],
+                 count,
+                 request->buffer + port->slot_done[slot] * AHCI_SECTOR_SIZE,
+                 count * AHCI_SECTOR_SIZE, request->write);
+    port->issued |= 1u << slot;
+    port->commands++;
+    if (port->ncq)
+    {
+        ahci_port_write(port, AHCI_PX_SACT, 1u << slot);
+    }
+    ahci_port_write(port, AHCI_PX_CI, 1u << slot);
+}
+
+/**
+ * Amount of slots with a request in progress
+ *
+ * @param port the port
+ * @return unsigned int requests in flight
+ */
+static unsigned int ahci_in_flight(ahci_port *port)
+{
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < port->depth; i++)
+    {
+        if (port->slot_request[i])
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Completes the request of a slot and frees the slot
+ *
+ * @param port the port
+ * @param slot index of the slot
+ * @param status BLOCK_REQUEST_DONE or BLOCK_REQUEST_FAILED
+ */
+static void ahci_complete(ahci_port *port, int slot, int status)
+{
+    block_request *request = port->slot_request[slot];
+    unsigned int latency = timer_get_ticks() - port->slot_start[slot];
+    port->slot_request[slot] = 0;
+    port->issued &= ~(1u << slot);
+    port->requests++;
+    port->latency_total += latency;
+    if (latency > port->latency_max)
+    {
+        port->latency_max = latency;
+    }
+    if (status == BLOCK_REQUEST_FAILED)
+    {
+        port->errors++;
+    }
+    request->status = status;
+    if (request->callback)
+    {
+        request->callback(request);
+    }
+}
+
+/**
+ * Recovers a port from an error or a timeout: all commands in progress fail
+ * and the port is restarted
+ *
+ * @param port the port
+ */
+static void ahci_recover(ahci_port *port)
+{
+    print("ahci: command failed\n", DEFAULT_COLOR_SCHEME);
+    ahci_port_stop(port);
+    for (unsigned int i = 0; i < port->depth; i++)
+    {
+        if (port->slot_request[i])
+        {
+            ahci_complete(port, i, BLOCK_REQUEST_FAILED);
+        }
+    }
+    port->issued = 0;
+    ahci_port_start(port);
+    // the interrupt handler masked the errors until now
+    port->failed = false;
+    ahci_port_write(port, AHCI_PX_IE, AHCI_PX_IE_USED);
+}
+
+/**
+ * Hands queued requests to free slots of a port
+ *
+ * @param port the port
+ */
+static void ahci_fill_slots(ahci_port *port)
+{
+    for (unsigned int i = 0; i < port->depth && port->queue_head; i++)
+    {
+        if (port->slot_request[i])
+        {
+            continue;
+        }
+        block_request *request = port->queue_head;
+        port->queue_head = request->next;
+        if (!port->queue_head)
+        {
+            port->queue_tail = 0;
+        }
+        request->next = 0;
+        port->slot_request[i] = request;
+        port->slot_done[i] = 0;
+        port->slot_start[i] = timer_get_ticks();
+        if (request->count == 0)
+        {
+            ahci_complete(port, i, BLOCK_REQUEST_DONE);
+            continue;
+        }
+        if ((unsigned int)request->buffer & 1)
+        {
+            // region descriptors need word aligned addresses
+            print("ahci: buffer not word aligned\n", DEFAULT_COLOR_SCHEME);
+            ahci_complete(port, i, BLOCK_REQUEST_FAILED);
+            continue;
+        }
+        ahci_issue(port, i);
+        unsigned int in_flight = ahci_in_flight(port);
+        port->depth_total += in_flight;
+        if (in_flight > port->depth_max)
+        {
+            port->depth_max = in_flight;
+        }
+    }
+}
+
+/**
+ * Completes finished commands of a port and issues new ones, without waiting
+ *
+ * @param port the port
+ * @return int 1 while there are requests left, 0 once the port is idle
+ */
+static int ahci_poll_port(ahci_port *port)
+{
+    if (port->failed || (ahci_port_read(port, AHCI_PX_IS) & AHCI_PX_IS_ERRORS))
+    {
+        ahci_recover(port);
+    }
+    // a command is finished once its slot is cleared in both registers
+    unsigned int active = ahci_port_read(port, AHCI_PX_SACT) |
+                          ahci_port_read(port, AHCI_PX_CI);
+    unsigned int finished = port->issued & ~active;
+    for (unsigned int i = 0; i < port->depth; i++)
+    {
+        if (!(finished & (1u << i)))
+        {
+            continue;
+        }
+        port->issued &= ~(1u << i);
+        port->slot_done[i] += port->slot_count[i];
+        if (port->slot_done[i] < port->slot_request[i]->count)
+        {
+            ahci_issue(port, i);
+            continue;
+        }
+        ahci_complete(port, i, BLOCK_REQUEST_DONE);
+    }
+    for (unsigned int i = 0; i < port->depth; i++)
+    {
+        if (port->slot_request[i] &&
+            timer_get_ticks() - port->slot_start[i] > AHCI_TIMEOUT)
+        {
+            ahci_recover(port);
+            break;
+        }
+    }
+    ahci_fill_slots(port);
+    return port->queue_head || port->issued ? 1 : 0;
+}
+
+/**
+ * Interrupt handler of the controller, acknowledges the interrupts of all
+ * ports. The work is done by polling. The interrupt is level triggered, so
+ * an error is acknowledged too: it is masked and left to ahci_poll_port
+ * through the port's failed flag.
+ *
+ * @param regs registers as pushed by the assembly code
+ */
+static void ahci_irq_callback(struct regs *regs)
+{
+    // avoid unused parameter warning
+    (void)(regs);
+    unsigned int pending = ahci_read(AHCI_IS);
+    if (!pending)
+    {
+        return;
+    }
+    ahci_interrupts++;
+    for (int i = 0; i < ahci_port_count; i++)
+    {
+        ahci_port *port = &ahci_ports[i];
+        if (pending & (1u << port->number))
+        {
+            unsigned int status = ahci_port_read(port, AHCI_PX_IS);
+            if (status & AHCI_PX_IS_ERRORS)
+            {
+                port->failed = true;
+                ahci_port_write(port, AHCI_PX_IE,
+                                AHCI_PX_IE_USED & ~AHCI_PX_IS_ERRORS);
+            }
+            ahci_port_write(port, AHCI_PX_IS, status);
+        }
+    }
+    ahci_write(AHCI_IS, pending);
+}
+
+/**
+ * Block device operation queueing a request
+ *
+ * @param device a disk
+ * @param request request to queue
+ */
+static void ahci_device_submit(block_device *device, block_request *request)
+{
+    ahci_port *port = (ahci_port *)device->data;
+    request->next = 0;
+    if (port->queue_tail)
+    {
+        port->queue_tail->next = request;
+    }
+    else
+    {
+        port->queue_head = request;
+    }
+    port->queue_tail = request;
+    ahci_fill_slots(port);
+}
+
+/**
+ * Block device operation serving requests
+ *
+ * @param device a disk
+ * @return int 1 while requests are being served, 0 once the port is idle
+ */
+static int ahci_device_poll(block_device *device)
+{
+    return ahci_poll_port((ahci_port *)device->data);
+}
+
+/**
+ * Block device operation writing the disk's write cache to the medium
+ *
+ * @param device a disk
+ * @return int 0 on success, -1 on failure
+ */
+static int ahci_device_flush(block_device *device)
+{
+    ahci_port *port = (ahci_port *)device->data;
+    while (ahci_poll_port(port))
+    {
+        block_sleep();
+    }
+    return ahci_run(port, AHCI_CMD_FLUSH_CACHE_EXT, 0, 0);
+}
+
+/** Operations of the disks */
+static const block_device_ops ahci_device_ops = {
+    ahci_device_submit,
+    ahci_device_poll,
+    ahci_device_flush,
+};
+
+/**
+ * Sets up a port with a disk and registers it as block device
+ *
+ * @param number number of the port on the controller
+ */
+static void ahci_setup_port(int number)
+{
+    static char *names[AHCI_MAX_PORTS] = {"sda", "sdb"};
+    ahci_port *port = &ahci_ports[ahci_port_count];
+    int index = ahci_port_count;
+    memset((unsigned char *)port, 0, sizeof(ahci_port));
+    port->number = number;
+
+    ahci_port_stop(port);
+    memset((unsigned char *)ahci_command_lists[index], 0,
+           sizeof(ahci_command_lists[index]));
+    memset(ahci_received_fis[index], 0, sizeof(ahci_received_fis[index]));
+    ahci_port_write(port, AHCI_PX_CLB, (unsigned int)ahci_command_lists[index]);
+    ahci_port_write(port, AHCI_PX_CLBU, 0);
+    ahci_port_write(port, AHCI_PX_FB, (unsigned int)ahci_received_fis[index]);
+    ahci_port_write(port, AHCI_PX_FBU, 0);
+    ahci_port_start(port);
+
+    if (ahci_run(port, AHCI_CMD_IDENTIFY, (unsigned char *)ahci_identify_data,
+                 sizeof(ahci_identify_data)))
+    {
+        ahci_port_stop(port);
+        return;
+    }
+    unsigned short *identify = ahci_identify_data;
+    unsigned int capacity = identify[60] | (identify[61] << 16);
+    if ((identify[83] >> 10) & 1)
+    {
+        capacity = identify[100] | (identify[101] << 16);
+        if (identify[102] || identify[103])
+        {
+            // more than the 32 bit block numbers can reach
+            capacity = 0xffffffff;
+        }
+    }
+    port->depth = 1;
+    if ((ahci_read(AHCI_CAP) & AHCI_CAP_SNCQ) && ((identify[76] >> 8) & 1))
+    {
+        port->ncq = true;
+        // the disk reports its queue depth - 1
+        port->depth = (identify[75] & 0x1f) + 1;
+        if (port->depth > ahci_slot_count)
+        {
+            port->depth = ahci_slot_count;
+        }
+    }
+    ahci_port_write(port, AHCI_PX_IE, AHCI_PX_IE_USED);
+
+    string_copy(names[index], port->device.name);
+    port->device.block_size = AHCI_SECTOR_SIZE;
+    port->device.block_count = capacity;
+    port->device.ops = &ahci_device_ops;
+    port->device.data = port;
+    ahci_port_count++;
+    block_device_register(&port->device);
+}
+
+/**
+ * Shell command function for showing the disks and their queue statistics
+ *
+ * @param args Arguments string. None expected
+ */
+static int ahci_command(int argc, char **argv)
+{
+    // surpressing unused parameter warnings
+    (void)(argc);
+    (void)(argv);
+    for (int i = 0; i < ahci_port_count; i++)
+    {
+        ahci_port *port = &ahci_ports[i];
+        print(port->device.name, DEFAULT_COLOR_SCHEME);
+        print(": port ", DEFAULT_COLOR_SCHEME);
+        print_int(port->number, DEFAULT_COLOR_SCHEME);
+        print(", ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->device.block_count, DEFAULT_COLOR_SCHEME);
+        print(" sectors, ", DEFAULT_COLOR_SCHEME);
+        print(port->ncq ? "NCQ" : "no NCQ", DEFAULT_COLOR_SCHEME);
+        print(", depth ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->depth, DEFAULT_COLOR_SCHEME);
+        print("\n  Requests: ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->requests, DEFAULT_COLOR_SCHEME);
+        print(", commands: ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->commands, DEFAULT_COLOR_SCHEME);
+        print(", errors: ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->errors, DEFAULT_COLOR_SCHEME);
+        print("\n  Queue depth: max ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->depth_max, DEFAULT_COLOR_SCHEME);
+        print(", average ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->requests ? port->depth_total / port->requests
+                                          : 0,
+                           DEFAULT_COLOR_SCHEME);
+        // timer ticks are 10ms
+        print("\n  Latency: max ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->latency_max * 10, DEFAULT_COLOR_SCHEME);
+        print(" ms, average ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(port->requests
+                               ? port->latency_total * 10 / port->requests
+                               : 0,
+                           DEFAULT_COLOR_SCHEME);
+        print(" ms\n", DEFAULT_COLOR_SCHEME);
+    }
+    print("Interrupts: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ahci_interrupts, DEFAULT_COLOR_SCHEME);
+    print("\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Installs the driver: sets up the disks on the first AHCI controller found
+ * on the PCI bus, registers them as block devices and registers the 'ahci'
+ * shell command. The PCI bus must have been scanned already.
+ */
+void ahci_install()
+{
+    pci_device *pci = pci_find_class(0x01, 0x06, 0);
+    // programming interface 1 is AHCI
+    if (!pci || pci->prog_if != 0x01)
+    {
+        return;
+    }
+    pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+    // registers are memory mapped at BAR5, paging is off so it is accessible
+    ahci_base = (volatile unsigned char *)(pci_bar(pci, 5) & 0xfffffff0);
+    ahci_write(AHCI_GHC, ahci_read(AHCI_GHC) | AHCI_GHC_AE);
+    ahci_slot_count = ((ahci_read(AHCI_CAP) >> 8) & 0x1f) + 1;
+
+    unsigned int implemented = ahci_read(AHCI_PI);
+    for (int i = 0; i < 32 && ahci_port_count < AHCI_MAX_PORTS; i++)
+    {
+        if (!(implemented & (1u << i)))
+        {
+            continue;
+        }
+        unsigned int base = AHCI_PORT_BASE(i);
+        // a device is present and communication is established
+        if ((ahci_read(base + AHCI_PX_SSTS) & 0x0f) != 3 ||
+            ahci_read(base + AHCI_PX_SIG) != AHCI_SIG_ATA)
+        {
+            continue;
+        }
+        ahci_setup_port(i);
+    }
+    if (pci->irq < 16)
+    {
+        irq_install_shared_handler(pci->irq, &ahci_irq_callback);
+    }
+    ahci_write(AHCI_IS, 0xffffffff);
+    ahci_write(AHCI_GHC, ahci_read(AHCI_GHC) | AHCI_GHC_IE);
+    register_command("ahci", ahci_command);
+}
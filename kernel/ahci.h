@@ -0,0 +1,42 @@
+/**
+ * FILENAME :       ahci.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the AHCI SATA driver
+ */
+
+#ifndef AHCI_H
+#define AHCI_H
+
+/** Size of a sector in bytes */
+#define AHCI_SECTOR_SIZE 512
+
+/** Maximum amount of ports driven, each needs about 9kB of memory */
+#define AHCI_MAX_PORTS 2
+
+/** Command slots of a port, the most AHCI allows */
+#define AHCI_SLOTS 32
+
+/**
+ * Maximum amount of sectors transferred by one command. Larger requests are
+ * served by several commands in a row.
+ */
+#define AHCI_MAX_SECTORS 0x4000
+
+/**
+ * Time in timer ticks (1/100 seconds) a command may take, before the port is
+ * restarted
+ */
+#define AHCI_TIMEOUT 500
+
+void ahci_install();
+
+#endif
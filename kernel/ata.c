@@ -0,0 +1,940 @@
+/**
+ * FILENAME :       ata.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A driver for ATA disks on the primary IDE channel. Drives are detected
+ *  with IDENTIFY and addressed with LBA28, or LBA48 beyond 128GB. Data is
+ *  transferred either with READ/WRITE MULTIPLE in PIO mode, or by the PCI IDE
+ *  controller as bus master using a table of physical region descriptors.
+ *  Commands complete with IRQ14, and requests are served asynchronously like
+ *  the floppy's: ata_poll advances the command in progress without waiting.
+ *  Each drive is registered as block device "hd0" or "hd1".
+ */
+
+#include "ata.h"
+#include "block_device.h"
+#include "pci.h"
+#include "irq.h"
+#include "timer.h"
+#include "screen.h"
+#include "shell.h"
+#include "string.h"
+#include "low_level.h"
+#include "bool.h"
+
+#define ATA_IRQ 14
+
+/** I/O ports of the primary channel */
+#define ATA_BASE 0x1f0
+#define ATA_DATA (ATA_BASE + 0)
+#define ATA_ERROR (ATA_BASE + 1)
+#define ATA_SECTOR_COUNT (ATA_BASE + 2)
+#define ATA_LBA_LOW (ATA_BASE + 3)
+#define ATA_LBA_MID (ATA_BASE + 4)
+#define ATA_LBA_HIGH (ATA_BASE + 5)
+#define ATA_DRIVE (ATA_BASE + 6)
+#define ATA_STATUS (ATA_BASE + 7)
+#define ATA_COMMAND (ATA_BASE + 7)
+// reading the alternate status does not acknowledge the interrupt
+#define ATA_ALT_STATUS 0x3f6
+#define ATA_CONTROL 0x3f6
+
+/** Bits of the status register */
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF 0x20
+#define ATA_SR_DRDY 0x40
+#define ATA_SR_BSY 0x80
+
+/** Bits of the device control register */
+#define ATA_CONTROL_NIEN 0x02
+#define ATA_CONTROL_SRST 0x04
+
+/** Commands */
+#define ATA_CMD_READ_SECTORS 0x20
+#define ATA_CMD_READ_SECTORS_EXT 0x24
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE 0xc4
+#define ATA_CMD_WRITE_MULTIPLE 0xc5
+#define ATA_CMD_SET_MULTIPLE 0xc6
+#define ATA_CMD_READ_DMA 0xc8
+#define ATA_CMD_WRITE_DMA 0xca
+#define ATA_CMD_CACHE_FLUSH 0xe7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xea
+#define ATA_CMD_IDENTIFY 0xec
+
+/** Registers of the bus master, relative to its base port */
+#define ATA_BM_COMMAND 0
+#define ATA_BM_STATUS 2
+#define ATA_BM_PRD 4
+
+/** Bits of the bus master registers */
+#define ATA_BM_START 0x01
+// set to transfer from the drive to memory
+#define ATA_BM_READ 0x08
+#define ATA_BM_ERROR 0x02
+#define ATA_BM_INTERRUPT 0x04
+
+/** Highest sector reachable with LBA28 */
+#define ATA_LBA28_LIMIT 0x10000000
+
+/** Status register polls without interrupts until a command times out */
+#define ATA_TIMEOUT_POLLS 3000000
+
+/** Size of the buffer for dma transfers of unaligned request buffers */
+#define ATA_BOUNCE_SECTORS 16
+
+/** Steps of a command */
+#define ATA_STATE_IDLE 0
+// waiting for the next block of a PIO read
+#define ATA_STATE_PIO_READ 1
+// waiting to hand the next block of a PIO write, or for its end
+#define ATA_STATE_PIO_WRITE 2
+// waiting for the end of a bus master transfer
+#define ATA_STATE_DMA 3
+// waiting for the end of a cache flush
+#define ATA_STATE_FLUSH 4
+
+/**
+ * A physical region descriptor, telling the bus master where to transfer
+ * data. A region must not cross a 64kB boundary.
+ */
+typedef struct ata_prd
+{
+    unsigned int address;
+    // byte count, 0 means 64kB
+    unsigned short count;
+    // bit 15 marks the last descriptor of the table
+    unsigned short flags;
+} __attribute__((packed)) ata_prd;
+
+/**
+ * A drive on the channel
+ */
+typedef struct ata_drive
+{
+    // registered block device, its data points to the drive
+    block_device device;
+    bool present;
+    // drive 1 on the channel
+    bool slave;
+    bool lba48;
+    // true if the drive supports multiword dma
+    bool dma;
+    // sectors per block of READ/WRITE MULTIPLE, 0 if unsupported
+    unsigned int multiple;
+    char model[41];
+    // queued requests, served in order
+    block_request *queue_head;
+    block_request *queue_tail;
+    // statistics
+    unsigned int commands;
+    unsigned int sectors;
+    unsigned int errors;
+} ata_drive;
+
+/** Master and slave drive of the channel */
+static ata_drive ata_drives[2];
+
+/** Base port of the bus master of the channel, 0 if there is none */
+static unsigned short ata_bus_master = 0;
+
+/** true to transfer with the bus master, if the drive supports it */
+static bool ata_use_dma = true;
+
+/** Descriptor table of the bus master, the table must not cross 64kB */
+static ata_prd ata_prd_table[2] __attribute__((aligned(16)));
+
+/** Buffer for dma transfers of buffers, which are not word aligned */
+static unsigned char ata_bounce[ATA_BOUNCE_SECTORS * ATA_SECTOR_SIZE]
+    __attribute__((aligned(ATA_BOUNCE_SECTORS * ATA_SECTOR_SIZE)));
+
+/** Set by the interrupt handler */
+static volatile int ata_irq_received = 0;
+
+/** Amount of interrupts raised by the channel */
+static unsigned int ata_interrupts = 0;
+
+/**
+ * The command in progress. Only one command can run on a channel.
+ */
+static struct
+{
+    // one of the ATA_STATE_ values
+    int state;
+    ata_drive *drive;
+    block_request *request;
+    // sectors of the request done by previous commands
+    unsigned int done;
+    // first sector and amount of sectors of the command
+    unsigned int sector;
+    unsigned int count;
+    // sectors of the command transferred so far in PIO mode
+    unsigned int transferred;
+    // true if the bus master uses ata_bounce
+    bool bounce;
+    // tick at which the command times out
+    unsigned int deadline;
+    // status register polls while interrupts are off
+    unsigned int polls;
+} ata_command;
+
+/**
+ * Waits 400ns by reading the alternate status register, which takes 100ns
+ * on the ISA bus. Needed after selecting a drive.
+ */
+static void ata_delay()
+{
+    for (int i = 0; i < 4; i++)
+    {
+        port_byte_in(ATA_ALT_STATUS);
+    }
+}
+
+/**
+ * Spins until the drive is not busy anymore
+ *
+ * @return int 0 on success, -1 on timeout
+ */
+static int ata_wait_not_busy()
+{
+    for (unsigned int i = 0; i < ATA_TIMEOUT_POLLS; i++)
+    {
+        if (!(port_byte_in(ATA_ALT_STATUS) & ATA_SR_BSY))
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Resets both drives of the channel, e.g. after a command timed out
+ */
+static void ata_reset()
+{
+    port_byte_out(ATA_CONTROL, ATA_CONTROL_SRST);
+    ata_delay();
+    port_byte_out(ATA_CONTROL, 0);
+    ata_delay();
+    ata_wait_not_busy();
+    ata_irq_received = 0;
+}
+
+/**
+ * Selects a drive and writes the address and sector count of a command
+ *
+ * @param drive the drive
+ * @param sector first sector
+ * @param count amount of sectors, 1 to 256 with LBA28, 1 to 65536 with LBA48
+ * @param lba48 true to use 48 bit addressing
+ */
+static void ata_setup(ata_drive *drive, unsigned int sector, unsigned int count,
+                      bool lba48)
+{
+    unsigned char select = 0x40 | (drive->slave ? 0x10 : 0);
+    if (lba48)
+    {
+        port_byte_out(ATA_DRIVE, select);
+        ata_delay();
+        // high bytes first, the registers are FIFOs of two bytes
+        port_byte_out(ATA_SECTOR_COUNT, count >> 8);
+        port_byte_out(ATA_LBA_LOW, sector >> 24);
+        port_byte_out(ATA_LBA_MID, 0);
+        port_byte_out(ATA_LBA_HIGH, 0);
+    }
+    else
+    {
+        port_byte_out(ATA_DRIVE, select | 0xa0 | ((sector >> 24) & 0x0f));
+        ata_delay();
+    }
+    port_byte_out(ATA_SECTOR_COUNT, count & 0xff);
+    port_byte_out(ATA_LBA_LOW, sector & 0xff);
+    port_byte_out(ATA_LBA_MID, (sector >> 8) & 0xff);
+    port_byte_out(ATA_LBA_HIGH, (sector >> 16) & 0xff);
+}
+
+/**
+ * Checks whether the channel is ready for the next step of a command without
+ * blocking. Falls back to polling the status register while interrupts are
+ * disabled.
+ *
+ * @return int 1 if the drive raised an interrupt or is ready, 0 otherwise
+ */
+static int ata_step_finished()
+{
+    if (ata_irq_received ||
+        (!interrupts_enabled() && !(port_byte_in(ATA_ALT_STATUS) & ATA_SR_BSY)))
+    {
+        ata_irq_received = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Checks whether the current step of the command takes too long
+ *
+ * @return int 1 if it timed out, 0 otherwise
+ */
+static int ata_step_timed_out()
+{
+    if (interrupts_enabled())
+    {
+        return (int)(timer_get_ticks() - ata_command.deadline) > 0;
+    }
+    return ++ata_command.polls > ATA_TIMEOUT_POLLS;
+}
+
+/**
+ * Begins a new step of the command, which ends with an interrupt
+ *
+ * @param state the step
+ */
+static void ata_begin_step(int state)
+{
+    ata_command.state = state;
+    ata_command.deadline = timer_get_ticks() + ATA_TIMEOUT;
+    ata_command.polls = 0;
+}
+
+/**
+ * Address of the part of the request's buffer the command transfers
+ *
+ * @return unsigned char* first byte of the command's data
+ */
+static unsigned char *ata_command_buffer()
+{
+    return ata_command.request->buffer +
+           ata_command.done * ATA_SECTOR_SIZE;
+}
+
+/**
+ * Fills the descriptor table of the bus master for the command, either with
+ * the request's buffer or with the bounce buffer
+ */
+static void ata_setup_prd()
+{
+    unsigned int address = (unsigned int)ata_command_buffer();
+    unsigned int length = ata_command.count * ATA_SECTOR_SIZE;
+    if (ata_command.bounce)
+    {
+        address = (unsigned int)ata_bounce;
+        if (ata_command.request->write)
+        {
+            memcpy(ata_bounce, ata_command_buffer(), length);
+        }
+    }
+    // split the region at the 64kB boundary, at most one lies within 64kB
+    unsigned int first = 0x10000 - (address & 0xffff);
+    if (first >= length)
+    {
+        ata_prd_table[0].address = address;
+        ata_prd_table[0].count = length & 0xffff;
+        ata_prd_table[0].flags = 0x8000;
+        return;
+    }
+    ata_prd_table[0].address = address;
+    ata_prd_table[0].count = first & 0xffff;
+    ata_prd_table[0].flags = 0;
+    ata_prd_table[1].address = address + first;
+    ata_prd_table[1].count = (length - first) & 0xffff;
+    ata_prd_table[1].flags = 0x8000;
+}
+
+/**
+ * Transfers the next block of a PIO command between the drive and the
+ * request's buffer
+ */
+static void ata_pio_block()
+{
+    unsigned int block = ata_command.drive->multiple
+                             ? ata_command.drive->multiple
+                             : 1;
+    if (block > ata_command.count - ata_command.transferred)
+    {
+        block = ata_command.count - ata_command.transferred;
+    }
+    unsigned short *buffer =
+        (unsigned short *)(ata_command_buffer() +
+                           ata_command.transferred * ATA_SECTOR_SIZE);
+    if (ata_command.request->write)
+    {
+        port_words_out(ATA_DATA, buffer, block * ATA_SECTOR_SIZE / 2);
+    }
+    else
+    {
+        port_words_in(ATA_DATA, buffer, block * ATA_SECTOR_SIZE / 2);
+    }
+    ata_command.transferred += block;
+}
+
+/**
+ * Starts the next command of the request in progress
+ */
+static void ata_start_command()
+{
+    ata_drive *drive = ata_command.drive;
+    block_request *request = ata_command.request;
+    unsigned int count = request->count - ata_command.done;
+    unsigned int sector = request->block + ata_command.done;
+    if (count > ATA_MAX_SECTORS)
+    {
+        count = ATA_MAX_SECTORS;
+    }
+    bool dma = ata_use_dma && drive->dma && ata_bus_master;
+    bool bounce = dma && ((unsigned int)ata_command_buffer() & 1);
+    if (bounce && count > ATA_BOUNCE_SECTORS)
+    {
+        count = ATA_BOUNCE_SECTORS;
+    }
+    bool lba48 = drive->lba48 && sector + count > ATA_LBA28_LIMIT;
+    ata_command.sector = sector;
+    ata_command.count = count;
+    ata_command.transferred = 0;
+    ata_command.bounce = bounce;
+    drive->commands++;
+
+    ata_irq_received = 0;
+    if (dma)
+    {
+        ata_setup_prd();
+        port_byte_out(ata_bus_master + ATA_BM_COMMAND, 0);
+        port_long_out(ata_bus_master + ATA_BM_PRD,
+                      (unsigned int)ata_prd_table);
+        // writing ones clears the error and interrupt bits
+        port_byte_out(ata_bus_master + ATA_BM_STATUS,
+                      ATA_BM_ERROR | ATA_BM_INTERRUPT);
+        port_byte_out(ata_bus_master + ATA_BM_COMMAND,
+                      request->write ? 0 : ATA_BM_READ);
+        ata_setup(drive, sector, count, lba48);
+        port_byte_out(ATA_COMMAND,
+                      request->write ? (lba48 ? ATA_CMD_WRITE_DMA_EXT
+                                              : ATA_CMD_WRITE_DMA)
+                                     : (lba48 ? ATA_CMD_READ_DMA_EXT
+                                              : ATA_CMD_READ_DMA));
+        port_byte_out(ata_bus_master + ATA_BM_COMMAND,
+                      (request->write ? 0 : ATA_BM_READ) | ATA_BM_START);
+        ata_begin_step(ATA_STATE_DMA);
+        return;
+    }
+
+    ata_setup(drive, sector, count, lba48);
+    unsigned char command;
+    if (drive->multiple)
+    {
+        command = request->write
+                      ? (lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT
+                               : ATA_CMD_WRITE_MULTIPLE)
+                      : (lba48 ? ATA_CMD_READ_MULTIPLE_EXT
+                               : ATA_CMD_READ_MULTIPLE);
+    }
+    else
+    {
+        command = request->write
+                      ? (lba48 ? ATA_CMD_WRITE_SECTORS_EXT
+                               : ATA_CMD_WRITE_SECTORS)
+                      : (lba48 ? ATA_CMD_READ_SECTORS_EXT
+                               : ATA_CMD_READ_SECTORS);
+    }
+    port_byte_out(ATA_COMMAND, command);
+    if (!request->write)
+    {
+        ata_begin_step(ATA_STATE_PIO_READ);
+        return;
+    }
+    // the first block of a write is handed over without an interrupt
+    ata_delay();
+    for (unsigned int i = 0; i < ATA_TIMEOUT_POLLS; i++)
+    {
+        unsigned char status = port_byte_in(ATA_ALT_STATUS);
+        if (!(status & ATA_SR_BSY) &&
+            (status & (ATA_SR_DRQ | ATA_SR_ERR | ATA_SR_DF)))
+        {
+            break;
+        }
+    }
+    if (port_byte_in(ATA_ALT_STATUS) & ATA_SR_DRQ)
+    {
+        ata_pio_block();
+    }
+    ata_begin_step(ATA_STATE_PIO_WRITE);
+}
+
+/**
+ * Completes the request in progress
+ *
+ * @param status BLOCK_REQUEST_DONE or BLOCK_REQUEST_FAILED
+ */
+static void ata_complete(int status)
+{
+    block_request *request = ata_command.request;
+    if (status == BLOCK_REQUEST_FAILED)
+    {
+        ata_command.drive->errors++;
+    }
+    ata_command.state = ATA_STATE_IDLE;
+    ata_command.request = 0;
+    request->status = status;
+    if (request->callback)
+    {
+        request->callback(request);
+    }
+}
+
+/**
+ * Ends the command in progress and starts the next one of the request, if it
+ * has sectors left
+ */
+static void ata_command_done()
+{
+    if (ata_command.bounce && !ata_command.request->write)
+    {
+        memcpy(ata_command_buffer(), ata_bounce,
+               ata_command.count * ATA_SECTOR_SIZE);
+    }
+    ata_command.drive->sectors += ata_command.count;
+    ata_command.done += ata_command.count;
+    if (ata_command.done >= ata_command.request->count)
+    {
+        ata_complete(BLOCK_REQUEST_DONE);
+        return;
+    }
+    ata_start_command();
+}
+
+/**
+ * Takes the next request of the drives' queues and starts it. The drives
+ * take turns.
+ *
+ * @return int 1 if a request was started, 0 if the queues are empty
+ */
+static int ata_start_next()
+{
+    static int turn = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        ata_drive *drive = &ata_drives[(turn + i) % 2];
+        block_request *request = drive->queue_head;
+        if (!request)
+        {
+            continue;
+        }
+        drive->queue_head = request->next;
+        if (!drive->queue_head)
+        {
+            drive->queue_tail = 0;
+        }
+        request->next = 0;
+        turn = (turn + i + 1) % 2;
+        ata_command.drive = drive;
+        ata_command.request = request;
+        ata_command.done = 0;
+        if (request->count == 0)
+        {
+            ata_complete(BLOCK_REQUEST_DONE);
+            return 1;
+        }
+        ata_start_command();
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Carries on with the requests of both drives as far as possible without
+ * waiting
+ *
+ * @return int 1 while there are requests left, 0 once the channel is idle
+ */
+static int ata_poll()
+{
+    while (true)
+    {
+        if (ata_command.state == ATA_STATE_IDLE && !ata_command.request)
+        {
+            if (!ata_start_next())
+            {
+                return 0;
+            }
+            continue;
+        }
+        if (!ata_step_finished())
+        {
+            if (!ata_step_timed_out())
+            {
+                return 1;
+            }
+            print("ata: command timed out\n", DEFAULT_COLOR_SCHEME);
+            if (ata_command.state == ATA_STATE_DMA)
+            {
+                port_byte_out(ata_bus_master + ATA_BM_COMMAND, 0);
+            }
+            ata_reset();
+            ata_complete(BLOCK_REQUEST_FAILED);
+            continue;
+        }
+        unsigned char bm_status = 0;
+        if (ata_command.state == ATA_STATE_DMA)
+        {
+            bm_status = port_byte_in(ata_bus_master + ATA_BM_STATUS);
+            port_byte_out(ata_bus_master + ATA_BM_COMMAND, 0);
+            port_byte_out(ata_bus_master + ATA_BM_STATUS,
+                          ATA_BM_ERROR | ATA_BM_INTERRUPT);
+        }
+        // reading the status acknowledges the interrupt
+        unsigned char status = port_byte_in(ATA_STATUS);
+        if ((status & (ATA_SR_ERR | ATA_SR_DF)) || (bm_status & ATA_BM_ERROR))
+        {
+            print("ata: command failed\n", DEFAULT_COLOR_SCHEME);
+            ata_complete(BLOCK_REQUEST_FAILED);
+            continue;
+        }
+        switch (ata_command.state)
+        {
+        case ATA_STATE_PIO_READ:
+            if (!(status & ATA_SR_DRQ))
+            {
+                // not the interrupt of a block, keep waiting
+                continue;
+            }
+            ata_pio_block();
+            if (ata_command.transferred < ata_command.count)
+            {
+                ata_begin_step(ATA_STATE_PIO_READ);
+                continue;
+            }
+            ata_command_done();
+            break;
+        case ATA_STATE_PIO_WRITE:
+            if (ata_command.transferred < ata_command.count)
+            {
+                if (status & ATA_SR_DRQ)
+                {
+                    ata_pio_block();
+                }
+                ata_begin_step(ATA_STATE_PIO_WRITE);
+                continue;
+            }
+            ata_command_done();
+            break;
+        case ATA_STATE_FLUSH:
+            ata_complete(BLOCK_REQUEST_DONE);
+            break;
+        default:
+            ata_command_done();
+            break;
+        }
+    }
+}
+
+/**
+ * Interrupt handler for IRQ14, raised by the drives of the primary channel
+ *
+ * @param regs registers as pushed by the assembly code
+ */
+static void ata_irq_callback(struct regs *regs)
+{
+    // avoid unused parameter warning
+    (void)(regs);
+    ata_interrupts++;
+    ata_irq_received = 1;
+}
+
+/**
+ * Block device operation queueing a request
+ *
+ * @param device a drive
+ * @param request request to queue
+ */
+static void ata_device_submit(block_device *device, block_request *request)
+{
+    ata_drive *drive = (ata_drive *)device->data;
+    request->next = 0;
+    if (drive->queue_tail)
+    {
+        drive->queue_tail->next = request;
+    }
+    else
+    {
+        drive->queue_head = request;
+    }
+    drive->queue_tail = request;
+    // start right away, if the channel is idle
+    ata_poll();
+}
+
+/**
+ * Block device operation serving queued requests
+ *
+ * @param device a drive
+ * @return int 1 while requests are being served, 0 once the channel is idle
+ */
+static int ata_device_poll(block_device *device)
+{
+    (void)(device);
+    return ata_poll();
+}
+
+/**
+ * Block device operation writing the drive's write cache to the disk
+ *
+ * @param device a drive
+ * @return int 0 on success, -1 on failure
+ */
+static int ata_device_flush(block_device *device)
+{
+    ata_drive *drive = (ata_drive *)device->data;
+    block_request request;
+    request.block = 0;
+    request.count = 0;
+    request.buffer = 0;
+    request.write = true;
+    request.callback = 0;
+    request.context = 0;
+    request.status = BLOCK_REQUEST_PENDING;
+    request.next = 0;
+    // the device is idle, as the block layer waited for all requests
+    while (ata_poll())
+    {
+        block_sleep();
+    }
+    ata_command.drive = drive;
+    ata_command.request = &request;
+    ata_command.done = 0;
+    ata_irq_received = 0;
+    ata_setup(drive, 0, 0, false);
+    port_byte_out(ATA_COMMAND,
+                  drive->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    ata_begin_step(ATA_STATE_FLUSH);
+    while (ata_poll())
+    {
+        block_sleep();
+    }
+    return request.status == BLOCK_REQUEST_DONE ? 0 : -1;
+}
+
+/** Operations of the drives */
+static const block_device_ops ata_device_ops = {
+    ata_device_submit,
+    ata_device_poll,
+    ata_device_flush,
+};
+
+/**
+ * Sets the amount of sectors per block of READ/WRITE MULTIPLE
+ *
+ * @param drive the drive
+ * @param count sectors per block
+ * @return int 0 on success, -1 if the drive refused
+ */
+static int ata_set_multiple(ata_drive *drive, unsigned int count)
+{
+    ata_setup(drive, 0, count, false);
+    port_byte_out(ATA_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ata_delay();
+    if (ata_wait_not_busy())
+    {
+        return -1;
+    }
+    return (port_byte_in(ATA_STATUS) & ATA_SR_ERR) ? -1 : 0;
+}
+
+/**
+ * Detects a drive with IDENTIFY and registers it as block device
+ *
+ * @param index 0 for the master, 1 for the slave
+ */
+static void ata_identify(int index)
+{
+    ata_drive *drive = &ata_drives[index];
+    unsigned short identify[256];
+    drive->present = false;
+    drive->slave = index == 1;
+    drive->queue_head = 0;
+    drive->queue_tail = 0;
+
+    port_byte_out(ATA_DRIVE, 0xa0 | (drive->slave ? 0x10 : 0));
+    ata_delay();
+    port_byte_out(ATA_SECTOR_COUNT, 0);
+    port_byte_out(ATA_LBA_LOW, 0);
+    port_byte_out(ATA_LBA_MID, 0);
+    port_byte_out(ATA_LBA_HIGH, 0);
+    port_byte_out(ATA_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay();
+    if (port_byte_in(ATA_STATUS) == 0 || ata_wait_not_busy())
+    {
+        // no drive
+        return;
+    }
+    if (port_byte_in(ATA_LBA_MID) || port_byte_in(ATA_LBA_HIGH))
+    {
+        // not an ATA drive, e.g. an ATAPI cd drive
+        return;
+    }
+    unsigned char status = 0;
+    for (unsigned int i = 0; i < ATA_TIMEOUT_POLLS; i++)
+    {
+        status = port_byte_in(ATA_STATUS);
+        if (status & (ATA_SR_DRQ | ATA_SR_ERR))
+        {
+            break;
+        }
+    }
+    if (!(status & ATA_SR_DRQ) || (status & ATA_SR_ERR))
+    {
+        return;
+    }
+    port_words_in(ATA_DATA, identify, 256);
+
+    // the model name is stored with swapped bytes
+    for (int i = 0; i < 20; i++)
+    {
+        drive->model[i * 2] = identify[27 + i] >> 8;
+        drive->model[i * 2 + 1] = identify[27 + i] & 0xff;
+    }
+    drive->model[40] = 0;
+    for (int i = 39; i >= 0 && drive->model[i] == ' '; i--)
+    {
+        drive->model[i] = 0;
+    }
+    drive->lba48 = (identify[83] >> 10) & 1;
+    drive->dma = (identify[49] >> 8) & 1;
+    unsigned int capacity = identify[60] | (identify[61] << 16);
+    if (drive->lba48)
+    {
+        // the upper words would exceed the 32 bit block numbers
+        capacity = identify[100] | (identify[101] << 16);
+        if (identify[102] || identify[103])
+        {
+            capacity = 0xffffffff;
+        }
+    }
+    drive->multiple = identify[47] & 0xff;
+    if (drive->multiple && ata_set_multiple(drive, drive->multiple))
+    {
+        drive->multiple = 0;
+    }
+    drive->present = true;
+
+    string_copy(index ? "hd1" : "hd0", drive->device.name);
+    drive->device.block_size = ATA_SECTOR_SIZE;
+    drive->device.block_count = capacity;
+    drive->device.ops = &ata_device_ops;
+    drive->device.data = drive;
+    block_device_register(&drive->device);
+}
+
+/**
+ * Finds the bus master of the primary channel on the PCI IDE controller
+ */
+static void ata_find_bus_master()
+{
+    pci_device *controller = pci_find_class(0x01, 0x01, 0);
+    // bit 7 of the programming interface marks bus master support
+    if (!controller || !(controller->prog_if & 0x80))
+    {
+        return;
+    }
+    unsigned int bar = pci_bar(controller, 4);
+    if (!(bar & 1))
+    {
+        return;
+    }
+    pci_enable(controller, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    ata_bus_master = bar & 0xfffc;
+}
+
+/**
+ * Shell command function for showing the drives, or choosing the transfer
+ * mode
+ *
+ * @param args Arguments string. Optionally "pio" or "dma"
+ */
+static int ata_shell_command(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        if (string_equals(argv[1], "pio"))
+        {
+            ata_use_dma = false;
+        }
+        else if (string_equals(argv[1], "dma"))
+        {
+            ata_use_dma = true;
+        }
+        else
+        {
+            print("Usage: ata [pio|dma]\n", DEFAULT_COLOR_SCHEME);
+            return 1;
+        }
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        ata_drive *drive = &ata_drives[i];
+        if (!drive->present)
+        {
+            continue;
+        }
+        print(drive->device.name, DEFAULT_COLOR_SCHEME);
+        print(": ", DEFAULT_COLOR_SCHEME);
+        print(drive->model, DEFAULT_COLOR_SCHEME);
+        print("\n  ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(drive->device.block_count, DEFAULT_COLOR_SCHEME);
+        print(" sectors, ", DEFAULT_COLOR_SCHEME);
+        print(drive->lba48 ? "LBA48" : "LBA28", DEFAULT_COLOR_SCHEME);
+        print(", ", DEFAULT_COLOR_SCHEME);
+        print(ata_use_dma && drive->dma && ata_bus_master ? "DMA" : "PIO",
+              DEFAULT_COLOR_SCHEME);
+        print(", multiple ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(drive->multiple, DEFAULT_COLOR_SCHEME);
+        print("\n  Commands: ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(drive->commands, DEFAULT_COLOR_SCHEME);
+        print(", sectors: ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(drive->sectors, DEFAULT_COLOR_SCHEME);
+        print(", errors: ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(drive->errors, DEFAULT_COLOR_SCHEME);
+        print("\n", DEFAULT_COLOR_SCHEME);
+    }
+    print("Interrupts: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ata_interrupts, DEFAULT_COLOR_SCHEME);
+    print("\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Installs the driver: detects the drives of the primary channel, registers
+ * them as block devices and registers the 'ata' shell command. The PCI bus
+ * must have been scanned already.
+ */
+void ata_install()
+{
+    // a floating bus reads as 0xff, there is no controller
+    if (port_byte_in(ATA_STATUS) == 0xff)
+    {
+        return;
+    }
+    ata_command.state = ATA_STATE_IDLE;
+    ata_command.request = 0;
+    ata_find_bus_master();
+    irq_install_handler(ATA_IRQ, &ata_irq_callback);
+    // enable interrupts of the drives
+    port_byte_out(ATA_CONTROL, 0);
+    ata_identify(0);
+    ata_identify(1);
+    ata_irq_received = 0;
+    register_command("ata", ata_shell_command);
+}
@@ -0,0 +1,36 @@
+/**
+ * FILENAME :       ata.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the ATA disk driver of the primary IDE channel
+ */
+
+#ifndef ATA_H
+#define ATA_H
+
+/** Size of a sector in bytes */
+#define ATA_SECTOR_SIZE 512
+
+/**
+ * Maximum amount of sectors transferred by one command. Larger requests are
+ * split into several commands.
+ */
+#define ATA_MAX_SECTORS 128
+
+/**
+ * Time in timer ticks (1/100 seconds) a command may take, before the channel
+ * is reset
+ */
+#define ATA_TIMEOUT 300
+
+void ata_install();
+
+#endif
@@ -0,0 +1,434 @@
+/**
+ * FILENAME :       block_device.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A registry of block devices and helpers on top of their operations.
+ *  Drivers serve requests asynchronously: requests are submitted, and the
+ *  kernel's main loop polls all devices, which complete the requests.
+ *  Synchronous reads and writes wait for their request while polling.
+ */
+
+#include "block_device.h"
+#include "screen.h"
+#include "shell.h"
+#include "string.h"
+#include "low_level.h"
+#include "timer.h"
+
+/** Size of the requests issued by the 'bench' command in blocks */
+#define BLOCK_BENCH_REQUEST_BLOCKS 8
+/** Maximum amount of requests in flight during a benchmark */
+#define BLOCK_BENCH_MAX_DEPTH 8
+/** Largest block size the benchmark buffers can hold */
+#define BLOCK_BENCH_BLOCK_SIZE 512
+
+/** All registered devices */
+static block_device *block_devices[BLOCK_DEVICE_MAX_COUNT];
+
+/** Amount of registered devices */
+static int block_device_count = 0;
+
+/** Buffers and requests of the 'bench' command */
+static unsigned char block_bench_buffers[BLOCK_BENCH_MAX_DEPTH]
+                                        [BLOCK_BENCH_REQUEST_BLOCKS *
+                                         BLOCK_BENCH_BLOCK_SIZE];
+static block_request block_bench_requests[BLOCK_BENCH_MAX_DEPTH];
+
+/**
+ * Registers a block device, so it can be found by its name
+ *
+ * @param device device to register, must stay valid
+ * @return int 0 on success, -1 if the registry is full
+ */
+int block_device_register(block_device *device)
+{
+    if (block_device_count >= BLOCK_DEVICE_MAX_COUNT)
+    {
+        print("block_device_register: too many devices\n",
+              DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    block_devices[block_device_count++] = device;
+    return 0;
+}
+
+/**
+ * Finds a registered device by its name
+ *
+ * @param name name of the device
+ * @return block_device* the device, or 0 if there is none with that name
+ */
+block_device *block_device_find(char *name)
+{
+    for (int i = 0; i < block_device_count; i++)
+    {
+        if (string_equals(block_devices[i]->name, name))
+        {
+            return block_devices[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns a registered device by its position in the registry
+ *
+ * @param index position, starting at 0
+ * @return block_device* the device, or 0 if index is out of range
+ */
+block_device *block_device_get(int index)
+{
+    if (index < 0 || index >= block_device_count)
+    {
+        return 0;
+    }
+    return block_devices[index];
+}
+
+/**
+ * Hands a request to the driver of a device. Requests outside of the device
+ * fail right away.
+ *
+ * @param device target device
+ * @param request request to submit, owned by the caller
+ * @return int 0 if the request was submitted, -1 if it failed
+ */
+int block_submit(block_device *device, block_request *request)
+{
+    request->next = 0;
+    if (request->block + request->count > device->block_count ||
+        request->block + request->count < request->block)
+    {
+        print("block_submit: block out of range\n", DEFAULT_COLOR_SCHEME);
+        request->status = BLOCK_REQUEST_FAILED;
+        if (request->callback)
+        {
+            request->callback(request);
+        }
+        return -1;
+    }
+    request->status = BLOCK_REQUEST_PENDING;
+    device->ops->submit(device, request);
+    return 0;
+}
+
+/**
+ * Lets the driver of a device carry on with its requests without waiting
+ *
+ * @param device device to poll
+ * @return int 1 while the device has requests left, 0 once it is idle
+ */
+int block_poll(block_device *device)
+{
+    return device->ops->poll(device);
+}
+
+/**
+ * Polls every registered device. Meant to be called from the kernel's main
+ * loop, so requests are served in the background.
+ */
+void block_poll_all()
+{
+    for (int i = 0; i < block_device_count; i++)
+    {
+        block_poll(block_devices[i]);
+    }
+}
+
+/**
+ * Halts the processor until the next interrupt, when nothing can be done
+ * but waiting for a device. Returns right away if interrupts are disabled.
+ */
+void block_sleep()
+{
+    if (interrupts_enabled())
+    {
+        cpu_halt();
+    }
+}
+
+/**
+ * Serves the requests of a device until the given one is completed
+ *
+ * @param device device the request was submitted to
+ * @param request a submitted request
+ * @return int 0 if the request succeeded, -1 otherwise
+ */
+int block_wait(block_device *device, block_request *request)
+{
+    while (request->status == BLOCK_REQUEST_PENDING)
+    {
+        if (!block_poll(device))
+        {
+            break;
+        }
+        if (request->status == BLOCK_REQUEST_PENDING)
+        {
+            block_sleep();
+        }
+    }
+    return request->status == BLOCK_REQUEST_DONE ? 0 : -1;
+}
+
+/**
+ * Serves all requests of a device until it is idle
+ *
+ * @param device device to serve
+ */
+void block_run(block_device *device)
+{
+    while (block_poll(device))
+    {
+        block_sleep();
+    }
+}
+
+/**
+ * Transfers consecutive blocks and waits for the transfer to finish
+ *
+ * @param device device to use
+ * @param block first block
+ * @param count amount of blocks
+ * @param buffer source or destination of count * block_size bytes
+ * @param write true to write, false to read
+ * @return int 0 on success, -1 on failure
+ */
+static int block_transfer(block_device *device, unsigned int block,
+                          unsigned int count, void *buffer, bool write)
+{
+    block_request request;
+    request.block = block;
+    request.count = count;
+    request.buffer = buffer;
+    request.write = write;
+    request.callback = 0;
+    request.context = 0;
+    if (block_submit(device, &request))
+    {
+        return -1;
+    }
+    return block_wait(device, &request);
+}
+
+/**
+ * Reads consecutive blocks from a device
+ *
+ * @param device device to read from
+ * @param block first block
+ * @param count amount of blocks
+ * @param buffer destination of count * block_size bytes
+ * @return int 0 on success, -1 on failure
+ */
+int block_read(block_device *device, unsigned int block, unsigned int count,
+               void *buffer)
+{
+    return block_transfer(device, block, count, buffer, false);
+}
+
+/**
+ * Writes consecutive blocks to a device
+ *
+ * @param device device to write to
+ * @param block first block
+ * @param count amount of blocks
+ * @param buffer source of count * block_size bytes
+ * @return int 0 on success, -1 on failure
+ */
+int block_write(block_device *device, unsigned int block, unsigned int count,
+                void *buffer)
+{
+    return block_transfer(device, block, count, buffer, true);
+}
+
+/**
+ * Waits for all requests of a device and makes sure the written data reached
+ * the medium
+ *
+ * @param device device to flush
+ * @return int 0 on success, -1 on failure
+ */
+int block_flush(block_device *device)
+{
+    block_run(device);
+    if (device->ops->flush)
+    {
+        return device->ops->flush(device);
+    }
+    return 0;
+}
+
+/**
+ * Shell command function for listing all registered block devices
+ *
+ * @param args Arguments string. None expected
+ */
+static int devices_command(int argc, char **argv)
+{
+    // surpressing unused parameter warnings
+    (void)(argc);
+    (void)(argv);
+    for (int i = 0; i < block_device_count; i++)
+    {
+        block_device *device = block_devices[i];
+        print(device->name, DEFAULT_COLOR_SCHEME);
+        print(": ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(device->block_count, DEFAULT_COLOR_SCHEME);
+        print(" blocks of ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(device->block_size, DEFAULT_COLOR_SCHEME);
+        print(" bytes (", DEFAULT_COLOR_SCHEME);
+        // in kB, without overflowing for large devices
+        print_unsigned_int(device->block_size >= 1024
+                               ? device->block_count * (device->block_size / 1024)
+                               : device->block_count / (1024 / device->block_size),
+                           DEFAULT_COLOR_SCHEME);
+        print(" kB)\n", DEFAULT_COLOR_SCHEME);
+    }
+    return 0;
+}
+
+/**
+ * Reads blocks from the beginning of a device with a given amount of requests
+ * in flight and measures the time
+ *
+ * @param device device to read from
+ * @param blocks amount of blocks to read
+ * @param depth amount of requests in flight
+ * @return unsigned int elapsed timer ticks, 0 if a request failed
+ */
+static unsigned int block_bench(block_device *device, unsigned int blocks,
+                                unsigned int depth)
+{
+    unsigned int next = 0;
+    unsigned int completed = 0;
+    int failed = 0;
+    unsigned int start = timer_get_ticks();
+    for (unsigned int i = 0; i < depth; i++)
+    {
+        block_bench_requests[i].status = BLOCK_REQUEST_DONE;
+    }
+    while (completed < blocks)
+    {
+        for (unsigned int i = 0; i < depth; i++)
+        {
+            block_request *request = &block_bench_requests[i];
+            if (request->status == BLOCK_REQUEST_PENDING)
+            {
+                continue;
+            }
+            if (request->status == BLOCK_REQUEST_FAILED)
+            {
+                failed = 1;
+            }
+            if (next >= blocks)
+            {
+                continue;
+            }
+            // keep the request in flight with the next blocks
+            request->block = next;
+            request->count = blocks - next < BLOCK_BENCH_REQUEST_BLOCKS
+                                 ? blocks - next
+                                 : BLOCK_BENCH_REQUEST_BLOCKS;
+            request->buffer = block_bench_buffers[i];
+            request->write = false;
+            request->callback = 0;
+            request->context = 0;
+            next += request->count;
+            block_submit(device, request);
+        }
+        completed = next;
+        for (unsigned int i = 0; i < depth; i++)
+        {
+            if (block_bench_requests[i].status == BLOCK_REQUEST_PENDING)
+            {
+                completed -= block_bench_requests[i].count;
+            }
+        }
+        if (completed < blocks && block_poll(device))
+        {
+            block_sleep();
+        }
+    }
+    for (unsigned int i = 0; i < depth; i++)
+    {
+        if (block_bench_requests[i].status == BLOCK_REQUEST_FAILED)
+        {
+            failed = 1;
+        }
+    }
+    unsigned int ticks = timer_get_ticks() - start;
+    if (failed)
+    {
+        return 0;
+    }
+    return ticks ? ticks : 1;
+}
+
+/**
+ * Shell command function for measuring the read throughput of a device
+ *
+ * @param args Arguments string. Expected format:
+ * bench device [blocks] [depth]
+ */
+static int bench_command(int argc, char **argv)
+{
+    unsigned int blocks = 2048;
+    unsigned int depth = 1;
+    block_device *device = argc > 1 ? block_device_find(argv[1]) : 0;
+    if (!device || (argc > 2 && string_to_unsigned_int(argv[2], &blocks)) ||
+        (argc > 3 && string_to_unsigned_int(argv[3], &depth)))
+    {
+        print("Usage: bench device [blocks] [depth]\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    if (device->block_size > BLOCK_BENCH_BLOCK_SIZE)
+    {
+        print("Error: block size not supported\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    if (depth < 1)
+    {
+        depth = 1;
+    }
+    if (depth > BLOCK_BENCH_MAX_DEPTH)
+    {
+        depth = BLOCK_BENCH_MAX_DEPTH;
+    }
+    if (blocks > device->block_count)
+    {
+        blocks = device->block_count;
+    }
+    unsigned int ticks = block_bench(device, blocks, depth);
+    if (!ticks)
+    {
+        print("Error: reading failed\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    unsigned int kilobytes = blocks / 2 * device->block_size / 512;
+    print_unsigned_int(kilobytes, DEFAULT_COLOR_SCHEME);
+    print(" kB with depth ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(depth, DEFAULT_COLOR_SCHEME);
+    print(" in ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ticks * 10, DEFAULT_COLOR_SCHEME);
+    print(" ms: ", DEFAULT_COLOR_SCHEME);
+    // timer ticks are 10ms
+    print_unsigned_int(kilobytes * 100 / ticks, DEFAULT_COLOR_SCHEME);
+    print(" kB/s\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Registers the shell commands of the block device layer
+ */
+void block_device_install()
+{
+    register_command("devices", devices_command);
+    register_command("bench", bench_command);
+}
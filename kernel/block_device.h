@@ -0,0 +1,107 @@
+/**
+ * FILENAME :       block_device.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for block devices. Every storage driver registers its devices
+ *  with a table of operations, so the cache and file system can work on any
+ *  of them.
+ */
+
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include "bool.h"
+
+/** Maximum amount of registered block devices */
+#define BLOCK_DEVICE_MAX_COUNT 8
+/** Maximum length of a device name including the terminating 0 */
+#define BLOCK_DEVICE_NAME_LENGTH 16
+
+/** States of a block request */
+#define BLOCK_REQUEST_PENDING 0
+#define BLOCK_REQUEST_DONE 1
+#define BLOCK_REQUEST_FAILED 2
+
+/**
+ * A request to read or write consecutive blocks. The memory of a request is
+ * owned by the caller and must stay valid until it is completed.
+ */
+typedef struct block_request
+{
+    // first block
+    unsigned int block;
+    // amount of blocks
+    unsigned int count;
+    // source or destination of count * block_size bytes
+    unsigned char *buffer;
+    // true to write the buffer to the device, false to read
+    bool write;
+    // called when the request is completed, may be 0
+    void (*callback)(struct block_request *request);
+    // free for use by the caller, e.g. in the callback
+    void *context;
+    // one of the BLOCK_REQUEST_ states
+    volatile int status;
+    // next request in a driver's queue
+    struct block_request *next;
+} block_request;
+
+struct block_device;
+
+/**
+ * Operations every block device driver implements
+ */
+typedef struct block_device_ops
+{
+    // queues a request, which is completed later through its status and
+    // callback. The range is already checked.
+    void (*submit)(struct block_device *device, block_request *request);
+    // carries on with queued requests without waiting, returns 1 while there
+    // are requests left and 0 once the device is idle
+    int (*poll)(struct block_device *device);
+    // makes sure completed writes reached the medium, may be 0
+    int (*flush)(struct block_device *device);
+} block_device_ops;
+
+/**
+ * A registered block device
+ */
+typedef struct block_device
+{
+    // name shown by the 'devices' command, e.g. "fd0"
+    char name[BLOCK_DEVICE_NAME_LENGTH];
+    // size of a block in bytes
+    unsigned int block_size;
+    // capacity in blocks
+    unsigned int block_count;
+    // operations of the driver
+    const block_device_ops *ops;
+    // free for use by the driver
+    void *data;
+} block_device;
+
+int block_device_register(block_device *device);
+block_device *block_device_find(char *name);
+block_device *block_device_get(int index);
+int block_submit(block_device *device, block_request *request);
+int block_poll(block_device *device);
+void block_poll_all();
+int block_wait(block_device *device, block_request *request);
+void block_run(block_device *device);
+int block_read(block_device *device, unsigned int block, unsigned int count,
+               void *buffer);
+int block_write(block_device *device, unsigned int block, unsigned int count,
+                void *buffer);
+int block_flush(block_device *device);
+void block_sleep();
+void block_device_install();
+
+#endif
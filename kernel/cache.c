@@ -0,0 +1,895 @@
+/**
+ * FILENAME :       cache.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A write-back cache for tracks of a block device, usually the floppy.
+ *  Reading a track from the floppy takes a long time, so recently used tracks
+ *  are kept in memory. Changes are only written back to the device when a
+ *  track is evicted, on the 'sync' command or every few seconds.
+ *  The least recently used track is evicted when a new one has to be loaded.
+ *  Validity and changes are tracked per sector, so only the sectors which are
+ *  actually accessed or changed are transferred. All transfers are submitted
+ *  to the device together, so the floppy's elevator can write back several
+ *  tracks in a single sweep of the head.
+ *  The periodic write back only submits the transfers, they are carried out
+ *  in the background by the main loop.
+ *  Sequential reads of consecutive tracks are detected and the following
+ *  tracks are read ahead in the background. The read ahead window doubles
+ *  with every sequential access up to a tunable depth and is dropped as soon
+ *  as the accesses become random.
+ *  Other parts of the kernel holding changes in memory, like the mounted file
+ *  system, install flush handlers to put them into the cache before it writes
+ *  back.
+ */
+
+#include "cache.h"
+#include "block_device.h"
+#include "screen.h"
+#include "shell.h"
+#include "timer.h"
+#include "bool.h"
+#include "low_level.h"
+#include "string.h"
+
+/**
+ * A track held in memory
+ */
+typedef struct cache_line
+{
+    // track index of the cached data. -1 if the line is unused
+    int index;
+    // per sector: true if the sector was read from the device or overwritten
+    unsigned char valid[CACHE_LINE_SECTORS];
+    // per sector: true if the sector was changed and needs to be written back
+    unsigned char dirty[CACHE_LINE_SECTORS];
+    // value of cache_clock at the last access, used to find the LRU line
+    unsigned int last_used;
+    // amount of submitted transfers of the line, which are not completed yet
+    int pending;
+    // true if the line was read ahead and not accessed yet
+    bool prefetched;
+    // the cached track, aligned for drivers transferring words or doubles
+    char data[CACHE_LINE_SIZE] __attribute__((aligned(4)));
+} cache_line;
+
+/** All lines of the cache */
+static cache_line cache_lines[CACHE_LINE_COUNT];
+
+/** Device holding the cached tracks, 0 until one is attached */
+static block_device *cache_device = 0;
+
+/** Incremented on every access, so lines can be ordered by last use */
+static unsigned int cache_clock = 0;
+
+/** Timer tick of the last periodic write back */
+static unsigned int cache_last_flush = 0;
+
+/** Statistics, can be shown with the 'cache' command */
+static unsigned int cache_hits = 0;
+static unsigned int cache_misses = 0;
+static unsigned int cache_evictions = 0;
+static unsigned int cache_write_backs = 0;
+static unsigned int cache_readaheads = 0;
+static unsigned int cache_readahead_hits = 0;
+
+/** Track accessed by the last call to cache_read, -1 if none */
+static int cache_last_index = -1;
+/** Amount of tracks currently read ahead, 0 while accesses are random */
+static unsigned int cache_readahead_window = 0;
+/** Maximum size of the read ahead window, 0 disables read ahead */
+static unsigned int cache_readahead_depth = CACHE_READAHEAD_DEPTH;
+
+/** Functions writing changes held outside of the cache into it */
+static int (*cache_flush_handlers[CACHE_MAX_FLUSH_HANDLERS])();
+
+/**
+ * Requests for transfers handed to the device. A request is free again once
+ * the device completed it.
+ */
+static block_request cache_requests[CACHE_LINE_COUNT * CACHE_LINE_SECTORS];
+
+/**
+ * Checks whether a line contains changes, which were not written back yet
+ *
+ * @param line line to check
+ * @return bool true if at least one sector is dirty
+ */
+static bool cache_line_dirty(cache_line *line)
+{
+    for (int i = 0; i < CACHE_LINE_SECTORS; i++)
+    {
+        if (line->dirty[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Called by the device when a write back of sectors finished
+ *
+ * @param request completed request, its context is the cache line
+ */
+static void cache_write_done(block_request *request)
+{
+    cache_line *line = (cache_line *)request->context;
+    line->pending--;
+    if (request->status != BLOCK_REQUEST_DONE)
+    {
+        print("cache: write back failed\n", DEFAULT_COLOR_SCHEME);
+        // the sectors were marked clean on submission, try again later
+        unsigned int first = request->block - line->index * CACHE_LINE_SECTORS;
+        for (unsigned int i = first; i < first + request->count; i++)
+        {
+            line->dirty[i] = true;
+        }
+        return;
+    }
+    cache_write_backs++;
+}
+
+/**
+ * Called by the device when a read of sectors finished
+ *
+ * @param request completed request, its context is the cache line
+ */
+static void cache_read_done(block_request *request)
+{
+    cache_line *line = (cache_line *)request->context;
+    line->pending--;
+    if (request->status != BLOCK_REQUEST_DONE)
+    {
+        return;
+    }
+    unsigned int first = request->block - line->index * CACHE_LINE_SECTORS;
+    for (unsigned int i = first; i < first + request->count; i++)
+    {
+        line->valid[i] = true;
+    }
+}
+
+/**
+ * Finds a request which is not in use. If all of them are, the submitted
+ * transfers are carried out first.
+ *
+ * @return block_request* a free request
+ */
+static block_request *cache_request_alloc()
+{
+    for (int i = 0; i < CACHE_LINE_COUNT * CACHE_LINE_SECTORS; i++)
+    {
+        if (cache_requests[i].status != BLOCK_REQUEST_PENDING)
+        {
+            return &cache_requests[i];
+        }
+    }
+    block_run(cache_device);
+    return &cache_requests[0];
+}
+
+/**
+ * Hands a transfer of sectors of a line to the device. Sectors to write are
+ * marked clean right away, so changes made until the transfer starts are
+ * included and later changes mark them dirty again.
+ *
+ * @param line line to transfer
+ * @param first first sector of the line
+ * @param last last sector of the line
+ * @param write true to write the sectors back, false to read them
+ */
+static void cache_submit(cache_line *line, int first, int last, bool write)
+{
+    block_request *request = cache_request_alloc();
+    if (write)
+    {
+        memset(line->dirty + first, false, last - first + 1);
+    }
+    line->pending++;
+    request->block = line->index * CACHE_LINE_SECTORS + first;
+    request->count = last - first + 1;
+    request->buffer = (unsigned char *)line->data + first * CACHE_SECTOR_SIZE;
+    request->write = write;
+    request->callback = write ? cache_write_done : cache_read_done;
+    request->context = line;
+    block_submit(cache_device, request);
+}
+
+/**
+ * Lets the device serve submitted transfers until all transfers of a line
+ * are completed
+ *
+ * @param line line to wait for
+ */
+static void cache_line_wait(cache_line *line)
+{
+    while (line->pending > 0 && block_poll(cache_device))
+    {
+        if (line->pending > 0)
+        {
+            block_sleep();
+        }
+    }
+}
+
+/**
+ * Submits the changed sectors of a line for writing them back. Consecutive
+ * dirty sectors are written with a single transfer.
+ *
+ * @param line line to write back
+ */
+static void cache_submit_write_back(cache_line *line)
+{
+    if (line->index < 0)
+    {
+        return;
+    }
+    int first = 0;
+    while (first < CACHE_LINE_SECTORS)
+    {
+        if (!line->dirty[first])
+        {
+            first++;
+            continue;
+        }
+        int last = first;
+        while (last + 1 < CACHE_LINE_SECTORS && line->dirty[last + 1])
+        {
+            last++;
+        }
+        cache_submit(line, first, last, true);
+        first = last + 1;
+    }
+}
+
+/**
+ * Writes the changed sectors of a line back to the device
+ *
+ * @param line line to write back
+ * @return int 0 on success, -1 on failure
+ */
+static int cache_write_back(cache_line *line)
+{
+    cache_submit_write_back(line);
+    cache_line_wait(line);
+    return cache_line_dirty(line) ? -1 : 0;
+}
+
+/**
+ * Checks whether all sectors of a range are valid
+ *
+ * @param line line to check
+ * @param first first sector of the range
+ * @param last last sector of the range
+ * @return bool true if nothing has to be read
+ */
+static bool cache_range_valid(cache_line *line, int first, int last)
+{
+    for (int i = first; i <= last; i++)
+    {
+        if (!line->valid[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads the sectors of a line in the given range, which are not valid yet.
+ * Consecutive missing sectors are read with a single transfer.
+ *
+ * @param line line to fill
+ * @param first first sector of the range
+ * @param last last sector of the range
+ * @return int 0 on success, -1 on failure
+ */
+static int cache_fill(cache_line *line, int first, int last)
+{
+    int sector = first;
+    while (sector <= last)
+    {
+        if (line->valid[sector])
+        {
+            sector++;
+            continue;
+        }
+        int end = sector;
+        while (end + 1 <= last && !line->valid[end + 1])
+        {
+            end++;
+        }
+        cache_submit(line, sector, end, false);
+        sector = end + 1;
+    }
+    cache_line_wait(line);
+    return cache_range_valid(line, first, last) ? 0 : -1;
+}
+
+/**
+ * Converts a byte range of a track to a range of sectors
+ *
+ * @param offset offset of the first byte in the track
+ * @param length amount of bytes, at least 1
+ * @param first where to store the first sector
+ * @param last where to store the last sector
+ * @return int 0 on success, -1 if the range does not fit into a track
+ */
+static int cache_sector_range(unsigned int offset, unsigned int length,
+                              int *first, int *last)
+{
+    if (length == 0)
+    {
+        length = 1;
+    }
+    if (offset + length > CACHE_LINE_SIZE)
+    {
+        print("cache: range exceeds the track\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    *first = offset / CACHE_SECTOR_SIZE;
+    *last = (offset + length - 1) / CACHE_SECTOR_SIZE;
+    return 0;
+}
+
+/**
+ * Marks all sectors of a line as unused
+ *
+ * @param line line to reset
+ * @param index new track index of the line
+ */
+static void cache_line_reset(cache_line *line, int index)
+{
+    line->index = index;
+    line->pending = 0;
+    line->prefetched = false;
+    memset(line->valid, false, CACHE_LINE_SECTORS);
+    memset(line->dirty, false, CACHE_LINE_SECTORS);
+}
+
+/**
+ * Finds the line holding a track
+ *
+ * @param index track index
+ * @return cache_line* the line, or 0 if the track is not cached
+ */
+static cache_line *cache_find(unsigned int index)
+{
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        if (cache_lines[i].index == (int)index)
+        {
+            return &cache_lines[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Makes room for a new track by picking an unused line, or evicting the least
+ * recently used one. Lines with transfers in progress are not evicted.
+ *
+ * @return cache_line* a line which can be filled, or 0 if the write back of
+ * the evicted line failed
+ */
+static cache_line *cache_evict()
+{
+    cache_line *victim = 0;
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        if (cache_lines[i].index < 0)
+        {
+            return &cache_lines[i];
+        }
+        if (cache_lines[i].pending == 0 &&
+            (!victim || cache_lines[i].last_used < victim->last_used))
+        {
+            victim = &cache_lines[i];
+        }
+    }
+    if (!victim)
+    {
+        // every line is busy, finish all transfers and pick again
+        block_run(cache_device);
+        return cache_evict();
+    }
+    if (cache_write_back(victim))
+    {
+        return 0;
+    }
+    cache_evictions++;
+    victim->index = -1;
+    return victim;
+}
+
+/**
+ * Picks a line for a track which is read ahead. Unlike cache_evict this never
+ * writes back or waits, so only unused or clean idle lines are taken. The
+ * line of the accessed track is never taken, it is about to be handed out.
+ *
+ * @param accessed index of the accessed track
+ * @return cache_line* a line which can be filled, or 0 if there is none
+ */
+static cache_line *cache_readahead_victim(unsigned int accessed)
+{
+    cache_line *victim = 0;
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        cache_line *line = &cache_lines[i];
+        if (line->index < 0)
+        {
+            return line;
+        }
+        if (line->pending == 0 && !line->prefetched && !cache_line_dirty(line) &&
+            line->index != (int)accessed &&
+            (!victim || line->last_used < victim->last_used))
+        {
+            victim = line;
+        }
+    }
+    return victim;
+}
+
+/**
+ * Submits reads of whole tracks following a track, which are not cached yet.
+ * The reads are carried out in the background.
+ *
+ * @param index track index
+ * @param count amount of following tracks
+ */
+static void cache_readahead(unsigned int index, unsigned int count)
+{
+    unsigned int track_count = cache_device->block_count / CACHE_LINE_SECTORS;
+    for (unsigned int i = index + 1; i <= index + count && i < track_count; i++)
+    {
+        if (cache_find(i))
+        {
+            continue;
+        }
+        cache_line *line = cache_readahead_victim(index);
+        if (!line)
+        {
+            return;
+        }
+        if (line->index >= 0)
+        {
+            cache_evictions++;
+        }
+        cache_line_reset(line, i);
+        line->prefetched = true;
+        line->last_used = ++cache_clock;
+        cache_submit(line, 0, CACHE_LINE_SECTORS - 1, false);
+        cache_readaheads++;
+    }
+}
+
+/**
+ * Adapts the read ahead window to an access of a track and reads ahead if
+ * the accesses are sequential
+ *
+ * @param index accessed track index
+ */
+static void cache_readahead_update(unsigned int index)
+{
+    if ((int)index == cache_last_index)
+    {
+        return;
+    }
+    if ((int)index == cache_last_index + 1)
+    {
+        // sequential, widen the window
+        cache_readahead_window = cache_readahead_window
+                                     ? cache_readahead_window * 2
+                                     : 1;
+        if (cache_readahead_window > cache_readahead_depth)
+        {
+            cache_readahead_window = cache_readahead_depth;
+        }
+    }
+    else
+    {
+        // random, reading ahead would only waste time and lines
+        cache_readahead_window = 0;
+    }
+    cache_last_index = index;
+    if (cache_readahead_window)
+    {
+        cache_readahead(index, cache_readahead_window);
+    }
+}
+
+/**
+ * Sets the maximum amount of tracks read ahead of sequential accesses
+ *
+ * @param depth amount of tracks, 0 disables read ahead
+ */
+void cache_set_readahead(unsigned int depth)
+{
+    if (depth > CACHE_READAHEAD_MAX_DEPTH)
+    {
+        depth = CACHE_READAHEAD_MAX_DEPTH;
+    }
+    cache_readahead_depth = depth;
+    if (cache_readahead_window > depth)
+    {
+        cache_readahead_window = depth;
+    }
+}
+
+/**
+ * Returns the cached data of a track. The sectors containing the given range
+ * are read from the device if they are not cached yet, other parts of the
+ * returned track may be invalid. The returned pointer stays valid until the
+ * next call to one of the cache functions.
+ *
+ * @param index track index
+ * @param offset offset of the first byte needed
+ * @param length amount of bytes needed
+ * @return char* the data of the track, or 0 if reading failed
+ */
+char *cache_read(unsigned int index, unsigned int offset, unsigned int length)
+{
+    int first, last;
+    if (!cache_device || cache_sector_range(offset, length, &first, &last))
+    {
+        return 0;
+    }
+    cache_line *line = cache_find(index);
+    if (line)
+    {
+        // keep the line from being replaced by a read ahead
+        line->last_used = ++cache_clock;
+    }
+    // submit the reads ahead first, so the device serves them in the same
+    // sweep as a miss of this track
+    cache_readahead_update(index);
+    if (line)
+    {
+        // a read in progress must not overwrite the data handed out
+        cache_line_wait(line);
+        if (line->prefetched)
+        {
+            line->prefetched = false;
+            cache_readahead_hits++;
+        }
+    }
+    if (line && cache_range_valid(line, first, last))
+    {
+        cache_hits++;
+    }
+    else
+    {
+        cache_misses++;
+        if (!line)
+        {
+            line = cache_evict();
+            if (!line)
+            {
+                return 0;
+            }
+            cache_line_reset(line, index);
+        }
+        if (cache_fill(line, first, last))
+        {
+            return 0;
+        }
+    }
+    line->last_used = ++cache_clock;
+    return line->data;
+}
+
+/**
+ * Returns a cleared buffer for sectors of a track, which are going to be
+ * overwritten completely. Nothing is read from the device and the sectors are
+ * marked as changed.
+ *
+ * @param index track index
+ * @param offset offset of the first byte which will be written, the start of
+ * a sector
+ * @param length amount of bytes which will be written
+ * @return char* the track with zeroed sectors in the range, or 0 on failure
+ */
+char *cache_overwrite(unsigned int index, unsigned int offset,
+                      unsigned int length)
+{
+    int first, last;
+    if (!cache_device || offset % CACHE_SECTOR_SIZE ||
+        cache_sector_range(offset, length, &first, &last))
+    {
+        return 0;
+    }
+    cache_line *line = cache_find(index);
+    if (line)
+    {
+        // a read in progress must not overwrite the new data
+        cache_line_wait(line);
+    }
+    else
+    {
+        line = cache_evict();
+        if (!line)
+        {
+            return 0;
+        }
+        cache_line_reset(line, index);
+    }
+    memset((unsigned char *)line->data + first * CACHE_SECTOR_SIZE, 0,
+           (last - first + 1) * CACHE_SECTOR_SIZE);
+    for (int i = first; i <= last; i++)
+    {
+        line->valid[i] = true;
+        line->dirty[i] = true;
+    }
+    line->last_used = ++cache_clock;
+    return line->data;
+}
+
+/**
+ * Marks a changed range of a cached track, so it will be written back later.
+ * The range must have been read with cache_read before.
+ *
+ * @param index track index
+ * @param offset offset of the first changed byte
+ * @param length amount of changed bytes
+ */
+void cache_mark_dirty(unsigned int index, unsigned int offset,
+                      unsigned int length)
+{
+    int first, last;
+    cache_line *line = cache_find(index);
+    if (!line || cache_sector_range(offset, length, &first, &last))
+    {
+        return;
+    }
+    for (int i = first; i <= last; i++)
+    {
+        if (line->valid[i])
+        {
+            line->dirty[i] = true;
+        }
+    }
+}
+
+/**
+ * Calls the installed flush handlers, so their changes are in the cache
+ * before it writes back
+ *
+ * @return int 0 on success, -1 if a handler failed
+ */
+static int cache_run_flush_handlers()
+{
+    int result = 0;
+    for (int i = 0; i < CACHE_MAX_FLUSH_HANDLERS; i++)
+    {
+        if (cache_flush_handlers[i] && cache_flush_handlers[i]())
+        {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/**
+ * Installs a function which writes changes held outside of the cache into
+ * it, e.g. metadata of a mounted file system. It is called before every write
+ * back, on 'sync' and periodically.
+ *
+ * @param handler function returning 0 on success and -1 on failure
+ * @return int 0 on success, -1 if all slots are taken
+ */
+int cache_install_flush_handler(int (*handler)())
+{
+    for (int i = 0; i < CACHE_MAX_FLUSH_HANDLERS; i++)
+    {
+        if (!cache_flush_handlers[i])
+        {
+            cache_flush_handlers[i] = handler;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Writes all changed tracks back to the device in a single sweep
+ *
+ * @return int 0 on success, -1 if a track could not be written
+ */
+int cache_sync()
+{
+    if (!cache_device)
+    {
+        return 0;
+    }
+    int handlers_result = cache_run_flush_handlers();
+    // submit everything first, so the device can sort all of it
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        cache_submit_write_back(&cache_lines[i]);
+    }
+    cache_last_flush = timer_get_ticks();
+    int result = block_flush(cache_device) | handlers_result;
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        if (cache_line_dirty(&cache_lines[i]))
+        {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/**
+ * Submits the write back of changed tracks, if CACHE_FLUSH_INTERVAL passed
+ * since the last write back. Meant to be called from the kernel's main loop,
+ * which carries out the transfers by polling the block devices.
+ */
+void cache_periodic_flush()
+{
+    if (!cache_device ||
+        timer_get_ticks() - cache_last_flush < CACHE_FLUSH_INTERVAL)
+    {
+        return;
+    }
+    cache_run_flush_handlers();
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        cache_submit_write_back(&cache_lines[i]);
+    }
+    cache_last_flush = timer_get_ticks();
+}
+
+/**
+ * Shell command function for writing all changes back to the device
+ *
+ * @param args Arguments string. None expected
+ */
+static int sync_command(int argc, char **argv)
+{
+    // surpressing unused parameter warnings
+    (void)(argc);
+    (void)(argv);
+    if (cache_sync())
+    {
+        print("Error: Could not write back all tracks\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Shell command function for printing cache statistics
+ *
+ * @param args Arguments string. None expected
+ */
+static int cache_command(int argc, char **argv)
+{
+    // surpressing unused parameter warnings
+    (void)(argc);
+    (void)(argv);
+    print("Hits: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_hits, DEFAULT_COLOR_SCHEME);
+    print("\nMisses: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_misses, DEFAULT_COLOR_SCHEME);
+    print("\nEvictions: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_evictions, DEFAULT_COLOR_SCHEME);
+    print("\nWrite backs: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_write_backs, DEFAULT_COLOR_SCHEME);
+    print("\nRead aheads: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_readaheads, DEFAULT_COLOR_SCHEME);
+    print(" (", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_readahead_hits, DEFAULT_COLOR_SCHEME);
+    print(" used)", DEFAULT_COLOR_SCHEME);
+    print("\nCached tracks:", DEFAULT_COLOR_SCHEME);
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        if (cache_lines[i].index >= 0)
+        {
+            print(" ", DEFAULT_COLOR_SCHEME);
+            print_int(cache_lines[i].index, DEFAULT_COLOR_SCHEME);
+            if (cache_line_dirty(&cache_lines[i]))
+            {
+                print("*", DEFAULT_COLOR_SCHEME);
+            }
+        }
+    }
+    print("\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Shell command function for showing or setting the read ahead depth
+ *
+ * @param args Arguments string. Optionally the new depth in tracks, 0
+ * disables read ahead
+ */
+static int readahead_command(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        unsigned int depth;
+        if (string_to_unsigned_int(argv[1], &depth))
+        {
+            print("Usage: readahead [depth]\n", DEFAULT_COLOR_SCHEME);
+            return 1;
+        }
+        cache_set_readahead(depth);
+    }
+    print("Read ahead depth: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_readahead_depth, DEFAULT_COLOR_SCHEME);
+    print(" tracks, current window: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(cache_readahead_window, DEFAULT_COLOR_SCHEME);
+    print("\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Makes the cache work on a device. Changes of the previous device are
+ * written back and its tracks are dropped.
+ *
+ * @param device device to cache, with a block size of CACHE_SECTOR_SIZE
+ * @return int 0 on success, -1 on failure
+ */
+int cache_attach(block_device *device)
+{
+    if (!device || device->block_size != CACHE_SECTOR_SIZE)
+    {
+        print("cache: unsupported device\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    if (cache_device)
+    {
+        if (cache_sync())
+        {
+            return -1;
+        }
+        block_run(cache_device);
+    }
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        cache_line_reset(&cache_lines[i], -1);
+        cache_lines[i].last_used = 0;
+    }
+    cache_last_index = -1;
+    cache_readahead_window = 0;
+    cache_device = device;
+    return 0;
+}
+
+/**
+ * Returns the device the cache works on
+ *
+ * @return block_device* the attached device, or 0 if there is none
+ */
+block_device *cache_get_device()
+{
+    return cache_device;
+}
+
+/**
+ * Installs the cache and registers its shell commands
+ */
+void cache_install()
+{
+    for (int i = 0; i < CACHE_LINE_COUNT; i++)
+    {
+        cache_line_reset(&cache_lines[i], -1);
+        cache_lines[i].last_used = 0;
+    }
+    for (int i = 0; i < CACHE_LINE_COUNT * CACHE_LINE_SECTORS; i++)
+    {
+        cache_requests[i].status = BLOCK_REQUEST_DONE;
+    }
+    cache_last_flush = timer_get_ticks();
+    register_command("sync", sync_command);
+    register_command("cache", cache_command);
+    register_command("readahead", readahead_command);
+}
@@ -0,0 +1,51 @@
+/**
+ * FILENAME :       cache.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the track cache
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "block_device.h"
+
+/** Amount of tracks which can be held in memory at once */
+#define CACHE_LINE_COUNT 8
+/** Size of a sector in bytes, the block size of the cached device */
+#define CACHE_SECTOR_SIZE 512
+/** Amount of sectors in a cached track, one cylinder of a 1.44MB floppy */
+#define CACHE_LINE_SECTORS 36
+/** Size of a cached track in bytes */
+#define CACHE_LINE_SIZE (CACHE_LINE_SECTORS * CACHE_SECTOR_SIZE)
+/** Time between two automatic write backs in timer ticks (5 seconds) */
+#define CACHE_FLUSH_INTERVAL 500
+/** Maximum amount of installed flush handlers */
+#define CACHE_MAX_FLUSH_HANDLERS 4
+/** Default maximum amount of tracks read ahead of sequential accesses */
+#define CACHE_READAHEAD_DEPTH 4
+/** Upper limit of the read ahead depth, some lines must stay for other uses */
+#define CACHE_READAHEAD_MAX_DEPTH (CACHE_LINE_COUNT - 2)
+
+char *cache_read(unsigned int index, unsigned int offset, unsigned int length);
+char *cache_overwrite(unsigned int index, unsigned int offset,
+                      unsigned int length);
+void cache_mark_dirty(unsigned int index, unsigned int offset,
+                      unsigned int length);
+int cache_sync();
+void cache_periodic_flush();
+void cache_set_readahead(unsigned int depth);
+int cache_attach(block_device *device);
+block_device *cache_get_device();
+int cache_install_flush_handler(int (*handler)());
+void cache_install();
+
+#endif
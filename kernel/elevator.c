@@ -0,0 +1,383 @@
+/**
+ * FILENAME :       elevator.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A request queue in front of the floppy driver. Requests are collected and
+ *  then served in C-SCAN order like an elevator: starting at the current head
+ *  position, the head only moves towards higher sectors and jumps back to the
+ *  lowest requested sector once it passed the highest one. Requests for
+ *  adjacent sectors on the same cylinder are merged into a single controller
+ *  command.
+ *
+ *  Requests are served asynchronously: elevator_poll advances the transfer in
+ *  progress as far as possible without waiting and is called from the main
+ *  loop, so nothing blocks while the controller is busy.
+ *  The elevator is the block device driver of the floppy drive.
+ */
+
+#include "elevator.h"
+#include "floppy.h"
+#include "screen.h"
+#include "low_level.h"
+#include "string.h"
+
+/** Maximum amount of sectors a merged group can have */
+#define ELEVATOR_MAX_SECTORS (FLOPPY_DMA_LENGTH / FLOPPY_SECTOR_SIZE)
+
+/** Queued requests, sorted by their first sector */
+static block_request *elevator_queue = 0;
+
+/** Sector following the last transfer, approximates the head position */
+static unsigned int elevator_position = 0;
+
+/** Requests being served, they cover consecutive sectors */
+static block_request *elevator_group = 0;
+/** First sector, amount of sectors and direction of the group */
+static unsigned int elevator_group_lba = 0;
+static unsigned int elevator_group_count = 0;
+static bool elevator_group_write = false;
+/** Sectors of the group already transferred */
+static unsigned int elevator_group_done = 0;
+/** Sectors of the transfer in progress, 0 if none is running */
+static unsigned int elevator_chunk = 0;
+
+/** Set when a request failed, reset by elevator_run */
+static int elevator_failed = 0;
+
+/**
+ * Adds a request to the queue. It is served by the following calls to
+ * elevator_poll.
+ *
+ * @param request request to queue, owned by the caller
+ */
+void elevator_submit(block_request *request)
+{
+    request->status = BLOCK_REQUEST_PENDING;
+    // insert sorted by first sector, behind requests for the same sector
+    block_request **link = &elevator_queue;
+    while (*link && (*link)->block <= request->block)
+    {
+        link = &(*link)->next;
+    }
+    request->next = *link;
+    *link = request;
+}
+
+/**
+ * Removes the request the elevator serves next from the queue: the first one
+ * at or behind the head position, or the lowest one if there is none.
+ *
+ * @return block_request* the next request, or 0 if the queue is empty
+ */
+static block_request *elevator_next()
+{
+    block_request **link = &elevator_queue;
+    while (*link && (*link)->block < elevator_position)
+    {
+        link = &(*link)->next;
+    }
+    if (!*link)
+    {
+        // passed the highest request, jump back to the lowest one
+        link = &elevator_queue;
+    }
+    block_request *request = *link;
+    if (request)
+    {
+        *link = request->next;
+        request->next = 0;
+    }
+    return request;
+}
+
+/**
+ * Removes a queued request which continues the given range in the same
+ * direction without leaving its cylinder, so both can be merged.
+ *
+ * @param lba first sector following the range
+ * @param count amount of sectors in the range
+ * @param write direction of the range
+ * @return block_request* the request, or 0 if there is none
+ */
+static block_request *elevator_take_adjacent(unsigned int lba,
+                                              unsigned int count, bool write)
+{
+    unsigned int per_cylinder = floppy_sectors_per_cylinder();
+    for (block_request **link = &elevator_queue; *link;
+         link = &(*link)->next)
+    {
+        block_request *request = *link;
+        if (request->block > lba)
+        {
+            break;
+        }
+        if (request->block == lba && request->write == write &&
+            (lba + request->count - 1) / per_cylinder == (lba - 1) / per_cylinder &&
+            count + request->count <= ELEVATOR_MAX_SECTORS)
+        {
+            *link = request->next;
+            request->next = 0;
+            return request;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Completes all requests of a group. Callbacks may submit new requests, but
+ * must not wait for them.
+ *
+ * @param group first request of a list of requests
+ * @param status BLOCK_REQUEST_DONE or BLOCK_REQUEST_FAILED
+ */
+static void elevator_complete(block_request *group, int status)
+{
+    if (status == BLOCK_REQUEST_FAILED)
+    {
+        elevator_failed = 1;
+    }
+    while (group)
+    {
+        // the callback may reuse the request, so remember the next one first
+        block_request *next = group->next;
+        group->next = 0;
+        group->status = status;
+        if (group->callback)
+        {
+            group->callback(group);
+        }
+        group = next;
+    }
+}
+
+/**
+ * Takes the next request from the queue together with all requests it can be
+ * merged with, and makes them the group being served.
+ *
+ * @return int 1 if there is a new group, 0 if the queue is empty
+ */
+static int elevator_start_group()
+{
+    block_request *group = elevator_next();
+    if (!group)
+    {
+        return 0;
+    }
+    unsigned int per_cylinder = floppy_sectors_per_cylinder();
+    unsigned int count = group->count;
+    // requests spanning several cylinders are transferred piece by piece and
+    // can't be merged
+    if (count > 0 && count <= ELEVATOR_MAX_SECTORS &&
+        group->block / per_cylinder == (group->block + count - 1) / per_cylinder)
+    {
+        // collect the requests continuing this one on the same cylinder
+        block_request *last = group;
+        block_request *adjacent;
+        while ((adjacent = elevator_take_adjacent(group->block + count, count,
+                                                  group->write)))
+        {
+            last->next = adjacent;
+            last = adjacent;
+            count += adjacent->count;
+        }
+    }
+    elevator_group = group;
+    elevator_group_lba = group->block;
+    elevator_group_count = count;
+    elevator_group_write = group->write;
+    elevator_group_done = 0;
+    elevator_chunk = 0;
+    return 1;
+}
+
+/**
+ * Copies the part of the group's buffers covered by the current transfer
+ * between the buffers and the dma buffer
+ *
+ * @param to_dma true to fill the dma buffer, false to empty it
+ */
+static void elevator_copy_chunk(bool to_dma)
+{
+    unsigned int first = elevator_group_lba + elevator_group_done;
+    unsigned int end = first + elevator_chunk;
+    for (block_request *request = elevator_group; request;
+         request = request->next)
+    {
+        unsigned int from = request->block > first ? request->block : first;
+        unsigned int to = request->block + request->count < end
+                              ? request->block + request->count
+                              : end;
+        if (from >= to)
+        {
+            continue;
+        }
+        unsigned char *dma = (unsigned char *)floppy_dma_buffer(0) +
+                             (from - first) * FLOPPY_SECTOR_SIZE;
+        unsigned char *buffer =
+            request->buffer + (from - request->block) * FLOPPY_SECTOR_SIZE;
+        unsigned int length = (to - from) * FLOPPY_SECTOR_SIZE;
+        if (to_dma)
+        {
+            memcpy(dma, buffer, length);
+        }
+        else
+        {
+            memcpy(buffer, dma, length);
+        }
+    }
+}
+
+/**
+ * Starts the transfer of the next part of the group, which ends at the end of
+ * the cylinder or when the dma buffer is full.
+ *
+ * @return int 0 on success, -1 on failure
+ */
+static int elevator_start_chunk()
+{
+    unsigned int per_cylinder = floppy_sectors_per_cylinder();
+    unsigned int lba = elevator_group_lba + elevator_group_done;
+    unsigned int count = elevator_group_count - elevator_group_done;
+    if (count > per_cylinder - lba % per_cylinder)
+    {
+        count = per_cylinder - lba % per_cylinder;
+    }
+    if (count > ELEVATOR_MAX_SECTORS)
+    {
+        count = ELEVATOR_MAX_SECTORS;
+    }
+    elevator_chunk = count;
+    if (elevator_group_write)
+    {
+        elevator_copy_chunk(true);
+    }
+    return floppy_dma_start(lba, count, elevator_group_write, 0);
+}
+
+/**
+ * Ends the group being served and completes its requests
+ *
+ * @param status BLOCK_REQUEST_DONE or BLOCK_REQUEST_FAILED
+ */
+static void elevator_finish_group(int status)
+{
+    block_request *group = elevator_group;
+    elevator_position = elevator_group_lba + elevator_group_count;
+    elevator_group = 0;
+    elevator_chunk = 0;
+    elevator_complete(group, status);
+}
+
+/**
+ * Serves the queued requests in elevator order as far as possible without
+ * waiting for the controller
+ *
+ * @return int 1 while requests are being served, 0 once the queue is empty
+ */
+int elevator_poll()
+{
+    while (true)
+    {
+        if (!elevator_group && !elevator_start_group())
+        {
+            return 0;
+        }
+        if (elevator_group_done == elevator_group_count)
+        {
+            elevator_finish_group(BLOCK_REQUEST_DONE);
+            continue;
+        }
+        if (!elevator_chunk && elevator_start_chunk())
+        {
+            elevator_finish_group(BLOCK_REQUEST_FAILED);
+            continue;
+        }
+        int status = floppy_dma_poll();
+        if (status == FLOPPY_BUSY)
+        {
+            return 1;
+        }
+        if (status)
+        {
+            elevator_finish_group(BLOCK_REQUEST_FAILED);
+            continue;
+        }
+        if (!elevator_group_write)
+        {
+            elevator_copy_chunk(false);
+        }
+        elevator_group_done += elevator_chunk;
+        elevator_chunk = 0;
+    }
+}
+
+/**
+ * Serves all queued requests in elevator order and completes them
+ *
+ * @return int 0 if all requests succeeded, -1 if at least one failed
+ */
+int elevator_run()
+{
+    elevator_failed = 0;
+    while (elevator_poll())
+    {
+        floppy_sleep();
+    }
+    return elevator_failed ? -1 : 0;
+}
+
+/**
+ * Block device operation queueing a request
+ *
+ * @param device the floppy device
+ * @param request request to queue
+ */
+static void elevator_device_submit(block_device *device, block_request *request)
+{
+    (void)(device);
+    elevator_submit(request);
+}
+
+/**
+ * Block device operation serving queued requests
+ *
+ * @param device the floppy device
+ * @return int 1 while requests are being served, 0 once the queue is empty
+ */
+static int elevator_device_poll(block_device *device)
+{
+    (void)(device);
+    return elevator_poll();
+}
+
+/** Operations of the floppy device. Writes go straight to the disk. */
+static const block_device_ops elevator_device_ops = {
+    elevator_device_submit,
+    elevator_device_poll,
+    0,
+};
+
+/** The floppy drive as a block device */
+static block_device elevator_device;
+
+/**
+ * Registers the floppy drive as block device "fd0". The floppy driver must be
+ * installed already, so the geometry of the disk is known.
+ */
+void elevator_install()
+{
+    string_copy("fd0", elevator_device.name);
+    elevator_device.block_size = FLOPPY_SECTOR_SIZE;
+    elevator_device.block_count = floppy_sector_count();
+    elevator_device.ops = &elevator_device_ops;
+    elevator_device.data = 0;
+    block_device_register(&elevator_device);
+}
@@ -0,0 +1,27 @@
+/**
+ * FILENAME :       elevator.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the floppy request queue, which serves block requests for
+ *  the floppy drive
+ */
+
+#ifndef ELEVATOR_H
+#define ELEVATOR_H
+
+#include "block_device.h"
+
+void elevator_submit(block_request *request);
+int elevator_poll();
+int elevator_run();
+void elevator_install();
+
+#endif
@@ -5,76 +5,1903 @@
  *
  * START DATE :     16 Dec 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
  * DESCRIPTION :
  *  A primitive custom file system for floppy drives. Actual file systems get
  *  way more complicated than this.
+ *  Space is allocated in blocks of 512 bytes, which are tracked by a free
+ *  space bitmap on the disk. A file gets a single run of consecutive blocks if
+ *  there is one large enough, so programs can be read without seeking, and
+ *  otherwise up to FILE_MAX_EXTENTS runs. Tiny files don't get blocks at all,
+ *  their data is kept in the directory entry and read together with it.
+ *  See file_system.h for the layout.
+ *  The file system is mounted once: the superblock and the directory are
+ *  kept in memory, so directory operations don't access the disk. The
+ *  bitmap grows with the disk, only the blocks of it used last are kept.
+ *  Names are looked up through a hash index of the directory, which is built
+ *  at mount time. Changed metadata is written back to the cache on
+ *  'sync' and with the periodic write back of the cache. File data goes
+ *  through the cache.
+ *  Creates and deletes can be grouped in a batch, which writes back the
+ *  metadata once for all of them when it is committed.
+ *  'mount' moves the file system to another block device, e.g. a hard disk.
+ *  Files can be opened and read or written piece by piece through file
+ *  descriptors, the data is streamed through the cache block by block.
+ *  Files compressed on the host are decompressed while they are read, so
+ *  fewer bytes have to come from the disk.
+ *  Where the blocks of a new file go is up to one of several strategies,
+ *  which can be switched with 'alloc' to compare them: the lowest free
+ *  blocks, blocks within one cylinder close to the directory, or the free
+ *  blocks closest to the heads.
+ *  'defrag' compacts the layout: files are moved one at a time until each of
+ *  them is contiguous and they are packed behind the directory, the programs
+ *  executed most often first, so loading them needs the fewest seeks.
  */
 
 #include "file_system.h"
-#include "floppy.h"
+#include "cache.h"
 #include "screen.h"
 #include "string.h"
 #include "shell.h"
 #include "low_level.h"
+#include "lz.h"
+
+#if FS_BLOCK_SIZE != CACHE_SECTOR_SIZE
+#error "file system blocks must be sectors of the cache"
+#endif
+
+/** Maximum size of a program run by the 'execute' command */
+#define MAX_PROGRAM_SIZE 0x8000
+/** Amount of buckets of the directory's hash index, a power of 2 */
+#define FS_HASH_BUCKETS 64
+/** Ways of accessing the data of a file with fs_map */
+#define FS_MAP_READ 0
+#define FS_MAP_WRITE 1
+#define FS_MAP_OVERWRITE 2
+/**
+ * Amount of blocks of the free space bitmap held in memory, each covers
+ * FS_BITS_PER_BLOCK blocks (2MB) of the disk
+ */
+#define FS_BITMAP_SLOTS 8
+/** Amount of blocks of a cylinder of the floppy, a cached track holds one */
+#define FS_CYLINDER_BLOCKS CACHE_LINE_SECTORS
+/** Free blocks the cylinder group strategy tries to leave behind a file */
+#define FS_GROWTH_BLOCKS 2
+
+/** True once a file system is mounted */
+static bool fs_mounted = false;
+
+/** True while a batch is open, its metadata changes are held back */
+static bool fs_batch_open = false;
+
+/** The superblock of the mounted file system */
+static superblock fs_super;
+
+/**
+ * A block of the free space bitmap held in memory
+ */
+typedef struct fs_bitmap_slot
+{
+    // index of the block within the bitmap, -1 if the slot is unused
+    int index;
+    // changed since it was written back
+    bool dirty;
+    // value of fs_bitmap_clock at the last access, 0 if the slot is unused
+    unsigned int last_used;
+    unsigned char bits[FS_BLOCK_SIZE];
+} fs_bitmap_slot;
+
+/**
+ * The blocks of the free space bitmap of the mounted file system used last.
+ * The bitmap grows with the disk, so only a few of its blocks are kept in
+ * memory and the others are loaded when they are needed.
+ */
+static fs_bitmap_slot fs_bitmap[FS_BITMAP_SLOTS];
+static unsigned int fs_bitmap_clock = 0;
+/**
+ * Amount of free blocks, counted once when it is needed first and kept up to
+ * date by fs_mark_blocks afterwards
+ */
+static unsigned int fs_free_count = 0;
+static bool fs_free_known = false;
+
+/** Length limit of fs_next_free_run for callers needing whole runs */
+#define FS_RUN_UNLIMITED 0xffffffff
+/** The directory of the mounted file system */
+static file_entry fs_directory[MAX_FILE_COUNT];
+
+/**
+ * Hash index of the directory, built at mount time: every bucket holds a
+ * chain of the entries whose names hash to it, linked through fs_hash_next.
+ * Chains end with -1.
+ */
+static short fs_hash_heads[FS_HASH_BUCKETS];
+static short fs_hash_next[MAX_FILE_COUNT];
+
+/** Metadata changed since the last write back, per block */
+static bool fs_super_dirty = false;
+static bool fs_directory_dirty[FS_DIRECTORY_BLOCKS];
+
+/**
+ * An open file
+ */
+typedef struct fs_open_file
+{
+    // true if the descriptor is in use
+    bool used;
+    // index of the file's directory entry
+    unsigned int index;
+    // offset of the next byte to read or write
+    unsigned int position;
+    // FS_OPEN_ flags the file was opened with
+    int flags;
+} fs_open_file;
+
+/**
+ * A strategy for placing the blocks of a file, see fs_allocate
+ */
+typedef struct fs_allocator
+{
+    // name used by the 'alloc' command
+    char *name;
+    // finds count consecutive free blocks, returns 0 and the first of them,
+    // or -1 if there aren't any
+    int (*place)(unsigned int count, unsigned int *start);
+} fs_allocator;
+
+/** Table of open files, a file descriptor is an index into it */
+static fs_open_file fs_open_files[FS_MAX_OPEN_FILES];
+
+/** Memory a program is copied to before it is executed */
+static unsigned char fs_program[MAX_PROGRAM_SIZE];
+
+/** Decoder for compressed files */
+static lz_decoder fs_decoder;
+
+/** Block the file system accessed last, the heads are most likely there */
+static unsigned int fs_head_block = 0;
+
+/** Blocks belonging to files, like a block of the bitmap, see fs_reclaim */
+static unsigned char fs_owned[FS_BLOCK_SIZE];
+/** A block moved by fs_move, between reading and writing it */
+static unsigned char fs_move_buffer[FS_BLOCK_SIZE];
+/** Indices of the files with blocks, in the order 'defrag' places them */
+static unsigned char fs_layout_order[MAX_FILE_COUNT];
+
+/**
+ * How the files are placed on the disk, see fs_layout_stats
+ */
+typedef struct fs_layout
+{
+    // files with blocks, and those of them with more than one extent
+    unsigned int files;
+    unsigned int fragmented;
+    unsigned int extents;
+    // cylinders the heads move to read each file once, from the directory
+    unsigned int cylinders;
+    // the same for each execution of the files
+    unsigned int executed_cylinders;
+    unsigned int executions;
+} fs_layout;
+
+/**
+ * Destination of data copied by fs_copy_output
+ */
+typedef struct fs_copy_target
+{
+    unsigned char *buffer;
+    unsigned int capacity;
+    unsigned int position;
+    // set if the data did not fit
+    bool overflow;
+} fs_copy_target;
+
+/**
+ * Accesses a whole block through the cache. The returned pointer stays valid
+ * until the next call to one of the cache functions.
+ *
+ * @param block the block
+ * @param overwrite true if the block is going to be overwritten completely,
+ * it is cleared instead of read
+ * @return unsigned char* the block, or 0 if it could not be read
+ */
+static unsigned char *fs_block(unsigned int block, bool overwrite)
+{
+    unsigned int index = block / CACHE_LINE_SECTORS;
+    unsigned int offset = (block % CACHE_LINE_SECTORS) * FS_BLOCK_SIZE;
+    fs_head_block = block;
+    char *line = overwrite ? cache_overwrite(index, offset, FS_BLOCK_SIZE)
+                           : cache_read(index, offset, FS_BLOCK_SIZE);
+    if (!line)
+    {
+        print("Error: Could not access the disk\n", DEFAULT_COLOR_SCHEME);
+        return 0;
+    }
+    return (unsigned char *)line + offset;
+}
+
+/**
+ * Copies a block of metadata held in memory into the cache, which writes it
+ * back to the disk
+ *
+ * @param block the block
+ * @param data FS_BLOCK_SIZE bytes
+ * @return int 0 on success, -1 on failure
+ */
+static int fs_store_block(unsigned int block, void *data)
+{
+    unsigned char *destination = fs_block(block, true);
+    if (!destination)
+    {
+        return -1;
+    }
+    memcpy(destination, (unsigned char *)data, FS_BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * Returns a block of the free space bitmap, which is loaded through the
+ * cache if it is not in memory. The block used least recently makes room
+ * for it. While a batch is open, changed blocks stay in memory, so the
+ * batch can still be aborted.
+ *
+ * @param index index of the block within the bitmap
+ * @param change true if the caller changes the bits
+ * @return unsigned char* the bits of the block, or 0 on failure
+ */
+static unsigned char *fs_bitmap_block(unsigned int index, bool change)
+{
+    fs_bitmap_slot *victim = 0;
+    for (int i = 0; i < FS_BITMAP_SLOTS; i++)
+    {
+        fs_bitmap_slot *slot = &fs_bitmap[i];
+        if (slot->index == (int)index)
+        {
+            victim = slot;
+            break;
+        }
+        if ((!slot->dirty || !fs_batch_open) &&
+            (!victim || slot->last_used < victim->last_used))
+        {
+            victim = slot;
+        }
+    }
+    if (!victim)
+    {
+        print("Error: The batch changes too much of the disk\n",
+              DEFAULT_COLOR_SCHEME);
+        return 0;
+    }
+    if (victim->index != (int)index)
+    {
+        if (victim->dirty &&
+            fs_store_block(fs_super.bitmap_start + victim->index, victim->bits))
+        {
+            return 0;
+        }
+        victim->dirty = false;
+        victim->index = -1;
+        unsigned char *block = fs_block(fs_super.bitmap_start + index, false);
+        if (!block)
+        {
+            return 0;
+        }
+        memcpy(victim->bits, block, FS_BLOCK_SIZE);
+        victim->index = index;
+    }
+    victim->last_used = ++fs_bitmap_clock;
+    victim->dirty |= change;
+    return victim->bits;
+}
+
+/**
+ * Empties the blocks of the free space bitmap held in memory, without
+ * writing them back
+ */
+static void fs_bitmap_reset()
+{
+    for (int i = 0; i < FS_BITMAP_SLOTS; i++)
+    {
+        fs_bitmap[i].index = -1;
+        fs_bitmap[i].dirty = false;
+        fs_bitmap[i].last_used = 0;
+    }
+    fs_free_known = false;
+}
+
+/**
+ * Writes the changed metadata of the mounted file system back to the cache.
+ * Installed as flush handler of the cache, so it runs on 'sync' and on the
+ * periodic write back.
+ *
+ * @return int 0 on success, -1 on failure
+ */
+static int fs_write_back()
+{
+    if (!fs_mounted)
+    {
+        return 0;
+    }
+    int result = 0;
+    if (fs_super_dirty)
+    {
+        // the rest of the superblock's block stays zero
+        static unsigned char block[FS_BLOCK_SIZE];
+        memcpy(block, (unsigned char *)&fs_super, sizeof(superblock));
+        if (fs_store_block(FS_SUPERBLOCK, block))
+        {
+            result = -1;
+        }
+        else
+        {
+            fs_super_dirty = false;
+        }
+    }
+    for (int i = 0; i < FS_BITMAP_SLOTS; i++)
+    {
+        fs_bitmap_slot *slot = &fs_bitmap[i];
+        if (!slot->dirty)
+        {
+            continue;
+        }
+        if (fs_store_block(fs_super.bitmap_start + slot->index, slot->bits))
+        {
+            result = -1;
+            continue;
+        }
+        slot->dirty = false;
+    }
+    for (unsigned int i = 0; i < FS_DIRECTORY_BLOCKS; i++)
+    {
+        if (!fs_directory_dirty[i])
+        {
+            continue;
+        }
+        if (fs_store_block(fs_super.directory_start + i,
+                           &fs_directory[i * FS_ENTRIES_PER_BLOCK]))
+        {
+            result = -1;
+            continue;
+        }
+        fs_directory_dirty[i] = false;
+    }
+    return result;
+}
+
+/**
+ * Hashes a filename (FNV-1a)
+ *
+ * @param name the filename
+ * @return unsigned int bucket of the hash index
+ */
+static unsigned int fs_hash(char *name)
+{
+    unsigned int hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash & (FS_HASH_BUCKETS - 1);
+}
+
+/**
+ * Adds an entry of the directory to the hash index
+ *
+ * @param index index of the entry
+ */
+static void fs_hash_insert(unsigned int index)
+{
+    unsigned int bucket = fs_hash(fs_directory[index].name);
+    fs_hash_next[index] = fs_hash_heads[bucket];
+    fs_hash_heads[bucket] = index;
+}
+
+/**
+ * Removes an entry of the directory from the hash index
+ *
+ * @param index index of the entry
+ */
+static void fs_hash_remove(unsigned int index)
+{
+    short *link = &fs_hash_heads[fs_hash(fs_directory[index].name)];
+    while (*link >= 0 && (unsigned int)*link != index)
+    {
+        link = &fs_hash_next[*link];
+    }
+    if (*link >= 0)
+    {
+        *link = fs_hash_next[index];
+    }
+}
+
+/**
+ * Builds the hash index of all entries of the directory
+ */
+static void fs_hash_build()
+{
+    for (int i = 0; i < FS_HASH_BUCKETS; i++)
+    {
+        fs_hash_heads[i] = -1;
+    }
+    for (unsigned int i = 0; i < fs_super.file_count; i++)
+    {
+        fs_hash_insert(i);
+    }
+}
+
+/**
+ * Flush handler of the cache. Metadata changed by an open batch is held back
+ * until the batch is committed.
+ *
+ * @return int 0 on success, -1 on failure
+ */
+static int fs_flush()
+{
+    return fs_batch_open ? 0 : fs_write_back();
+}
+
+/**
+ * Reads the metadata of the file system on the disk the cache works on into
+ * memory. Afterwards the directory and the bitmap are only accessed there.
+ *
+ * @return int 0 on success, -1 if the disk is not formatted or unreadable
+ */
+static int fs_mount()
+{
+    fs_mounted = false;
+    unsigned char *block = fs_block(FS_SUPERBLOCK, false);
+    if (!block)
+    {
+        return -1;
+    }
+    memcpy((unsigned char *)&fs_super, block, sizeof(superblock));
+    if (fs_super.magic != FS_MAGIC || fs_super.file_count > MAX_FILE_COUNT ||
+        fs_super.bitmap_blocks * FS_BITS_PER_BLOCK < fs_super.block_count ||
+        fs_super.directory_blocks != FS_DIRECTORY_BLOCKS)
+    {
+        return -1;
+    }
+    // the bitmap is loaded block by block when it is needed
+    fs_bitmap_reset();
+    for (unsigned int i = 0; i < FS_DIRECTORY_BLOCKS; i++)
+    {
+        if (!(block = fs_block(fs_super.directory_start + i, false)))
+        {
+            return -1;
+        }
+        memcpy((unsigned char *)&fs_directory[i * FS_ENTRIES_PER_BLOCK], block,
+               FS_BLOCK_SIZE);
+        fs_directory_dirty[i] = false;
+    }
+    fs_hash_build();
+    fs_super_dirty = false;
+    fs_mounted = true;
+    return 0;
+}
+
+/**
+ * Checks that a file system is mounted, prints an error otherwise
+ *
+ * @return int 0 if it is mounted, -1 otherwise
+ */
+static int fs_check_mounted()
+{
+    if (!fs_mounted)
+    {
+        print("Error: No file system mounted, use 'format'\n",
+              DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Marks an entry of the directory as changed
+ *
+ * @param index index of the entry
+ */
+static void fs_entry_changed(unsigned int index)
+{
+    fs_directory_dirty[index / FS_ENTRIES_PER_BLOCK] = true;
+}
+
+/**
+ * Looks for a file by its name in the hash index
+ *
+ * @param name name of the file
+ * @return int index of the entry, -1 if the file does not exist
+ */
+static int fs_find(char *name)
+{
+    for (short i = fs_hash_heads[fs_hash(name)]; i >= 0; i = fs_hash_next[i])
+    {
+        if (string_equals(fs_directory[i].name, name))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Tells whether a block is used according to the bitmap
+ *
+ * @param block the block
+ * @return bool true if it is used, or if the bitmap could not be read
+ */
+static bool fs_block_used(unsigned int block)
+{
+    unsigned char *bits = fs_bitmap_block(block / FS_BITS_PER_BLOCK, false);
+    // a block in an unknown state is never allocated
+    unsigned int bit = block % FS_BITS_PER_BLOCK;
+    return !bits || ((bits[bit / 8] >> (bit % 8)) & 1);
+}
+
+/**
+ * Finds the next run of free blocks. Each block of the bitmap is fetched once
+ * and bytes with all blocks in the same state are skipped at once.
+ *
+ * @param from first block to look at
+ * @param limit the run ends after this many blocks, FS_RUN_UNLIMITED to get
+ * the whole run
+ * @param run receives the first block and the length of the run
+ * @return int 0 if a run was found, -1 if there is no free block
+ */
+static int fs_next_free_run(unsigned int from, unsigned int limit, extent *run)
+{
+    run->count = 0;
+    unsigned int block = from;
+    while (block < fs_super.block_count && run->count < limit)
+    {
+        unsigned int first = block - block % FS_BITS_PER_BLOCK;
+        unsigned int end = first + FS_BITS_PER_BLOCK;
+        if (end > fs_super.block_count)
+        {
+            end = fs_super.block_count;
+        }
+        unsigned char *bits = fs_bitmap_block(first / FS_BITS_PER_BLOCK, false);
+        if (!bits)
+        {
+            // blocks in an unknown state are never allocated
+            if (run->count)
+            {
+                return 0;
+            }
+            block = end;
+            continue;
+        }
+        while (block < end && run->count < limit)
+        {
+            unsigned int bit = block - first;
+            unsigned char byte = bits[bit / 8];
+            unsigned int step = 1;
+            bool used = (byte >> (bit % 8)) & 1;
+            if (bit % 8 == 0 && block + 8 <= end && (byte == 0 || byte == 0xff))
+            {
+                step = 8;
+            }
+            if (used)
+            {
+                if (run->count)
+                {
+                    return 0;
+                }
+                block += step;
+                continue;
+            }
+            if (!run->count)
+            {
+                run->start = block;
+            }
+            if (step > limit - run->count)
+            {
+                step = limit - run->count;
+            }
+            run->count += step;
+            block += step;
+        }
+    }
+    return run->count ? 0 : -1;
+}
+
+/**
+ * Marks blocks as used or free in the bitmap
+ *
+ * @param start first block
+ * @param count amount of blocks
+ * @param used true to mark them as used, false to free them
+ */
+static void fs_mark_blocks(unsigned int start, unsigned int count, bool used)
+{
+    unsigned char *bits = 0;
+    for (unsigned int block = start; block < start + count; block++)
+    {
+        unsigned int bit = block % FS_BITS_PER_BLOCK;
+        if (!bits || !bit)
+        {
+            bits = fs_bitmap_block(block / FS_BITS_PER_BLOCK, true);
+            if (!bits)
+            {
+                return;
+            }
+        }
+        unsigned char mask = 1 << (bit % 8);
+        if (used == !(bits[bit / 8] & mask))
+        {
+            if (fs_free_known && block >= fs_super.data_start)
+            {
+                fs_free_count = used ? fs_free_count - 1 : fs_free_count + 1;
+            }
+            bits[bit / 8] ^= mask;
+        }
+    }
+}
+
+/**
+ * Returns the amount of free blocks of the disk, which are counted if they
+ * are not known yet
+ *
+ * @return unsigned int amount of free blocks
+ */
+static unsigned int fs_free_blocks()
+{
+    if (fs_free_known)
+    {
+        return fs_free_count;
+    }
+    fs_free_count = 0;
+    extent run;
+    for (unsigned int from = fs_super.data_start;
+         !fs_next_free_run(from, FS_RUN_UNLIMITED, &run);
+         from = run.start + run.count)
+    {
+        fs_free_count += run.count;
+    }
+    fs_free_known = true;
+    return fs_free_count;
+}
+
+/**
+ * Finds the first run of free blocks large enough for a file
+ *
+ * @param count amount of blocks
+ * @param from first block the run may start at
+ * @param start receives the first block of the run
+ * @return int 0 if there is a run, -1 otherwise
+ */
+static int fs_find_free_run(unsigned int count, unsigned int from,
+                            unsigned int *start)
+{
+    extent run;
+    for (; !fs_next_free_run(from, count, &run); from = run.start + run.count)
+    {
+        if (run.count >= count)
+        {
+            *start = run.start;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Allocation strategy placing a file in the lowest run of free blocks large
+ * enough for it
+ *
+ * @param count amount of blocks, at least 1
+ * @param start receives the first block for the file
+ * @return int 0 on success, -1 if no run is large enough
+ */
+static int fs_place_first_fit(unsigned int count, unsigned int *start)
+{
+    return fs_find_free_run(count, fs_super.data_start, start);
+}
+
+/**
+ * Allocation strategy keeping a file within as few cylinders as possible,
+ * as close to the directory as possible. A file fitting into a cylinder is
+ * placed where it does not cross into the next one, one that does not starts
+ * at the beginning of a cylinder. Runs leaving FS_GROWTH_BLOCKS free behind
+ * the file are preferred, so it can grow in place.
+ *
+ * @param count amount of blocks, at least 1
+ * @param start receives the first block for the file
+ * @return int 0 on success, -1 if no run is large enough
+ */
+static int fs_place_cylinder_group(unsigned int count, unsigned int *start)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        unsigned int room = pass ? count : count + FS_GROWTH_BLOCKS;
+        extent run;
+        // a run this long fits the file even when it starts at the next
+        // cylinder, so the rest of it is not needed
+        for (unsigned int from = fs_super.data_start;
+             !fs_next_free_run(from, FS_CYLINDER_BLOCKS + room, &run);
+             from = run.start + run.count)
+        {
+            unsigned int block = run.start;
+            unsigned int in_cylinder =
+                FS_CYLINDER_BLOCKS - block % FS_CYLINDER_BLOCKS;
+            if (count > in_cylinder && in_cylinder < FS_CYLINDER_BLOCKS)
+            {
+                // try the beginning of the next cylinder
+                block += in_cylinder;
+            }
+            if (block + room <= run.start + run.count)
+            {
+                *start = block;
+                return 0;
+            }
+        }
+    }
+    return fs_place_first_fit(count, start);
+}
+
+/**
+ * Allocation strategy placing a file in the free blocks closest to the
+ * cylinder the file system accessed last, where the heads most likely are
+ *
+ * @param count amount of blocks, at least 1
+ * @param start receives the first block for the file
+ * @return int 0 on success, -1 if no run is large enough
+ */
+static int fs_place_nearest(unsigned int count, unsigned int *start)
+{
+    unsigned int head = fs_head_block / FS_CYLINDER_BLOCKS;
+    unsigned int best = 0xffffffff;
+    extent run;
+    for (unsigned int from = fs_super.data_start;
+         !fs_next_free_run(from, FS_RUN_UNLIMITED, &run);
+         from = run.start + run.count)
+    {
+        if (run.count < count)
+        {
+            continue;
+        }
+        // the block of the run closest to the heads
+        unsigned int block = fs_head_block;
+        if (block < run.start)
+        {
+            block = run.start;
+        }
+        else if (block > run.start + run.count - count)
+        {
+            block = run.start + run.count - count;
+        }
+        unsigned int cylinder = block / FS_CYLINDER_BLOCKS;
+        unsigned int distance =
+            cylinder > head ? cylinder - head : head - cylinder;
+        if (distance < best)
+        {
+            best = distance;
+            *start = block;
+        }
+    }
+    return best == 0xffffffff ? -1 : 0;
+}
+
+/** The allocation strategies, chosen with the 'alloc' command */
+static const fs_allocator fs_allocators[] = {
+    {"first-fit", fs_place_first_fit},
+    {"cylinder-group", fs_place_cylinder_group},
+    {"nearest", fs_place_nearest}};
+/** The strategy used for new files */
+static const fs_allocator *fs_allocator_used = &fs_allocators[1];
+
+/**
+ * Allocates blocks for a file and stores them as its extents. The strategy
+ * in use places all of them in one run of free blocks if there is one large
+ * enough, otherwise the blocks are taken from consecutive runs in order.
+ *
+ * @param count amount of blocks
+ * @param entry the file, receives the extents
+ * @return int 0 on success, -1 on failure
+ */
+static int fs_allocate(unsigned int count, file_entry *entry)
+{
+    entry->extent_count = 0;
+    if (count == 0)
+    {
+        return 0;
+    }
+    unsigned int start;
+    if (!fs_allocator_used->place(count, &start))
+    {
+        entry->extents[0].start = start;
+        entry->extents[0].count = count;
+        entry->extent_count = 1;
+        fs_mark_blocks(start, count, true);
+        return 0;
+    }
+    extent run;
+    // no run is large enough, spread the file over several of them
+    unsigned int left = count;
+    for (unsigned int from = fs_super.data_start;
+         left && !fs_next_free_run(from, left, &run);
+         from = run.start + run.count)
+    {
+        if (entry->extent_count == FILE_MAX_EXTENTS)
+        {
+            print("Error: The disk is too fragmented\n", DEFAULT_COLOR_SCHEME);
+            return -1;
+        }
+        entry->extents[entry->extent_count++] = run;
+        left -= run.count;
+    }
+    if (left)
+    {
+        print("Error: The disk is full\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    for (unsigned int i = 0; i < entry->extent_count; i++)
+    {
+        fs_mark_blocks(entry->extents[i].start, entry->extents[i].count, true);
+    }
+    return 0;
+}
+
+/**
+ * Frees the blocks of a file
+ *
+ * @param entry the file
+ */
+static void fs_free_extents(file_entry *entry)
+{
+    // inline files have no extents
+    for (unsigned int i = 0; i < entry->extent_count; i++)
+    {
+        fs_mark_blocks(entry->extents[i].start, entry->extents[i].count, false);
+    }
+}
+
+/**
+ * Amount of blocks needed for data of the given length
+ *
+ * @param length length in bytes
+ * @return unsigned int amount of blocks
+ */
+static unsigned int fs_blocks_for(unsigned int length)
+{
+    return (length + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+/**
+ * Accesses the data of a file through the cache. The accessible part ends at
+ * the end of an extent or of a cached track, so it can be shorter than
+ * requested. The returned pointer stays valid until the next call to one of
+ * the cache functions. Inline data is accessed in the entry itself.
+ *
+ * @param entry the file
+ * @param offset offset of the first byte within the data
+ * @param length amount of bytes wanted, receives the amount accessible
+ * @param mode FS_MAP_READ, FS_MAP_WRITE to change the data, or
+ * FS_MAP_OVERWRITE if the sectors are going to be overwritten completely, the
+ * offset has to be the start of a block then
+ * @return unsigned char* the data, or 0 on failure
+ */
+static unsigned char *fs_map(file_entry *entry, unsigned int offset,
+                             unsigned int *length, int mode)
+{
+    if (entry->flags & FILE_FLAG_INLINE)
+    {
+        if (offset + *length > FILE_INLINE_DATA_SIZE)
+        {
+            print("Error: The file is damaged\n", DEFAULT_COLOR_SCHEME);
+            return 0;
+        }
+        return entry->inline_data + offset;
+    }
+    unsigned int index = offset / FS_BLOCK_SIZE;
+    for (unsigned int i = 0; i < entry->extent_count; i++)
+    {
+        extent *run = &entry->extents[i];
+        if (index >= run->count)
+        {
+            index -= run->count;
+            continue;
+        }
+        unsigned int block = run->start + index;
+        unsigned int in_block = offset % FS_BLOCK_SIZE;
+        // stay within the extent and the track holding the block
+        unsigned int available = (run->count - index) * FS_BLOCK_SIZE - in_block;
+        unsigned int in_track =
+            (CACHE_LINE_SECTORS - block % CACHE_LINE_SECTORS) * FS_BLOCK_SIZE -
+            in_block;
+        if (available > in_track)
+        {
+            available = in_track;
+        }
+        if (*length > available)
+        {
+            *length = available;
+        }
+        fs_head_block = block;
+        unsigned int track = block / CACHE_LINE_SECTORS;
+        unsigned int track_offset =
+            (block % CACHE_LINE_SECTORS) * FS_BLOCK_SIZE + in_block;
+        char *line = mode == FS_MAP_OVERWRITE
+                         ? cache_overwrite(track, track_offset, *length)
+                         : cache_read(track, track_offset, *length);
+        if (!line)
+        {
+            print("Error: Could not read the file\n", DEFAULT_COLOR_SCHEME);
+            return 0;
+        }
+        if (mode == FS_MAP_WRITE)
+        {
+            // the caller changes the data right away
+            cache_mark_dirty(track, track_offset, *length);
+        }
+        return (unsigned char *)line + track_offset;
+    }
+    print("Error: The file is damaged\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Makes room for data of a file up to a new length. The last extent is
+ * extended if the following blocks are free, otherwise new extents are added.
+ * Inline data moves to blocks once it does not fit into the entry anymore.
+ * The data length itself is not changed.
+ *
+ * @param entry the file
+ * @param length new length of the data
+ * @return int 0 on success, -1 on failure
+ */
+static int fs_grow(file_entry *entry, unsigned int length)
+{
+    if (entry->flags & FILE_FLAG_INLINE)
+    {
+        if (length <= FILE_INLINE_DATA_SIZE)
+        {
+            return 0;
+        }
+        file_entry grown = *entry;
+        grown.flags &= ~FILE_FLAG_INLINE;
+        if (fs_allocate(fs_blocks_for(length), &grown))
+        {
+            return -1;
+        }
+        // the end of the inline data becomes the execute count
+        grown.execute_count = 0;
+        unsigned int piece = entry->data_length;
+        unsigned char *data =
+            piece ? fs_map(&grown, 0, &piece, FS_MAP_OVERWRITE) : 0;
+        if (piece && !data)
+        {
+            fs_free_extents(&grown);
+            return -1;
+        }
+        // inline data is shorter than a block, so it fits into one piece
+        memcpy(data, entry->inline_data, piece);
+        *entry = grown;
+        return 0;
+    }
+    unsigned int blocks = 0;
+    for (unsigned int i = 0; i < entry->extent_count; i++)
+    {
+        blocks += entry->extents[i].count;
+    }
+    if (fs_blocks_for(length) <= blocks)
+    {
+        return 0;
+    }
+    unsigned int extra = fs_blocks_for(length) - blocks;
+    if (entry->extent_count)
+    {
+        extent *last = &entry->extents[entry->extent_count - 1];
+        unsigned int behind = last->start + last->count;
+        extent run;
+        if (behind < fs_super.block_count && !fs_block_used(behind) &&
+            !fs_next_free_run(behind, extra, &run))
+        {
+            fs_mark_blocks(run.start, run.count, true);
+            last->count += run.count;
+            extra -= run.count;
+        }
+    }
+    if (!extra)
+    {
+        return 0;
+    }
+    file_entry more;
+    if (fs_allocate(extra, &more))
+    {
+        return -1;
+    }
+    if (entry->extent_count + more.extent_count > FILE_MAX_EXTENTS)
+    {
+        fs_free_extents(&more);
+        print("Error: The file is too fragmented\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    for (unsigned int i = 0; i < more.extent_count; i++)
+    {
+        entry->extents[entry->extent_count++] = more.extents[i];
+    }
+    return 0;
+}
+
+/**
+ * Hands the data of a file to an output function piece by piece, as it is
+ * read through the cache. Compressed files are decompressed on the way.
+ *
+ * @param entry the file
+ * @param output function receiving the data
+ * @param context context for the output function
+ * @return int 0 on success, -1 on failure
+ */
+static int fs_stream(file_entry *entry, lz_output output, void *context)
+{
+    bool compressed = entry->flags & FILE_FLAG_COMPRESSED;
+    int status = 1;
+    if (compressed)
+    {
+        lz_decoder_init(&fs_decoder);
+    }
+    for (unsigned int offset = 0; offset < entry->data_length;)
+    {
+        unsigned int length = entry->data_length - offset;
+        unsigned char *data = fs_map(entry, offset, &length, FS_MAP_READ);
+        if (!data)
+        {
+            return -1;
+        }
+        if (!compressed)
+        {
+            output(data, length, context);
+        }
+        else if ((status = lz_decode(&fs_decoder, data, length, output,
+                                     context)) <= 0)
+        {
+            break;
+        }
+        offset += length;
+    }
+    if (compressed && status != 0)
+    {
+        print("Error: The compressed data is damaged\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Output function of fs_stream printing the data, even if there are \0 bytes
+ *
+ * @param data the data
+ * @param length amount of bytes
+ * @param context unused
+ */
+static void fs_print_output(unsigned char *data, unsigned int length,
+                            void *context)
+{
+    (void)(context);
+    for (unsigned int i = 0; i < length; i++)
+    {
+        print_char(data[i], DEFAULT_COLOR_SCHEME);
+    }
+}
+
+/**
+ * Output function of fs_stream copying the data into a buffer
+ *
+ * @param data the data
+ * @param length amount of bytes
+ * @param context the fs_copy_target
+ */
+static void fs_copy_output(unsigned char *data, unsigned int length,
+                           void *context)
+{
+    fs_copy_target *target = (fs_copy_target *)context;
+    if (length > target->capacity - target->position)
+    {
+        target->overflow = true;
+        return;
+    }
+    memcpy(target->buffer + target->position, data, length);
+    target->position += length;
+}
+
+/**
+ * Prints an error message for a file which was not found
+ *
+ * @param filename name of the file
+ */
+static void fs_not_found(char *filename)
+{
+    print("File: '", DEFAULT_COLOR_SCHEME);
+    print(filename, DEFAULT_COLOR_SCHEME);
+    print("' not found\n", DEFAULT_COLOR_SCHEME);
+}
+
+/**
+ * Checks a file descriptor
+ *
+ * @param fd the file descriptor
+ * @return fs_open_file* the open file, or 0 if the descriptor is invalid
+ */
+static fs_open_file *fs_get_open_file(int fd)
+{
+    if (!fs_mounted || fd < 0 || fd >= FS_MAX_OPEN_FILES ||
+        !fs_open_files[fd].used)
+    {
+        print("Error: Invalid file descriptor\n", DEFAULT_COLOR_SCHEME);
+        return 0;
+    }
+    return &fs_open_files[fd];
+}
+
+/**
+ * Adds an empty file to the directory
+ *
+ * @param filename name of the file
+ * @return int index of the new entry, -1 on failure
+ */
+static int fs_add_entry(char *filename)
+{
+    if (fs_super.file_count >= MAX_FILE_COUNT)
+    {
+        print("Error: The directory is full\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    if (strlen(filename) >= MAX_FILENAME_LENGTH)
+    {
+        print("Error: The name is too long\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    unsigned int index = fs_super.file_count;
+    file_entry *entry = &fs_directory[index];
+    memset((unsigned char *)entry, 0, sizeof(file_entry));
+    string_copy(filename, entry->name);
+    // empty files are inline until their data grows
+    entry->flags = FILE_FLAG_INLINE;
+    fs_entry_changed(index);
+    fs_hash_insert(index);
+    fs_super.file_count++;
+    fs_super_dirty = true;
+    return index;
+}
+
+/**
+ * Opens a file
+ *
+ * @param filename name of the file
+ * @param flags FS_OPEN_READ and/or FS_OPEN_WRITE, FS_OPEN_CREATE to create
+ * the file if it does not exist
+ * @return int file descriptor, -1 on failure
+ */
+int fs_open(char *filename, int flags)
+{
+    if (fs_check_mounted())
+    {
+        return -1;
+    }
+    int fd = 0;
+    while (fd < FS_MAX_OPEN_FILES && fs_open_files[fd].used)
+    {
+        fd++;
+    }
+    if (fd == FS_MAX_OPEN_FILES)
+    {
+        print("Error: Too many open files\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    int index = fs_find(filename);
+    if (index < 0 && (flags & FS_OPEN_CREATE))
+    {
+        index = fs_add_entry(filename);
+    }
+    if (index < 0)
+    {
+        return -1;
+    }
+    if (fs_directory[index].flags & FILE_FLAG_COMPRESSED)
+    {
+        // positions in the decompressed data can't be found without
+        // decompressing everything in front of them
+        print("Error: Compressed files can only be printed or executed\n",
+              DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    fs_open_files[fd].used = true;
+    fs_open_files[fd].index = index;
+    fs_open_files[fd].position = 0;
+    fs_open_files[fd].flags = flags;
+    return fd;
+}
+
+/**
+ * Reads data of an open file at its position and advances the position
+ *
+ * @param fd file descriptor
+ * @param buffer receives the data
+ * @param count maximum amount of bytes to read
+ * @return int amount of bytes read, 0 at the end of the file, -1 on failure
+ */
+int fs_read(int fd, void *buffer, unsigned int count)
+{
+    fs_open_file *file = fs_get_open_file(fd);
+    if (!file || !(file->flags & FS_OPEN_READ))
+    {
+        return -1;
+    }
+    file_entry *entry = &fs_directory[file->index];
+    if (count > entry->data_length - file->position)
+    {
+        count = entry->data_length - file->position;
+    }
+    // stream piece by piece through the cache
+    for (unsigned int done = 0; done < count;)
+    {
+        unsigned int length = count - done;
+        unsigned char *data =
+            fs_map(entry, file->position, &length, FS_MAP_READ);
+        if (!data)
+        {
+            return -1;
+        }
+        memcpy((unsigned char *)buffer + done, data, length);
+        done += length;
+        file->position += length;
+    }
+    return count;
+}
+
+/**
+ * Writes data to an open file at its position and advances the position.
+ * The file grows if the data goes beyond its end.
+ *
+ * @param fd file descriptor
+ * @param buffer the data
+ * @param count amount of bytes to write
+ * @return int amount of bytes written, -1 on failure
+ */
+int fs_write(int fd, void *buffer, unsigned int count)
+{
+    fs_open_file *file = fs_get_open_file(fd);
+    if (!file || !(file->flags & FS_OPEN_WRITE))
+    {
+        return -1;
+    }
+    file_entry *entry = &fs_directory[file->index];
+    unsigned int end = file->position + count;
+    if (end > entry->data_length && fs_grow(entry, end))
+    {
+        return -1;
+    }
+    fs_entry_changed(file->index);
+    for (unsigned int done = 0; done < count;)
+    {
+        unsigned int length = count - done;
+        // whole sectors and sectors reaching the end of the data are
+        // overwritten without reading them first
+        int mode = FS_MAP_WRITE;
+        if (file->position % FS_BLOCK_SIZE == 0)
+        {
+            if (file->position + length >= entry->data_length)
+            {
+                mode = FS_MAP_OVERWRITE;
+            }
+            else if (length >= FS_BLOCK_SIZE)
+            {
+                length -= length % FS_BLOCK_SIZE;
+                mode = FS_MAP_OVERWRITE;
+            }
+        }
+        unsigned char *data = fs_map(entry, file->position, &length, mode);
+        if (!data)
+        {
+            return -1;
+        }
+        memcpy(data, (unsigned char *)buffer + done, length);
+        done += length;
+        file->position += length;
+        if (file->position > entry->data_length)
+        {
+            entry->data_length = file->position;
+        }
+    }
+    return count;
+}
+
+/**
+ * Moves the position of an open file
+ *
+ * @param fd file descriptor
+ * @param offset offset relative to whence
+ * @param whence FS_SEEK_SET, FS_SEEK_CUR or FS_SEEK_END
+ * @return int the new position, -1 if it would be outside of the file
+ */
+int fs_lseek(int fd, int offset, int whence)
+{
+    fs_open_file *file = fs_get_open_file(fd);
+    if (!file)
+    {
+        return -1;
+    }
+    int base = 0;
+    if (whence == FS_SEEK_CUR)
+    {
+        base = file->position;
+    }
+    else if (whence == FS_SEEK_END)
+    {
+        base = fs_directory[file->index].data_length;
+    }
+    int position = base + offset;
+    if (position < 0 ||
+        (unsigned int)position > fs_directory[file->index].data_length)
+    {
+        return -1;
+    }
+    file->position = position;
+    return position;
+}
+
+/**
+ * Closes an open file
+ *
+ * @param fd file descriptor
+ * @return int 0 on success, -1 if the descriptor is invalid
+ */
+int fs_close(int fd)
+{
+    fs_open_file *file = fs_get_open_file(fd);
+    if (!file)
+    {
+        return -1;
+    }
+    file->used = false;
+    return 0;
+}
+
+/**
+ * Create a file, which is then written to the floppy.
+ *
+ * @param filename Zero-Terminated String. Name of the file. Maximum 59 chars
+ * @param data Zero-Terminated String. Content of the file
+ * @return int 0 on success, -1 on failure
+ */
+int create_file(char *filename, char *data)
+{
+    if (fs_check_mounted())
+    {
+        return -1;
+    }
+    if (fs_find(filename) >= 0)
+    {
+        print("Error: The file already exists\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    int fd = fs_open(filename, FS_OPEN_WRITE | FS_OPEN_CREATE);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    // tiny files stay inline, larger ones get their blocks in one piece
+    unsigned int length = strlen(data) + 1;
+    int written = fs_write(fd, data, length);
+    fs_close(fd);
+    if (written != (int)length)
+    {
+        delete_file(filename);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Deletes a file and frees its blocks
+ *
+ * @param filename name of the file
+ * @return int 0 on success, -1 on failure
+ */
+int delete_file(char *filename)
+{
+    if (fs_check_mounted())
+    {
+        return -1;
+    }
+    int index = fs_find(filename);
+    if (index < 0)
+    {
+        fs_not_found(filename);
+        return -1;
+    }
+    for (int i = 0; i < FS_MAX_OPEN_FILES; i++)
+    {
+        if (fs_open_files[i].used && fs_open_files[i].index == (unsigned int)index)
+        {
+            print("Error: The file is open\n", DEFAULT_COLOR_SCHEME);
+            return -1;
+        }
+    }
+    fs_free_extents(&fs_directory[index]);
+    // the last entry takes the place of the deleted one
+    fs_hash_remove(index);
+    fs_super.file_count--;
+    if ((unsigned int)index != fs_super.file_count)
+    {
+        fs_hash_remove(fs_super.file_count);
+        fs_directory[index] = fs_directory[fs_super.file_count];
+        fs_hash_insert(index);
+        // open files follow their moved entry
+        for (int i = 0; i < FS_MAX_OPEN_FILES; i++)
+        {
+            if (fs_open_files[i].used &&
+                fs_open_files[i].index == fs_super.file_count)
+            {
+                fs_open_files[i].index = index;
+            }
+        }
+    }
+    memset((unsigned char *)&fs_directory[fs_super.file_count], 0,
+           sizeof(file_entry));
+    fs_entry_changed(index);
+    fs_entry_changed(fs_super.file_count);
+    fs_super_dirty = true;
+    return 0;
+}
+
+/**
+ * Opens a batch of changes. The metadata changes of all following creates and
+ * deletes are held in memory and written back together when the batch is
+ * committed, instead of once per file.
+ *
+ * @return int 0 on success, -1 if a batch is open already
+ */
+int fs_batch_begin()
+{
+    if (fs_check_mounted())
+    {
+        return -1;
+    }
+    if (fs_batch_open)
+    {
+        print("Error: A batch is open already\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    // the cache holds the state before the batch, so it can be aborted
+    if (fs_write_back())
+    {
+        return -1;
+    }
+    fs_batch_open = true;
+    return 0;
+}
+
+/**
+ * Commits the open batch: the changed metadata is written back once and all
+ * changes are written to the disk in a single sweep, so the data of all files
+ * is ordered by cylinder.
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int fs_batch_commit()
+{
+    if (!fs_batch_open)
+    {
+        return -1;
+    }
+    fs_batch_open = false;
+    return cache_sync();
+}
 
 /**
- * Maximal number of Files a 1.44MB floppy can hold, because each file
- * has a dedicated track, which there are 120 of. Track 0 is reserved for the
- * files record
- * */
-#define MAX_FILE_COUNT 119
-/** Track file index 0 is reserverd for the files record */
-#define FILES_RECORD_INDEX 0
+ * Aborts the open batch and drops its changes. The metadata is mounted again
+ * from the state before the batch, the data written in the batch stays in
+ * blocks which are free again.
+ */
+void fs_batch_abort()
+{
+    if (!fs_batch_open)
+    {
+        return;
+    }
+    fs_batch_open = false;
+    if (fs_mount())
+    {
+        print("Error: Could not mount the file system again\n",
+              DEFAULT_COLOR_SCHEME);
+    }
+}
+
+/**
+ * Cylinders the heads move to read a file, coming from the directory
+ *
+ * @param entry the file
+ * @return unsigned int amount of cylinders
+ */
+static unsigned int fs_seek_distance(file_entry *entry)
+{
+    unsigned int cylinder = fs_super.directory_start / FS_CYLINDER_BLOCKS;
+    unsigned int distance = 0;
+    for (unsigned int i = 0; i < entry->extent_count; i++)
+    {
+        extent *run = &entry->extents[i];
+        unsigned int first = run->start / FS_CYLINDER_BLOCKS;
+        distance += first > cylinder ? first - cylinder : cylinder - first;
+        // the extent itself is read cylinder by cylinder
+        cylinder = (run->start + run->count - 1) / FS_CYLINDER_BLOCKS;
+        distance += cylinder - first;
+    }
+    return distance;
+}
+
+/**
+ * Collects statistics about the placement of the files with blocks
+ *
+ * @param layout receives the statistics
+ */
+static void fs_layout_stats(fs_layout *layout)
+{
+    memset((unsigned char *)layout, 0, sizeof(fs_layout));
+    for (unsigned int i = 0; i < fs_super.file_count; i++)
+    {
+        file_entry *entry = &fs_directory[i];
+        if ((entry->flags & FILE_FLAG_INLINE) || !entry->extent_count)
+        {
+            continue;
+        }
+        unsigned int distance = fs_seek_distance(entry);
+        layout->files++;
+        layout->fragmented += entry->extent_count > 1;
+        layout->extents += entry->extent_count;
+        layout->cylinders += distance;
+        layout->executed_cylinders += distance * entry->execute_count;
+        layout->executions += entry->execute_count;
+    }
+}
+
+/**
+ * Prints statistics about the placement of the files
+ *
+ * @param label printed in front of them
+ * @param layout the statistics
+ */
+static void fs_print_layout(char *label, fs_layout *layout)
+{
+    print(label, DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(layout->fragmented, DEFAULT_COLOR_SCHEME);
+    print(" of ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(layout->files, DEFAULT_COLOR_SCHEME);
+    print(" files fragmented, ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(layout->extents, DEFAULT_COLOR_SCHEME);
+    print(" extents, ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(layout->cylinders, DEFAULT_COLOR_SCHEME);
+    print(" cylinders of seeking to read all", DEFAULT_COLOR_SCHEME);
+    if (layout->executions)
+    {
+        print(", ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(layout->executed_cylinders, DEFAULT_COLOR_SCHEME);
+        print(" for ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(layout->executions, DEFAULT_COLOR_SCHEME);
+        print(" executions", DEFAULT_COLOR_SCHEME);
+    }
+    print("\n", DEFAULT_COLOR_SCHEME);
+}
+
+/**
+ * Marks the blocks of a run which are covered by a block of the bitmap in
+ * fs_owned
+ *
+ * @param first first block covered by the block of the bitmap
+ * @param start first block of the run
+ * @param count amount of blocks of the run
+ */
+static void fs_mark_owned(unsigned int first, unsigned int start,
+                          unsigned int count)
+{
+    for (unsigned int block = start;
+         block < start + count && block < fs_super.block_count; block++)
+    {
+        if (block - first < FS_BITS_PER_BLOCK)
+        {
+            unsigned int bit = block - first;
+            fs_owned[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+}
+
+/**
+ * Makes the bitmap match the blocks the files use. Blocks are left marked as
+ * used without belonging to a file if a move was interrupted, see fs_move.
+ * The bitmap is compared block by block.
+ *
+ * @return unsigned int amount of blocks which were freed
+ */
+static unsigned int fs_reclaim()
+{
+    unsigned int freed = 0;
+    for (unsigned int index = 0; index < fs_super.bitmap_blocks; index++)
+    {
+        unsigned int first = index * FS_BITS_PER_BLOCK;
+        memset(fs_owned, 0, sizeof(fs_owned));
+        fs_mark_owned(first, FS_SUPERBLOCK, fs_super.data_start);
+        for (unsigned int i = 0; i < fs_super.file_count; i++)
+        {
+            file_entry *entry = &fs_directory[i];
+            for (unsigned int j = 0;
+                 !(entry->flags & FILE_FLAG_INLINE) && j < entry->extent_count;
+                 j++)
+            {
+                fs_mark_owned(first, entry->extents[j].start,
+                              entry->extents[j].count);
+            }
+        }
+        unsigned char *bits = fs_bitmap_block(index, false);
+        if (!bits)
+        {
+            break;
+        }
+        bool changed = false;
+        for (unsigned int i = 0; i < FS_BLOCK_SIZE; i++)
+        {
+            if (bits[i] == fs_owned[i])
+            {
+                continue;
+            }
+            for (unsigned char lost = bits[i] & ~fs_owned[i]; lost; lost >>= 1)
+            {
+                freed += lost & 1;
+            }
+            bits[i] = fs_owned[i];
+            changed = true;
+        }
+        if (changed)
+        {
+            // marks the block as changed, it is still held in memory
+            fs_bitmap_block(index, true);
+        }
+    }
+    // the bits were changed directly, the free blocks are counted again
+    fs_free_known = false;
+    return freed;
+}
 
 /**
- * Record of the files on the drive. Containing count and names
+ * Looks for the file a block belongs to
+ *
+ * @param block the block
+ * @return int index of the file's entry, -1 if it belongs to none
  */
-typedef struct record
+static int fs_owner(unsigned int block)
 {
-    // amount of files currently on the drive
-    unsigned short file_count;
-    // array of file names
-    char file_names[MAX_FILE_COUNT][MAX_FILENAME_LENGTH];
-} __attribute__((packed)) record;
+    for (unsigned int i = 0; i < fs_super.file_count; i++)
+    {
+        file_entry *entry = &fs_directory[i];
+        for (unsigned int j = 0;
+             !(entry->flags & FILE_FLAG_INLINE) && j < entry->extent_count; j++)
+        {
+            if (block - entry->extents[j].start < entry->extents[j].count)
+            {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
 
 /**
- * Create a file, which is then written to the floppy.
+ * Tells whether a file is placed before another one by 'defrag': programs
+ * executed more often come first, otherwise the files keep their order.
  *
- * @param filename Zero-Terminated String. Name of the file. Maximum 59 chars
- * @param data Zero-Terminated String. Content of the file. Maximum 18367 chars
+ * @param a index of the one file
+ * @param b index of the other file
+ * @return bool true if a comes first
  */
-void create_file(char *filename, char *data)
+static bool fs_placed_before(unsigned int a, unsigned int b)
 {
-    // load the file record
-    floppy_read_buffer(FILES_RECORD_INDEX);
-    struct record *record = (struct record *)floppy_dmabuf;
+    file_entry *first = &fs_directory[a];
+    file_entry *second = &fs_directory[b];
+    if (first->execute_count != second->execute_count)
+    {
+        return first->execute_count > second->execute_count;
+    }
+    return first->extents[0].start < second->extents[0].start;
+}
 
-    // save the filename into the record
-    string_copy(filename, record->file_names[record->file_count]);
-    // increment the filecount
-    record->file_count++;
-    int count = record->file_count;
+/**
+ * Sorts the files with blocks into fs_layout_order
+ *
+ * @return unsigned int amount of files
+ */
+static unsigned int fs_sort_layout()
+{
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < fs_super.file_count; i++)
+    {
+        if ((fs_directory[i].flags & FILE_FLAG_INLINE) ||
+            !fs_directory[i].extent_count)
+        {
+            continue;
+        }
+        // insertion sort, the directory is small
+        unsigned int j = count++;
+        for (; j > 0 && fs_placed_before(i, fs_layout_order[j - 1]); j--)
+        {
+            fs_layout_order[j] = fs_layout_order[j - 1];
+        }
+        fs_layout_order[j] = i;
+    }
+    return count;
+}
 
-    // write the changed record
-    floppy_write_buffer(FILES_RECORD_INDEX);
+/**
+ * Moves the data of a file to a run of free blocks. The copy and the bitmap
+ * marking its blocks are written to the disk before the entry points to the
+ * copy, and the old blocks are freed once the entry is on the disk. A crash
+ * in between leaves the file intact, at worst with blocks marked as used
+ * which don't belong to a file, which fs_reclaim frees again.
+ *
+ * @param index index of the file's entry
+ * @param start first block of the run, which has to be free
+ * @return int 0 on success, -1 on failure
+ */
+static int fs_move(unsigned int index, unsigned int start)
+{
+    file_entry *entry = &fs_directory[index];
+    unsigned int count = fs_blocks_for(entry->data_length);
+    fs_mark_blocks(start, count, true);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        // the block read may leave the cache once the copy is accessed
+        unsigned int length = FS_BLOCK_SIZE;
+        unsigned char *data =
+            fs_map(entry, i * FS_BLOCK_SIZE, &length, FS_MAP_READ);
+        if (!data)
+        {
+            fs_mark_blocks(start, count, false);
+            return -1;
+        }
+        memcpy(fs_move_buffer, data, FS_BLOCK_SIZE);
+        unsigned char *copy = fs_block(start + i, true);
+        if (!copy)
+        {
+            fs_mark_blocks(start, count, false);
+            return -1;
+        }
+        memcpy(copy, fs_move_buffer, FS_BLOCK_SIZE);
+    }
+    if (cache_sync())
+    {
+        fs_mark_blocks(start, count, false);
+        print("Error: Could not write the moved file\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    file_entry old = *entry;
+    memset((unsigned char *)entry->extents, 0, sizeof(entry->extents));
+    entry->extents[0].start = start;
+    entry->extents[0].count = count;
+    entry->extent_count = 1;
+    fs_entry_changed(index);
+    if (cache_sync())
+    {
+        // the old blocks stay used, whichever entry is on the disk
+        print("Error: Could not write the moved file\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    fs_free_extents(&old);
+    return 0;
+}
 
-    // clear the buffer
-    floppy_clear_buffer();
-    // access the buffer as a file
-    struct file *file = (struct file *)floppy_dmabuf;
-    // write the filename
-    string_copy(filename, file->name);
-    // write the data length
-    file->data_length = strlen(data) + 1;
-    // write the data
-    string_copy(data, (char *)file->data);
+/**
+ * Moves one file closer to the compact layout: the files are packed behind
+ * the directory in the order of fs_placed_before, each in a single extent.
+ * The first file which is not in its place yet is moved there if the blocks
+ * are free, otherwise the file in the way is moved out of it.
+ *
+ * @return int 1 if a file was moved, 0 if the layout is compact, -1 on
+ * failure
+ */
+static int fs_defrag_step()
+{
+    unsigned int files = fs_sort_layout();
+    unsigned int place = fs_super.data_start;
+    unsigned int end = place;
+    for (unsigned int i = 0; i < files; i++)
+    {
+        end += fs_blocks_for(fs_directory[fs_layout_order[i]].data_length);
+    }
+    for (unsigned int i = 0; i < files; i++)
+    {
+        unsigned int index = fs_layout_order[i];
+        file_entry *entry = &fs_directory[index];
+        if (entry->extent_count == 1 && entry->extents[0].start == place)
+        {
+            place += entry->extents[0].count;
+            continue;
+        }
+        unsigned int count = fs_blocks_for(entry->data_length);
+        unsigned int block = place;
+        extent run;
+        if (place < fs_super.block_count && !fs_block_used(place) &&
+            !fs_next_free_run(place, count, &run))
+        {
+            block += run.count;
+        }
+        if (block == place + count)
+        {
+            return fs_move(index, place) ? -1 : 1;
+        }
+        // the file owning the first used block has to make room. It moves
+        // behind the compact layout if possible, where it is in no one's way.
+        int in_the_way = block < fs_super.block_count ? fs_owner(block) : -1;
+        unsigned int behind = end > place + count ? end : place + count;
+        unsigned int needed = 0;
+        unsigned int start;
+        if (in_the_way >= 0)
+        {
+            needed = fs_blocks_for(fs_directory[in_the_way].data_length);
+        }
+        if (in_the_way < 0 ||
+            (fs_find_free_run(needed, behind, &start) &&
+             fs_find_free_run(needed, place + count, &start)))
+        {
+            print("Error: Not enough free space to move the files\n",
+                  DEFAULT_COLOR_SCHEME);
+            return -1;
+        }
+        return fs_move(in_the_way, start) ? -1 : 1;
+    }
+    return 0;
+}
 
-    // write the file to the next free track on the floppy
-    floppy_write_buffer(count);
+/**
+ * Creates an empty file system on the disk the cache works on and mounts it
+ *
+ * @return int 0 on success, -1 on failure
+ */
+static int format_disk()
+{
+    block_device *device = cache_get_device();
+    if (!device)
+    {
+        return -1;
+    }
+    fs_mounted = false;
+    fs_batch_open = false;
+    memset((unsigned char *)fs_open_files, 0, sizeof(fs_open_files));
+    memset((unsigned char *)&fs_super, 0, sizeof(superblock));
+    fs_super.magic = FS_MAGIC;
+    fs_super.block_count = device->block_count;
+    fs_super.bitmap_start = FS_SUPERBLOCK + 1;
+    fs_super.bitmap_blocks =
+        (fs_super.block_count + FS_BITS_PER_BLOCK - 1) / FS_BITS_PER_BLOCK;
+    fs_super.directory_start = fs_super.bitmap_start + fs_super.bitmap_blocks;
+    fs_super.directory_blocks = FS_DIRECTORY_BLOCKS;
+    fs_super.data_start = fs_super.directory_start + fs_super.directory_blocks;
+    if (fs_super.data_start >= fs_super.block_count)
+    {
+        print("Error: Unsupported disk size\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    // a cleared bitmap, the blocks are loaded from the cache again when
+    // they are marked
+    static unsigned char empty[FS_BLOCK_SIZE];
+    fs_bitmap_reset();
+    for (unsigned int i = 0; i < fs_super.bitmap_blocks; i++)
+    {
+        if (fs_store_block(fs_super.bitmap_start + i, empty))
+        {
+            return -1;
+        }
+    }
+    memset((unsigned char *)fs_directory, 0, sizeof(fs_directory));
+    fs_mark_blocks(FS_SUPERBLOCK, fs_super.data_start, true);
+    fs_hash_build();
+    fs_super_dirty = true;
+    for (unsigned int i = 0; i < FS_DIRECTORY_BLOCKS; i++)
+    {
+        fs_directory_dirty[i] = true;
+    }
+    fs_mounted = true;
+    return fs_write_back();
 }
 
 /**
@@ -101,6 +1928,121 @@ static int create_file_command(int argc, char **argv)
     return 0;
 }
 
+/**
+ * Shell command function for creating several files in one batch. If one of
+ * them can't be created, none of them is.
+ *
+ * @param args Arguments string. Expected format:
+ * command_name file_name file_data [file_name file_data ...]
+ */
+static int batch_command(int argc, char **argv)
+{
+    if (argc < 3 || argc % 2 == 0)
+    {
+        print("Error: Expected pairs of file names and data!\n",
+              DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    if (fs_batch_begin())
+    {
+        return 1;
+    }
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (create_file(argv[i], argv[i + 1]))
+        {
+            fs_batch_abort();
+            print("Batch aborted\n", DEFAULT_COLOR_SCHEME);
+            return 1;
+        }
+    }
+    if (fs_batch_commit())
+    {
+        print("Error: Could not write back the batch\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    print("Created ", DEFAULT_COLOR_SCHEME);
+    print_int(argc / 2, DEFAULT_COLOR_SCHEME);
+    print(" files\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Shell command function for appending text to a file. The terminating zero
+ * of the text already in the file is replaced.
+ *
+ * @param args Arguments string. Expected format:
+ * command_name file_name file_data
+ */
+static int append_command(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        print("Error: Did not provide enough arguments!\n",
+              DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    // Replace zero bits before argument strings with whitespaces to create
+    // one long string
+    for (int i = 3; i < argc; i++)
+    {
+        argv[i][-1] = ' ';
+    }
+    int fd = fs_open(argv[1], FS_OPEN_READ | FS_OPEN_WRITE | FS_OPEN_CREATE);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    char last = 1;
+    if (fs_lseek(fd, -1, FS_SEEK_END) >= 0 && fs_read(fd, &last, 1) == 1 &&
+        last == 0)
+    {
+        fs_lseek(fd, -1, FS_SEEK_END);
+    }
+    unsigned int length = strlen(argv[2]) + 1;
+    int written = fs_write(fd, argv[2], length);
+    fs_close(fd);
+    return written == (int)length ? 0 : 1;
+}
+
+/**
+ * Shell command function for deleting a file
+ *
+ * @param args Arguments string. Expected format:
+ * command_name file_name
+ */
+static int delete_file_command(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        print("Error: Did not provide enough arguments!\n",
+              DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    return delete_file(argv[1]) ? 1 : 0;
+}
+
+/**
+ * Shell command function for creating an empty file system
+ *
+ * @param args Arguments string. None expected
+ */
+static int format_command(int argc, char **argv)
+{
+    // surpressing unused parameter warnings
+    (void)(argc);
+    (void)(argv);
+    if (format_disk())
+    {
+        print("Error: Could not format the disk\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    print("Formatted ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(fs_super.block_count, DEFAULT_COLOR_SCHEME);
+    print(" blocks\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
 /**
  * Shell command function for listing all files on the floppy
  *
@@ -113,15 +2055,25 @@ static int list_files_command(int argc, char **argv)
     (void)(argv);
 
     print("Listing files...\n", DEFAULT_COLOR_SCHEME);
-    // reading files record
-    floppy_read_buffer(FILES_RECORD_INDEX);
-    struct record *record = (struct record *)floppy_dmabuf;
-    // for each file, print its name
-    for (int i = 0; i < record->file_count; i++)
+    if (fs_check_mounted())
+    {
+        return 1;
+    }
+    // for each file, print its name and size
+    for (unsigned int i = 0; i < fs_super.file_count; i++)
     {
-        print(record->file_names[i], DEFAULT_COLOR_SCHEME);
-        print("\n", 0);
+        print(fs_directory[i].name, DEFAULT_COLOR_SCHEME);
+        print(" (", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(fs_directory[i].data_length, DEFAULT_COLOR_SCHEME);
+        print(fs_directory[i].flags & FILE_FLAG_COMPRESSED
+                  ? " bytes, compressed)\n"
+                  : " bytes)\n",
+              DEFAULT_COLOR_SCHEME);
     }
+    print_unsigned_int(fs_free_blocks(), DEFAULT_COLOR_SCHEME);
+    print(" of ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(fs_super.block_count, DEFAULT_COLOR_SCHEME);
+    print(" blocks free\n", DEFAULT_COLOR_SCHEME);
     return 0;
 }
 
@@ -141,31 +2093,22 @@ static int print_file_command(int argc, char **argv)
     }
     // the second word is the filename argument
     char *filename = argv[1];
-    // read the files record
-    floppy_read_buffer(FILES_RECORD_INDEX);
-    struct record *record = (struct record *)floppy_dmabuf;
-    // try to find a record entry for the filename
-    for (unsigned short i = 0; i < record->file_count; i++)
+    if (fs_check_mounted())
     {
-        if (string_equals(record->file_names[i], filename))
-        {
-            // read the found file
-            floppy_read_buffer(i + 1);
-            struct file *file = (struct file *)floppy_dmabuf;
-            // print its full data, even if there are \0 bytes
-            for (unsigned int j = 0; j < file->data_length; j++)
-            {
-                print_char(((unsigned char *)(file->data))[j],
-                           DEFAULT_COLOR_SCHEME);
-            }
-            print("\n", DEFAULT_COLOR_SCHEME);
-            return 0;
-        }
+        return 1;
     }
-    // print file not found message, if the filename was not found in the record
-    print("File: '", DEFAULT_COLOR_SCHEME);
-    print(filename, DEFAULT_COLOR_SCHEME);
-    print("' not found\n", DEFAULT_COLOR_SCHEME);
+    int index = fs_find(filename);
+    if (index < 0)
+    {
+        fs_not_found(filename);
+        return 0;
+    }
+    // print its full data piece by piece, even if there are \0 bytes
+    if (fs_stream(&fs_directory[index], fs_print_output, 0))
+    {
+        return 1;
+    }
+    print("\n", DEFAULT_COLOR_SCHEME);
     return 0;
 }
 
@@ -185,47 +2128,219 @@ static int execute_file_command(int argc, char **argv)
     }
     // the second word is the filename argument
     char *filename = argv[1];
-    // read the files record
-    floppy_read_buffer(FILES_RECORD_INDEX);
-    struct record *record = (struct record *)floppy_dmabuf;
-    // try to find a record entry for the filename
-    for (int i = 0; i < record->file_count; i++)
-    {
-        if (string_equals(record->file_names[i], filename))
-        {
-            // if the file is found read it into the buffer
-            floppy_read_buffer(i + 1);
-            struct file *file = (struct file *)floppy_dmabuf;
-            // execute the data as if it were a file with the signature:
-            // int filename(int argc, char **argv);
-            int (*func)(int argc, char **argv) = (int (*)(int, char **))file->data;
-            // getting rid of the first argv string 'execute'
-            argv = &argv[1];
-            argc--;
-            int exit_value = func(argc, argv);
-            print("Program ended with exit value: ", DEFAULT_COLOR_SCHEME);
-            print_int(exit_value, DEFAULT_COLOR_SCHEME);
-            print("\n", 0);
+    if (fs_check_mounted())
+    {
+        return 1;
+    }
+    int index = fs_find(filename);
+    if (index < 0)
+    {
+        fs_not_found(filename);
+        return 0;
+    }
+    // the extents may lie on several tracks, so the program is put together
+    // in memory. Compressed programs are decompressed on the way.
+    fs_copy_target target = {fs_program, MAX_PROGRAM_SIZE, 0, false};
+    if (fs_stream(&fs_directory[index], fs_copy_output, &target))
+    {
+        return 1;
+    }
+    if (target.overflow)
+    {
+        print("Error: The program is too large\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    // execute the data as if it were a file with the signature:
+    // int filename(int argc, char **argv);
+    int (*func)(int argc, char **argv) = (int (*)(int, char **))fs_program;
+    // the count is written back with the directory on 'sync' or by the
+    // periodic write back, so executing doesn't wait for the disk
+    if (!(fs_directory[index].flags & FILE_FLAG_INLINE))
+    {
+        fs_directory[index].execute_count++;
+        fs_entry_changed(index);
+    }
+    // getting rid of the first argv string 'execute'
+    argv = &argv[1];
+    argc--;
+    int exit_value = func(argc, argv);
+    print("Program ended with exit value: ", DEFAULT_COLOR_SCHEME);
+    print_int(exit_value, DEFAULT_COLOR_SCHEME);
+    print("\n", 0);
+    return 0;
+}
+
+/**
+ * Shell command function for compacting the layout of the files. Files are
+ * moved one at a time until each of them is contiguous and they are packed
+ * behind the directory, the programs executed most often first. A move can
+ * be interrupted at any time, so the compaction can be done a few files at a
+ * time.
+ *
+ * @param args Arguments string. Expected format:
+ * command_name [maximum amount of files to move]
+ */
+static int defrag_command(int argc, char **argv)
+{
+    unsigned int limit = 0xffffffff;
+    if (argc > 1 && string_to_unsigned_int(argv[1], &limit))
+    {
+        print("Error: Expected the amount of files to move\n",
+              DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    if (fs_check_mounted())
+    {
+        return 1;
+    }
+    if (fs_batch_open)
+    {
+        print("Error: A batch is open\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    fs_layout layout;
+    fs_layout_stats(&layout);
+    fs_print_layout("Before: ", &layout);
+    unsigned int freed = fs_reclaim();
+    if (freed)
+    {
+        print("Freed ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(freed, DEFAULT_COLOR_SCHEME);
+        print(" blocks not belonging to any file\n", DEFAULT_COLOR_SCHEME);
+    }
+    unsigned int moved = 0;
+    int status = 0;
+    while (moved < limit && (status = fs_defrag_step()) > 0)
+    {
+        moved++;
+    }
+    // the execute counts are written back together with the moves
+    for (unsigned int i = 0; i < fs_super.file_count; i += FS_ENTRIES_PER_BLOCK)
+    {
+        fs_entry_changed(i);
+    }
+    print("Moved ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(moved, DEFAULT_COLOR_SCHEME);
+    print(" files\n", DEFAULT_COLOR_SCHEME);
+    fs_layout_stats(&layout);
+    fs_print_layout("After: ", &layout);
+    if (status > 0)
+    {
+        print("Use 'defrag' again to continue\n", DEFAULT_COLOR_SCHEME);
+    }
+    return status < 0 ? 1 : 0;
+}
+
+/**
+ * Shell command function for choosing how the blocks of new files are
+ * placed. Without an argument the strategies are listed.
+ *
+ * @param args Arguments string. Expected format:
+ * command_name [strategy]
+ */
+static int alloc_command(int argc, char **argv)
+{
+    unsigned int count = sizeof(fs_allocators) / sizeof(fs_allocator);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (argc < 2)
+        {
+            print(&fs_allocators[i] == fs_allocator_used ? "* " : "  ",
+                  DEFAULT_COLOR_SCHEME);
+            print(fs_allocators[i].name, DEFAULT_COLOR_SCHEME);
+            print("\n", DEFAULT_COLOR_SCHEME);
+        }
+        else if (string_equals(fs_allocators[i].name, argv[1]))
+        {
+            fs_allocator_used = &fs_allocators[i];
             return 0;
         }
     }
-    // print file not found message, if the filename was not found in the record
-    print("File: '", DEFAULT_COLOR_SCHEME);
-    print(filename, DEFAULT_COLOR_SCHEME);
-    print("' not found\n", DEFAULT_COLOR_SCHEME);
+    if (argc < 2)
+    {
+        return 0;
+    }
+    print("Error: Unknown strategy, use 'alloc' to list them\n",
+          DEFAULT_COLOR_SCHEME);
+    return 1;
+}
+
+/**
+ * Shell command function for moving the file system to another block
+ * device, see 'devices'. The changes on the current device are written back,
+ * then the cache switches to the new device and its file system is mounted.
+ *
+ * @param args Arguments string. Expected format:
+ * command_name device_name
+ */
+static int mount_command(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        block_device *current = cache_get_device();
+        print("Mounted: ", DEFAULT_COLOR_SCHEME);
+        print(current ? current->name : "none", DEFAULT_COLOR_SCHEME);
+        print("\n", DEFAULT_COLOR_SCHEME);
+        return 0;
+    }
+    block_device *device = block_device_find(argv[1]);
+    if (!device)
+    {
+        print("Error: Unknown device, use 'devices' to list them\n",
+              DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    if (fs_batch_open)
+    {
+        print("Error: A batch is open\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    for (int i = 0; i < FS_MAX_OPEN_FILES; i++)
+    {
+        if (fs_open_files[i].used)
+        {
+            print("Error: Files are open\n", DEFAULT_COLOR_SCHEME);
+            return 1;
+        }
+    }
+    // writes back everything of the current device first
+    if (cache_attach(device))
+    {
+        print("Error: Could not switch to the device\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    if (fs_mount())
+    {
+        print("No file system found, use 'format'\n", DEFAULT_COLOR_SCHEME);
+        return 1;
+    }
+    print("Mounted ", DEFAULT_COLOR_SCHEME);
+    print(device->name, DEFAULT_COLOR_SCHEME);
+    print("\n", DEFAULT_COLOR_SCHEME);
     return 0;
 }
 
 /**
- * Installing the file system.
+ * Installing the file system. The file system on the disk the cache works on
+ * is mounted, its changed metadata is written back together with the cache.
  */
 void install_filesystem()
 {
-    // clear the floppy buffer in case there is something in there
-    floppy_clear_buffer();
+    if (fs_mount())
+    {
+        print("No file system found, use 'format'\n", DEFAULT_COLOR_SCHEME);
+    }
+    cache_install_flush_handler(fs_flush);
     // register the commands
     register_command("list", (int (*)(int, char **))list_files_command);
     register_command("create", (int (*)(int, char **))create_file_command);
     register_command("print", (int (*)(int, char **))print_file_command);
     register_command("execute", (int (*)(int, char **))execute_file_command);
+    register_command("delete", (int (*)(int, char **))delete_file_command);
+    register_command("format", (int (*)(int, char **))format_command);
+    register_command("batch", (int (*)(int, char **))batch_command);
+    register_command("append", (int (*)(int, char **))append_command);
+    register_command("defrag", (int (*)(int, char **))defrag_command);
+    register_command("alloc", (int (*)(int, char **))alloc_command);
+    register_command("mount", (int (*)(int, char **))mount_command);
 }
@@ -5,36 +5,138 @@
  *
  * START DATE :     16 Dec 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
  * DESCRIPTION :
  *  Structures and constants for the file system.
+ *
+ *  Layout of a formatted disk, in blocks of 512 bytes:
+ *  - block 0: the superblock
+ *  - the free space bitmap, one bit per block of the disk, set if it is used
+ *  - the directory, an array of MAX_FILE_COUNT file entries
+ *  - the data blocks of the files
+ *  The data of a file is stored in up to FILE_MAX_EXTENTS extents, which are
+ *  runs of consecutive blocks. Files of up to FILE_INLINE_DATA_SIZE bytes are
+ *  stored inside their directory entry instead.
  */
 
 #ifndef FILE_SYSTEM_C
 #define FILE_SYSTEM_C
 
-#include "floppy.h"
-
 #define MAX_FILENAME_LENGTH 60
 
+/** Size of a block of the file system in bytes */
+#define FS_BLOCK_SIZE 512
+/** Identifies a formatted disk, "RBFS" */
+#define FS_MAGIC 0x53464252
+/** Block of the superblock */
+#define FS_SUPERBLOCK 0
+/** Maximum amount of files */
+#define MAX_FILE_COUNT 128
+/** Maximum amount of extents of a file */
+#define FILE_MAX_EXTENTS 7
+/** Size of the data stored inside the directory entry of a tiny file */
+#define FILE_INLINE_DATA_SIZE 60
+/** Flag of a file entry: the data is stored inline instead of in extents */
+#define FILE_FLAG_INLINE 0x0001
+/**
+ * Flag of a file entry: the data is LZ compressed, see lz.h. The data length
+ * is the length of the compressed data.
+ */
+#define FILE_FLAG_COMPRESSED 0x0002
+/** Amount of bits of the free space bitmap stored in a block */
+#define FS_BITS_PER_BLOCK (FS_BLOCK_SIZE * 8)
+
+/**
+ * A run of consecutive blocks holding data of a file
+ */
+typedef struct extent
+{
+    // first block
+    unsigned int start;
+    // amount of blocks
+    unsigned int count;
+} __attribute__((packed)) extent;
+
 /**
- * A primitive file format.
+ * An entry of the directory, describing a file
  */
-typedef struct file
+typedef struct file_entry
 {
     // Filename. Zero-terminated string with maximum 59 chars.
     char name[MAX_FILENAME_LENGTH];
     // Length of the data in bytes
     unsigned int data_length;
-    // Data consisting of maximum 18367 bytes
-    unsigned char *data[FLOPPY_DMA_LENGTH - MAX_FILENAME_LENGTH - 33];
-    // a zero bit at the end to ensure that printing the file doesn't overflow
-    unsigned zero : 1;
-} __attribute__((packed)) file;
+    // amount of used extents, 0 for inline data
+    unsigned short extent_count;
+    // FILE_FLAG_ bits
+    unsigned short flags;
+    union
+    {
+        struct
+        {
+            // the blocks holding the data, in order
+            extent extents[FILE_MAX_EXTENTS];
+            // how often the file was executed, 'defrag' puts the programs
+            // executed most often closest to the directory
+            unsigned int execute_count;
+        } __attribute__((packed));
+        // the data itself if FILE_FLAG_INLINE is set
+        unsigned char inline_data[FILE_INLINE_DATA_SIZE];
+    } __attribute__((packed));
+} __attribute__((packed)) file_entry;
+
+/** Amount of file entries stored in a block */
+#define FS_ENTRIES_PER_BLOCK (FS_BLOCK_SIZE / sizeof(file_entry))
+/** Amount of blocks of the directory */
+#define FS_DIRECTORY_BLOCKS (MAX_FILE_COUNT / FS_ENTRIES_PER_BLOCK)
+
+/**
+ * The first block of a formatted disk, describing the layout
+ */
+typedef struct superblock
+{
+    // FS_MAGIC
+    unsigned int magic;
+    // size of the disk in blocks
+    unsigned int block_count;
+    // first block and amount of blocks of the free space bitmap
+    unsigned int bitmap_start;
+    unsigned int bitmap_blocks;
+    // first block and amount of blocks of the directory
+    unsigned int directory_start;
+    unsigned int directory_blocks;
+    // first block available for data
+    unsigned int data_start;
+    // amount of files, their entries are the first ones of the directory
+    unsigned short file_count;
+} __attribute__((packed)) superblock;
+
+/** Maximum amount of files open at the same time */
+#define FS_MAX_OPEN_FILES 8
+
+/** Flags for fs_open */
+#define FS_OPEN_READ 0x1
+#define FS_OPEN_WRITE 0x2
+#define FS_OPEN_CREATE 0x4
+
+/** Origins of fs_lseek */
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
 
+int fs_open(char *filename, int flags);
+int fs_read(int fd, void *buffer, unsigned int count);
+int fs_write(int fd, void *buffer, unsigned int count);
+int fs_lseek(int fd, int offset, int whence);
+int fs_close(int fd);
+int create_file(char *filename, char *data);
+int delete_file(char *filename);
+int fs_batch_begin();
+int fs_batch_commit();
+void fs_batch_abort();
 void install_filesystem();
 
-#endif
\ No newline at end of file
+#endif
@@ -5,7 +5,7 @@
  *
  * START DATE :     8 Mar 2007
  *
- * LAST UPDATE :    21 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -24,6 +24,9 @@
 #include "screen.h"
 #include "bool.h"
 #include "timer.h"
+#include "irq.h"
+#include "shell.h"
+#include "string.h"
 
 /*
     The MSR byte: [read-only]
@@ -81,22 +84,67 @@
 #define CMD_SENSE_INTERRUPT 8
 #define CMD_SEEK 15
 
+/** IRQ line of the floppy disk controller */
+#define FLOPPY_IRQ 6
+
+/**
+ * Maximum time to wait for the controller to signal completion, in timer ticks
+ * (3 seconds). Used while interrupts can be received.
+ */
+#define FLOPPY_IRQ_TIMEOUT 300
+/**
+ * Maximum amount of status register polls while waiting for the controller
+ * with interrupts disabled. One port read takes roughly a microsecond, so this
+ * equals a few seconds as well.
+ */
+#define FLOPPY_IRQ_TIMEOUT_POLLS 3000000
+
 /** Floppy motor states*/
 
 #define FLOPPY_MOTOR_OFF 0
 #define FLOPPY_MOTOR_ON 1
+// motor is still spinning, but will be turned off when floppy_motor_ticks
+// reaches 0
+#define FLOPPY_MOTOR_WAIT 2
+
+/** Time for the motor to get up to speed in timer ticks (500 ms) */
+#define FLOPPY_MOTOR_SPIN_UP 50
 
-/** Counter for floppy motor ticks */
+/** Counter for floppy motor ticks, until the idle motor is turned off */
 static volatile int floppy_motor_ticks = 0;
+/** Timer ticks an idle motor keeps spinning */
+static unsigned int floppy_motor_timeout = FLOPPY_MOTOR_TIMEOUT;
+/** Timer tick at which a starting motor is up to speed */
+static volatile unsigned int floppy_motor_ready_tick = 0;
 /** Flag for current motor state (off/on) */
 static volatile int floppy_motor_state = 0;
+/** Set by the IRQ6 handler, cleared before each command that interrupts */
+static volatile int floppy_irq_received = 0;
+/** Counter for received floppy controller interrupts */
+unsigned int floppy_controller_interrupts = 0;
+/**
+ * Cylinder the heads of drive 0 are currently positioned over. -1 if unknown,
+ * e.g. after a reset or a failed seek.
+ */
+static int floppy_current_cylinder = -1;
+
+/**
+ * Space reserved for each dma buffer. A power of two, so that a buffer aligned
+ * to it can not cross a 64kB boundary.
+ */
+#define FLOPPY_DMA_SLOT_SIZE 0x8000
+
+/** ISA DMA can only reach the first 16MB of memory */
+#define FLOPPY_DMA_LIMIT 0x1000000
 
 /**
- * Floppy Direct Memory Access Buffer.
- * Data can be read from the floppy to the buffer, or be written from the buffer
- * to the floppy
+ * Floppy Direct Memory Access Buffers.
+ * Data can be read from the floppy to a buffer, or be written from a buffer
+ * to the floppy. ISA DMA can not cross a 64kB boundary, which the alignment
+ * rules out.
  */
-char floppy_dmabuf[FLOPPY_DMA_LENGTH];
+static char floppy_dma_pool[FLOPPY_DMA_BUFFER_COUNT][FLOPPY_DMA_SLOT_SIZE]
+    __attribute__((aligned(FLOPPY_DMA_SLOT_SIZE)));
 
 /** Types of floppy disks */
 static char *drive_types[8] = {
@@ -109,10 +157,45 @@ static char *drive_types[8] = {
     "unknown type",
     "unknown type"};
 
+/**
+ * Geometry and data rate of a floppy disk
+ */
+typedef struct floppy_geometry
+{
+    // sectors per track
+    unsigned char sectors;
+    // heads per cylinder
+    unsigned char heads;
+    // cylinders on the disk
+    unsigned char cylinders;
+    // GAP3 length used by read and write commands
+    unsigned char gap3;
+    // value for the configuration control register, selects the data rate
+    unsigned char data_rate;
+} floppy_geometry;
+
+/**
+ * Geometries of the drive types above. Unknown types are treated as 1.44MB.
+ * Data rates: 0 = 500kb/s, 1 = 300kb/s, 2 = 250kb/s, 3 = 1Mb/s
+ */
+static floppy_geometry floppy_geometries[8] = {
+    {18, 2, 80, 0x1b, 0},
+    {9, 2, 40, 0x2a, 2},
+    {15, 2, 80, 0x1b, 0},
+    {9, 2, 80, 0x1b, 2},
+    {18, 2, 80, 0x1b, 0},
+    {36, 2, 80, 0x1b, 3},
+    {18, 2, 80, 0x1b, 0},
+    {18, 2, 80, 0x1b, 0}};
+
+/** Geometry of drive 0, set by floppy_detect_drives */
+static floppy_geometry *floppy_current_geometry = &floppy_geometries[4];
+
 // function declarations
 
-void wait_for_interrupt();
+int wait_for_interrupt();
 void floppy_motor(int onoff);
+static int floppy_command_done();
 
 /**
  * Detect drives and print type
@@ -127,6 +210,8 @@ void floppy_detect_drives()
     print(" - Floppy drive 0: ", FLOPPY_PRINT_ATTRIBUTE);
     print(drive_types[drives >> 4], FLOPPY_PRINT_ATTRIBUTE);
     print("\n", FLOPPY_PRINT_ATTRIBUTE);
+
+    floppy_current_geometry = &floppy_geometries[drives >> 4];
 }
 
 /**
@@ -188,19 +273,23 @@ int floppy_calibrate()
     for (i = 0; i < 10; i++)
     {
         // Attempt to positions head to cylinder 0
+        floppy_irq_received = 0;
         floppy_write_cmd(CMD_RECALIBRATE);
         // argument is drive, we only support drive 0
         floppy_write_cmd(0);
 
-        wait_for_interrupt();
+        if (wait_for_interrupt())
+            continue;
         floppy_check_interrupt(&st0, &cyl);
 
         if (!cyl)
         { // found cylinder 0 ?
+            floppy_current_cylinder = 0;
             floppy_motor(FLOPPY_MOTOR_OFF);
             return 0;
         }
     }
+    floppy_current_cylinder = -1;
     print("floppy_calibrate: 10 retries exhausted\n", FLOPPY_PRINT_ATTRIBUTE);
     floppy_motor(FLOPPY_MOTOR_OFF);
     return -1;
@@ -211,12 +300,17 @@ int floppy_calibrate()
  */
 int floppy_reset()
 {
+    floppy_irq_received = 0;
+    // resetting turns off the motor as well and loses the head position
+    floppy_motor_state = FLOPPY_MOTOR_OFF;
+    floppy_current_cylinder = -1;
     // disable controller
     port_byte_out(FLOPPY_BASE + FLOPPY_DOR, 0x00);
     // enable controller
     port_byte_out(FLOPPY_BASE + FLOPPY_DOR, 0x0C);
 
-    wait_for_interrupt();
+    if (wait_for_interrupt())
+        return -1;
     // read clear interrupt data
     {
         // ignore these here..
@@ -224,8 +318,9 @@ int floppy_reset()
         floppy_check_interrupt(&st0, &cyl);
     }
 
-    // set transfer speed 500kb/s
-    port_byte_out(FLOPPY_BASE + FLOPPY_CCR, 0x00);
+    // set transfer speed according to the drive type, 500kb/s for 1.44MB
+    port_byte_out(FLOPPY_BASE + FLOPPY_CCR,
+                  floppy_current_geometry->data_rate);
 
     //  - 1st byte is: bits[7:4] = steprate, bits[3:0] = head unload time
     //  - 2nd byte is: bits[7:1] = head load time, bit[0] = no-DMA
@@ -245,7 +340,37 @@ int floppy_reset()
 }
 
 /**
- * Turn the floppy motor on or off.
+ * Turns the motor on without waiting for it to get up to speed
+ */
+static void floppy_motor_start()
+{
+    // the timer interrupt may turn the motor off in between
+    unsigned int eflags = interrupts_disable();
+    int previous_state = floppy_motor_state;
+    floppy_motor_state = FLOPPY_MOTOR_ON;
+    if (previous_state == FLOPPY_MOTOR_OFF)
+    {
+        // need to turn on
+        port_byte_out(FLOPPY_BASE + FLOPPY_DOR, 0x1c);
+        floppy_motor_ready_tick = timer_get_ticks() + FLOPPY_MOTOR_SPIN_UP;
+    }
+    interrupts_restore(eflags);
+}
+
+/**
+ * Checks whether the motor had enough time to get up to speed
+ *
+ * @return int 1 if the motor is ready, 0 otherwise
+ */
+static int floppy_motor_ready()
+{
+    return (int)(timer_get_ticks() - floppy_motor_ready_tick) >= 0;
+}
+
+/**
+ * Turn the floppy motor on or off. Turning it off only starts the idle
+ * countdown, the motor keeps spinning for floppy_motor_timeout ticks so
+ * consecutive operations don't have to wait for it to spin up again.
  *
  * @param onoff on or off
  */
@@ -253,58 +378,83 @@ void floppy_motor(int onoff)
 {
     if (onoff)
     {
-        if (!floppy_motor_state)
+        floppy_motor_start();
+        if (!floppy_motor_ready())
         {
-            // need to turn on
-            port_byte_out(FLOPPY_BASE + FLOPPY_DOR, 0x1c);
-            timer_sleep(50); // wait 500 ms = hopefully enough for modern drives
+            // wait 500 ms = hopefully enough for modern drives
+            timer_sleep(FLOPPY_MOTOR_SPIN_UP);
+            floppy_motor_ready_tick = timer_get_ticks();
         }
-        floppy_motor_state = FLOPPY_MOTOR_ON;
+        return;
     }
-    else
+    unsigned int eflags = interrupts_disable();
+    if (floppy_motor_state == FLOPPY_MOTOR_ON)
     {
-        floppy_motor_state = FLOPPY_MOTOR_OFF;
+        floppy_motor_ticks = floppy_motor_timeout;
+        floppy_motor_state = FLOPPY_MOTOR_WAIT;
     }
+    interrupts_restore(eflags);
 }
 
 /**
- * Seek for a given cylinder, with a given head
+ * Counts down the idle time of the motor and turns it off once the time is
+ * up. Called by the timer interrupt on every tick.
  *
- * @param cyli cylinder number
- * @param head head number
+ * @param ticks current tick count
  */
-int floppy_seek(unsigned cyli, int head)
+static void floppy_timer_callback(unsigned int ticks)
 {
-    unsigned i, st0, cyl = -1; // set to bogus cylinder
-
-    floppy_motor(FLOPPY_MOTOR_ON);
-    // try cylinders until the specified one is found
-    for (i = 0; i < 10; i++)
+    // avoid unused parameter warning
+    (void)(ticks);
+    if (floppy_motor_state != FLOPPY_MOTOR_WAIT)
+    {
+        return;
+    }
+    if (--floppy_motor_ticks <= 0)
     {
-        // Attempt to position to given cylinder
-        // 1st byte bit[1:0] = drive, bit[2] = head
-        // 2nd byte is cylinder number
-        floppy_write_cmd(CMD_SEEK);
-        floppy_write_cmd(head << 2);
-        floppy_write_cmd(cyli);
+        // keep controller enabled with DMA and interrupts, but motor off
+        port_byte_out(FLOPPY_BASE + FLOPPY_DOR, 0x0c);
+        floppy_motor_state = FLOPPY_MOTOR_OFF;
+    }
+}
 
-        wait_for_interrupt();
-        floppy_check_interrupt((int *)&st0, (int *)&cyl);
+/**
+ * Sets the time the motor keeps spinning after the last operation
+ *
+ * @param ticks idle time in timer ticks (1/100 seconds)
+ */
+void floppy_set_motor_timeout(unsigned int ticks)
+{
+    floppy_motor_timeout = ticks;
+}
 
-        if (cyl == cyli)
+/**
+ * Shell command showing or setting the time an idle motor keeps spinning
+ *
+ * @param argc amount of arguments
+ * @param argv the arguments, optionally the time in timer ticks
+ * @return int 0 on success, 1 on wrong usage
+ */
+static int motor_command(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        unsigned int ticks;
+        if (string_to_unsigned_int(argv[1], &ticks))
         {
-            floppy_motor(FLOPPY_MOTOR_OFF);
-            return 0;
+            print("Usage: motor [ticks]\n", DEFAULT_COLOR_SCHEME);
+            return 1;
         }
+        floppy_set_motor_timeout(ticks);
     }
-
-    print("floppy_seek: 10 retries exhausted\n", FLOPPY_PRINT_ATTRIBUTE);
-    floppy_motor(FLOPPY_MOTOR_OFF);
-    return -1;
+    print("Motor idle timeout: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(floppy_motor_timeout, DEFAULT_COLOR_SCHEME);
+    print(" ticks\n", DEFAULT_COLOR_SCHEME);
+    return 0;
 }
 
 /**
- * Used by floppy_dma_init and floppy_do_track to specify direction
+ * Used by floppy_dma_init and floppy_dma_start to specify direction
  */
 typedef enum
 {
@@ -316,8 +466,10 @@ typedef enum
  * Initialize floppy for Direct Memory Access
  *
  * @dir set to read or write mode
+ * @param length amount of bytes to transfer, at most FLOPPY_DMA_LENGTH
+ * @param buffer index of the dma buffer
  */
-static void floppy_dma_init(floppy_dir dir)
+static void floppy_dma_init(floppy_dir dir, unsigned int length, int buffer)
 {
     union
     {
@@ -325,8 +477,8 @@ static void floppy_dma_init(floppy_dir dir)
         unsigned long l;    // 1 long = 32-bit
     } a, c;                 // address and count
 
-    a.l = (unsigned)&floppy_dmabuf;
-    c.l = (unsigned)FLOPPY_DMA_LENGTH - 1; // -1 because of DMA counting
+    a.l = (unsigned long)floppy_dma_pool[buffer];
+    c.l = (unsigned)length - 1; // -1 because of DMA counting
 
     unsigned char mode;
     switch (dir)
@@ -362,162 +514,718 @@ static void floppy_dma_init(floppy_dir dir)
 }
 
 /**
- * This monster does full cylinder (both tracks) transfer to
- * the specified direction (since the difference is small).
+ * Steps of an asynchronous transfer
+ */
+#define FLOPPY_STATE_IDLE 0
+// waiting for the motor to get up to speed
+#define FLOPPY_STATE_SPIN_UP 1
+// waiting for the interrupt of the seek command
+#define FLOPPY_STATE_SEEK 2
+// waiting for the interrupt of the read or write command
+#define FLOPPY_STATE_TRANSFER 3
+
+/**
+ * A transfer of consecutive sectors of one cylinder between the floppy and the
+ * dma buffer, which is executed step by step by floppy_dma_poll
+ */
+typedef struct floppy_operation
+{
+    unsigned int cyl;
+    // head and sector (counting from 1) of the first sector
+    unsigned int head;
+    unsigned int sector;
+    // amount of sectors
+    unsigned int count;
+    floppy_dir dir;
+    // index of the dma buffer
+    int buffer;
+    // one of the FLOPPY_STATE_ values
+    int state;
+    // remaining attempts
+    int seek_retries;
+    int transfer_retries;
+    // tick at which the current step times out
+    unsigned int deadline;
+    // status register polls during the current step, while interrupts are off
+    unsigned int polls;
+} floppy_operation;
+
+/** The transfer in progress. There is only one dma buffer, so only one. */
+static floppy_operation floppy_current_operation;
+
+/**
+ * Checks whether the controller finished the last command without blocking.
+ * Falls back to polling the status register while interrupts are disabled.
+ *
+ * @return int 1 if the command finished, 0 otherwise
+ */
+static int floppy_step_finished()
+{
+    if (floppy_irq_received ||
+        (!interrupts_enabled() && floppy_command_done()))
+    {
+        floppy_irq_received = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Checks whether the current step of an operation takes too long
+ *
+ * @param operation the operation
+ * @return int 1 if the step timed out, 0 otherwise
+ */
+static int floppy_step_timed_out(floppy_operation *operation)
+{
+    if (interrupts_enabled())
+    {
+        return (int)(timer_get_ticks() - operation->deadline) > 0;
+    }
+    return ++operation->polls > FLOPPY_IRQ_TIMEOUT_POLLS;
+}
+
+/**
+ * Begins a new step of an operation, which completes with an interrupt
  *
- * @param cyl cylinder number
- * @dir read or write mode
+ * @param operation the operation
+ * @param state the step
  */
-int floppy_do_track(unsigned cyl, floppy_dir dir)
+static void floppy_begin_step(floppy_operation *operation, int state)
 {
-    // transfer command, set below
-    unsigned char cmd;
+    operation->state = state;
+    operation->deadline = timer_get_ticks() + FLOPPY_IRQ_TIMEOUT;
+    operation->polls = 0;
+}
 
+/**
+ * Ends an operation
+ *
+ * @param operation the operation
+ * @param result 0 on success, -1 on failure
+ * @return int the result
+ */
+static int floppy_finish(floppy_operation *operation, int result)
+{
+    operation->state = FLOPPY_STATE_IDLE;
+    floppy_motor(FLOPPY_MOTOR_OFF);
+    return result;
+}
+
+/**
+ * Sends the read or write command of an operation. The heads have to be over
+ * the right cylinder already. With the multitrack bit set, a transfer starting
+ * on head 0 goes on with head 1 after the last sector of the track.
+ *
+ * @param operation the operation
+ */
+static void floppy_begin_transfer(floppy_operation *operation)
+{
     // Read is MT:MF:SK:0:0:1:1:0, write MT:MF:0:0:1:0:1
     // where MT = multitrack, MF = MFM mode, SK = skip deleted
     //
     // Specify multitrack and MFM mode
     static const int flags = 0xC0;
-    switch (dir)
+    unsigned char cmd = operation->dir == floppy_dir_write
+                            ? CMD_WRITE_DATA | flags
+                            : CMD_READ_DATA | flags;
+
+    // init dma, the transfer ends when the dma count runs out
+    floppy_dma_init(operation->dir, operation->count * FLOPPY_SECTOR_SIZE,
+                    operation->buffer);
+
+    // no extra settle time needed, the head load time programmed with
+    // CMD_SPECIFY is applied by the controller itself
+    floppy_irq_received = 0;
+    floppy_write_cmd(cmd);                   // set above for current direction
+    floppy_write_cmd(operation->head << 2);  // 0:0:0:0:0:HD:US1:US0 = head and drive
+    floppy_write_cmd(operation->cyl);        // cylinder
+    floppy_write_cmd(operation->head);       // first head (should match with above)
+    floppy_write_cmd(operation->sector);     // first sector, strangely counts from 1
+    floppy_write_cmd(2);                     // bytes/sector, 128*2^x (x=2 -> 512)
+    floppy_write_cmd(floppy_current_geometry->sectors); // last sector of a track
+    floppy_write_cmd(floppy_current_geometry->gap3);    // GAP3 length
+    floppy_write_cmd(0xff);                  // data length (0xff if B/S != 0)
+    floppy_begin_step(operation, FLOPPY_STATE_TRANSFER);
+}
+
+/**
+ * Positions the heads for an operation. One seek positions both heads, and
+ * it is skipped if they are already there.
+ *
+ * @param operation the operation
+ */
+static void floppy_begin_seek(floppy_operation *operation)
+{
+    if (floppy_current_cylinder == (int)operation->cyl)
     {
-    case floppy_dir_read:
-        cmd = CMD_READ_DATA | flags;
-        break;
-    case floppy_dir_write:
-        cmd = CMD_WRITE_DATA | flags;
-        break;
-    default:
-        print("floppy_do_track: invalid direction", FLOPPY_PRINT_ATTRIBUTE);
-        return 0; // not reached, but pleases "cmd used uninitialized"
+        floppy_begin_transfer(operation);
+        return;
     }
+    // 1st byte bit[1:0] = drive, bit[2] = head
+    // 2nd byte is cylinder number
+    floppy_irq_received = 0;
+    floppy_write_cmd(CMD_SEEK);
+    floppy_write_cmd(operation->head << 2);
+    floppy_write_cmd(operation->cyl);
+    floppy_begin_step(operation, FLOPPY_STATE_SEEK);
+}
+
+/**
+ * Starts an asynchronous transfer of consecutive sectors of one cylinder
+ * between the floppy and a dma buffer. The transfer is carried out by
+ * calling floppy_dma_poll until it does not return FLOPPY_BUSY anymore.
+ *
+ * @param lba first sector
+ * @param count amount of sectors, all within the cylinder of the first one
+ * @param write true to write the dma buffer to the floppy, false to read
+ * @param buffer index of the dma buffer
+ * @return int 0 if the transfer was started, -1 on failure
+ */
+int floppy_dma_start(unsigned int lba, unsigned int count, bool write,
+                     int buffer)
+{
+    floppy_geometry *geometry = floppy_current_geometry;
+    unsigned int per_cylinder = floppy_sectors_per_cylinder();
+    floppy_operation *operation = &floppy_current_operation;
 
-    // seek both heads
-    if (floppy_seek(cyl, 0))
+    if (operation->state != FLOPPY_STATE_IDLE)
+    {
+        print("floppy_dma_start: transfer in progress\n",
+              FLOPPY_PRINT_ATTRIBUTE);
         return -1;
-    if (floppy_seek(cyl, 1))
+    }
+    if (count == 0 || lba + count > floppy_sector_count() ||
+        lba / per_cylinder != (lba + count - 1) / per_cylinder ||
+        count > FLOPPY_DMA_LENGTH / FLOPPY_SECTOR_SIZE || buffer < 0 ||
+        buffer >= FLOPPY_DMA_BUFFER_COUNT)
+    {
+        print("floppy_dma_start: invalid sector range\n",
+              FLOPPY_PRINT_ATTRIBUTE);
         return -1;
+    }
+    operation->cyl = lba / per_cylinder;
+    operation->head = (lba / geometry->sectors) % geometry->heads;
+    operation->sector = lba % geometry->sectors + 1;
+    operation->count = count;
+    operation->dir = write ? floppy_dir_write : floppy_dir_read;
+    operation->buffer = buffer;
+    operation->seek_retries = 10;
+    operation->transfer_retries = 20;
+    operation->state = FLOPPY_STATE_SPIN_UP;
+    floppy_motor_start();
+    floppy_dma_poll();
+    return 0;
+}
 
-    int i;
-    for (i = 0; i < 20; i++)
+/**
+ * Carries out the transfer started by floppy_dma_start as far as possible
+ * without waiting. Never blocks, except for resetting the controller after a
+ * timeout.
+ *
+ * @return int FLOPPY_BUSY while the transfer is in progress, 0 once it
+ * succeeded, -1 once it failed
+ */
+int floppy_dma_poll()
+{
+    floppy_operation *operation = &floppy_current_operation;
+    switch (operation->state)
     {
-        floppy_motor(FLOPPY_MOTOR_ON);
-
-        // init dma..
-        floppy_dma_init(dir);
-
-        timer_sleep(10); // give some time (100ms) to settle after the seeks
-
-        floppy_write_cmd(cmd);  // set above for current direction
-        floppy_write_cmd(0);    // 0:0:0:0:0:HD:US1:US0 = head and drive
-        floppy_write_cmd(cyl);  // cylinder
-        floppy_write_cmd(0);    // first head (should match with above)
-        floppy_write_cmd(1);    // first sector, strangely counts from 1
-        floppy_write_cmd(2);    // bytes/sector, 128*2^x (x=2 -> 512)
-        floppy_write_cmd(18);   // number of tracks to operate on
-        floppy_write_cmd(0x1b); // GAP3 length, 27 is default for 3.5"
-        floppy_write_cmd(0xff); // data length (0xff if B/S != 0)
-
-        wait_for_interrupt(); // don't SENSE_INTERRUPT here!
-
-        // first read status information
-        unsigned char st0, st1, st2, rcy, rhe, rse, bps;
-        st0 = floppy_read_data();
-        st1 = floppy_read_data();
-        st2 = floppy_read_data();
-        /*
-         * These are cylinder/head/sector values, updated with some
-         * rather bizarre logic, that I would like to understand.
-         *
-         */
-        rcy = floppy_read_data();
-        rhe = floppy_read_data();
-        rse = floppy_read_data();
-        // surpress unused parameter warnings
-        (void)(rcy);
-        (void)(rhe);
-        (void)(rse);
-        // bytes per sector, should be what we programmed in
-        bps = floppy_read_data();
-
-        floppy_motor(FLOPPY_MOTOR_OFF);
+    case FLOPPY_STATE_SPIN_UP:
+        if (!floppy_motor_ready())
+        {
+            if (interrupts_enabled())
+            {
+                return FLOPPY_BUSY;
+            }
+            // the timer doesn't count without interrupts
+            timer_sleep(FLOPPY_MOTOR_SPIN_UP);
+        }
+        floppy_begin_seek(operation);
+        return FLOPPY_BUSY;
+
+    case FLOPPY_STATE_SEEK:
+        if (!floppy_step_finished())
+        {
+            if (!floppy_step_timed_out(operation))
+            {
+                return FLOPPY_BUSY;
+            }
+        }
+        else
+        {
+            int st0, cyl;
+            floppy_check_interrupt(&st0, &cyl);
+            if (cyl == (int)operation->cyl)
+            {
+                floppy_current_cylinder = cyl;
+                floppy_begin_transfer(operation);
+                return FLOPPY_BUSY;
+            }
+        }
+        floppy_current_cylinder = -1;
+        if (--operation->seek_retries <= 0)
+        {
+            print("floppy_seek: 10 retries exhausted\n", FLOPPY_PRINT_ATTRIBUTE);
+            return floppy_finish(operation, -1);
+        }
+        floppy_begin_seek(operation);
+        return FLOPPY_BUSY;
+
+    case FLOPPY_STATE_TRANSFER:
+        if (!floppy_step_finished())
+        {
+            if (!floppy_step_timed_out(operation))
+            {
+                return FLOPPY_BUSY;
+            }
+            // the controller never finished, start over with a clean state
+            floppy_reset();
+        }
+        else
+        {
+            // first read status information. Don't SENSE_INTERRUPT here!
+            unsigned char st0, st1, st2, rcy, rhe, rse, bps;
+            st0 = floppy_read_data();
+            st1 = floppy_read_data();
+            st2 = floppy_read_data();
+            /*
+             * These are cylinder/head/sector values, updated with some
+             * rather bizarre logic, that I would like to understand.
+             *
+             */
+            rcy = floppy_read_data();
+            rhe = floppy_read_data();
+            rse = floppy_read_data();
+            // surpress unused parameter warnings
+            (void)(rcy);
+            (void)(rhe);
+            (void)(rse);
+            // bytes per sector, should be what we programmed in
+            bps = floppy_read_data();
+
+            if (st1 & 0x02)
+            {
+                print("floppy_dma_poll: disk is write protected\n",
+                      FLOPPY_PRINT_ATTRIBUTE);
+                return floppy_finish(operation, -1);
+            }
+            // abnormal termination, unless the transfer just ended on the last
+            // sector of the cylinder (end of cylinder is the only error bit)
+            if (!((st0 & 0xC0) && !(st1 == 0x80 && st2 == 0)) && bps == 2)
+            {
+                return floppy_finish(operation, 0);
+            }
+        }
+        // the head might be over the wrong cylinder, seek again
+        floppy_current_cylinder = -1;
+        if (--operation->transfer_retries <= 0)
+        {
+            print("floppy_dma_poll: 20 retries exhausted\n",
+                  FLOPPY_PRINT_ATTRIBUTE);
+            return floppy_finish(operation, -1);
+        }
+        if (floppy_motor_state == FLOPPY_MOTOR_OFF)
+        {
+            // the reset turned the motor off
+            operation->state = FLOPPY_STATE_SPIN_UP;
+            floppy_motor_start();
+            return FLOPPY_BUSY;
+        }
+        floppy_begin_seek(operation);
+        return FLOPPY_BUSY;
+
+    default:
         return 0;
     }
+}
 
-    print("floppy_do_sector: 20 retries exhausted\n", FLOPPY_PRINT_ATTRIBUTE);
-    floppy_motor(FLOPPY_MOTOR_OFF);
-    return -1;
+/**
+ * Halts the processor until the next interrupt, unless the controller already
+ * signalled one. Used while waiting for asynchronous transfers. Returns right
+ * away if interrupts are disabled, as nothing would wake the processor up.
+ */
+void floppy_sleep()
+{
+    if (!interrupts_enabled())
+    {
+        return;
+    }
+    // no interrupt may slip in between the check and halting
+    unsigned int eflags = interrupts_disable();
+    if (floppy_irq_received)
+    {
+        interrupts_restore(eflags);
+    }
+    else
+    {
+        cpu_enable_interrupts_and_halt();
+    }
 }
 
 /**
- * Read a floppy track to the dma buffer
+ * Waits for the transfer in progress to finish
  *
- * @param base base address of the floppy controller (primary/secondary)
- * @param cyl cylinder number
+ * @return int 0 on success, -1 on failure
  */
-int floppy_read_track(unsigned cyl)
+static int floppy_dma_wait()
 {
-    return floppy_do_track(cyl, floppy_dir_read);
+    int status;
+    while ((status = floppy_dma_poll()) == FLOPPY_BUSY)
+    {
+        floppy_sleep();
+    }
+    return status;
 }
 
 /**
- * Write a floppy track from the dma buffer
+ * Transfers consecutive sectors of one cylinder between the floppy and the
+ * first dma buffer and waits for the transfer to finish
  *
- * @param base base address of the floppy controller (primary/secondary)
- * @param cyl cylinder number
+ * @param lba first sector
+ * @param count amount of sectors, all within the cylinder of the first one
+ * @param dir read or write mode
+ * @return int 0 on success, -1 on failure
  */
-int floppy_write_track(unsigned cyl)
+static int floppy_dma_transfer(unsigned int lba, unsigned int count,
+                               floppy_dir dir)
 {
-    return floppy_do_track(cyl, floppy_dir_write);
+    if (floppy_dma_start(lba, count, dir == floppy_dir_write, 0))
+    {
+        return -1;
+    }
+    return floppy_dma_wait();
 }
 
-unsigned int floppy_controller_interrupts = 0;
+/**
+ * Returns one of the dma buffers. Each of them holds FLOPPY_DMA_LENGTH bytes.
+ *
+ * @param index index of the buffer, below FLOPPY_DMA_BUFFER_COUNT
+ * @return char* the buffer
+ */
+char *floppy_dma_buffer(int index)
+{
+    return floppy_dma_pool[index];
+}
+
+/**
+ * Read sectors of one cylinder to the beginning of the first dma buffer
+ *
+ * @param lba first sector
+ * @param count amount of sectors, all within the cylinder of the first one
+ * @return int 0 on success, -1 on failure
+ */
+int floppy_dma_read(unsigned int lba, unsigned int count)
+{
+    return floppy_dma_transfer(lba, count, floppy_dir_read);
+}
 
 /**
- * This function should be waiting for an interrupt to occurr, but since that
- * is weirdly broken, it instead waits for 500ms
+ * Write sectors of one cylinder from the beginning of the first dma buffer
+ *
+ * @param lba first sector
+ * @param count amount of sectors, all within the cylinder of the first one
+ * @return int 0 on success, -1 on failure
  */
-void wait_for_interrupt()
+int floppy_dma_write(unsigned int lba, unsigned int count)
 {
-    timer_sleep(50);
+    return floppy_dma_transfer(lba, count, floppy_dir_write);
 }
 
 /**
- * Write the buffer to the specified track
+ * Amount of sectors which can be transferred at once, starting at a sector
  *
- * @param index track index
+ * @param lba first sector
+ * @param count amount of sectors left
+ * @return unsigned int sectors up to the end of the cylinder or dma buffer
  */
-void floppy_write_buffer(unsigned int index)
+static unsigned int floppy_chunk(unsigned int lba, unsigned int count)
 {
-    floppy_write_track(index);
+    unsigned int per_cylinder = floppy_sectors_per_cylinder();
+    // stay within the cylinder and the dma buffer
+    unsigned int chunk = per_cylinder - lba % per_cylinder;
+    if (chunk > count)
+        chunk = count;
+    if (chunk > FLOPPY_DMA_LENGTH / FLOPPY_SECTOR_SIZE)
+        chunk = FLOPPY_DMA_LENGTH / FLOPPY_SECTOR_SIZE;
+    return chunk;
+}
+
+/**
+ * Transfers consecutive sectors between the floppy and a buffer. Every
+ * cylinder touched costs one controller command.
+ *
+ * @param lba first sector
+ * @param count amount of sectors
+ * @param buffer source or destination of count * FLOPPY_SECTOR_SIZE bytes
+ * @param dir read or write mode
+ * @return int 0 on success, -1 on failure
+ */
+static int floppy_transfer(unsigned int lba, unsigned int count,
+                           unsigned char *buffer, floppy_dir dir)
+{
+    if (lba + count > floppy_sector_count())
+    {
+        print("floppy_transfer: sector out of range\n", FLOPPY_PRINT_ATTRIBUTE);
+        return -1;
+    }
+    while (count > 0)
+    {
+        unsigned int chunk = floppy_chunk(lba, count);
+
+        if (dir == floppy_dir_write)
+            memcpy((unsigned char *)floppy_dma_pool[0], buffer,
+                   chunk * FLOPPY_SECTOR_SIZE);
+        if (floppy_dma_transfer(lba, chunk, dir))
+            return -1;
+        if (dir == floppy_dir_read)
+            memcpy(buffer, (unsigned char *)floppy_dma_pool[0],
+                   chunk * FLOPPY_SECTOR_SIZE);
+
+        lba += chunk;
+        count -= chunk;
+        buffer += chunk * FLOPPY_SECTOR_SIZE;
+    }
+    return 0;
 }
 
 /**
- * Read the specified track to the buffer
+ * Read sectors from the floppy
  *
- * @param index track index
+ * @param lba first sector
+ * @param count amount of sectors
+ * @param buffer destination of count * FLOPPY_SECTOR_SIZE bytes
+ * @return int 0 on success, -1 on failure
  */
-void floppy_read_buffer(unsigned int index)
+int floppy_read_sectors(unsigned int lba, unsigned int count, void *buffer)
 {
-    floppy_read_track(index);
+    return floppy_transfer(lba, count, buffer, floppy_dir_read);
 }
 
 /**
- * Clear the dma buffer
+ * Write sectors to the floppy
+ *
+ * @param lba first sector
+ * @param count amount of sectors
+ * @param buffer source of count * FLOPPY_SECTOR_SIZE bytes
+ * @return int 0 on success, -1 on failure
+ */
+int floppy_write_sectors(unsigned int lba, unsigned int count, void *buffer)
+{
+    return floppy_transfer(lba, count, buffer, floppy_dir_write);
+}
+
+/**
+ * Reads consecutive sectors and hands them to a consumer piece by piece.
+ * The dma buffers are used in turns: the transfer of the next piece is
+ * started before the consumer gets the previous one, so the controller keeps
+ * reading while the data is processed. The floppy must not be used otherwise
+ * until the read is finished, e.g. the elevator has to be idle.
+ *
+ * @param lba first sector
+ * @param count amount of sectors
+ * @param consume function called with each piece in order
+ * @param context handed to the consumer
+ * @return int 0 on success, -1 if a transfer failed or the consumer aborted
+ */
+int floppy_stream_read(unsigned int lba, unsigned int count,
+                       floppy_stream_consumer consume, void *context)
+{
+    if (lba + count > floppy_sector_count())
+    {
+        print("floppy_stream_read: sector out of range\n",
+              FLOPPY_PRINT_ATTRIBUTE);
+        return -1;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    int buffer = 0;
+    unsigned int chunk = floppy_chunk(lba, count);
+    if (floppy_dma_start(lba, chunk, false, buffer))
+    {
+        return -1;
+    }
+    while (true)
+    {
+        if (floppy_dma_wait())
+        {
+            return -1;
+        }
+        unsigned int done_lba = lba;
+        unsigned int done_count = chunk;
+        int done_buffer = buffer;
+        lba += chunk;
+        count -= chunk;
+        if (count > 0)
+        {
+            // keep the controller busy while the consumer is working
+            buffer = (buffer + 1) % FLOPPY_DMA_BUFFER_COUNT;
+            chunk = floppy_chunk(lba, count);
+            if (floppy_dma_start(lba, chunk, false, buffer))
+            {
+                return -1;
+            }
+        }
+        if (consume(done_lba, done_count, floppy_dma_pool[done_buffer],
+                    context))
+        {
+            if (count > 0)
+            {
+                floppy_dma_wait();
+            }
+            return -1;
+        }
+        if (count == 0)
+        {
+            return 0;
+        }
+    }
+}
+
+/**
+ * Amount of sectors in one cylinder of the disk in drive 0, which can be
+ * reached without seeking
+ *
+ * @return unsigned int sectors per cylinder
+ */
+unsigned int floppy_sectors_per_cylinder()
+{
+    return floppy_current_geometry->sectors * floppy_current_geometry->heads;
+}
+
+/**
+ * Total amount of sectors on the disk in drive 0
+ *
+ * @return unsigned int sector count
+ */
+unsigned int floppy_sector_count()
+{
+    return floppy_current_geometry->sectors * floppy_current_geometry->heads *
+           floppy_current_geometry->cylinders;
+}
+
+/**
+ * Interrupt handler for IRQ6, which the controller raises whenever it finished
+ * a command
+ *
+ * @param regs registers as pushed by the assembly code in interrupt.asm
+ */
+static void floppy_irq_callback(struct regs *regs)
+{
+    // avoid unused parameter warning
+    (void)(regs);
+    floppy_controller_interrupts++;
+    floppy_irq_received = 1;
+}
+
+/**
+ * Checks the main status register for a finished command. Either the result
+ * bytes of a transfer are ready to be read (MRQ and DIO), or the controller
+ * is idle and no drive is seeking anymore.
+ *
+ * @return int 1 if the last command is finished, 0 otherwise
+ */
+static int floppy_command_done()
+{
+    unsigned char msr = port_byte_in(FLOPPY_BASE + FLOPPY_MSR);
+    if (!(msr & 0x80))
+        return 0;
+    return (msr & 0x40) || !(msr & 0x1F);
+}
+
+/**
+ * Waits until the controller raised IRQ6 for the last command, or gives up
+ * after FLOPPY_IRQ_TIMEOUT.
+ *
+ * Inside interrupt handlers the interrupt flag is cleared and IRQ6 is never
+ * delivered. In that case the main status register is polled for the end of
+ * the command instead.
+ *
+ * @return int 0 on completion, -1 on timeout
+ */
+int wait_for_interrupt()
+{
+    if (interrupts_enabled())
+    {
+        unsigned int start = timer_get_ticks();
+        while (!floppy_irq_received)
+        {
+            if (timer_get_ticks() - start > FLOPPY_IRQ_TIMEOUT)
+            {
+                print("wait_for_interrupt: timeout\n", FLOPPY_PRINT_ATTRIBUTE);
+                return -1;
+            }
+            cpu_halt();
+        }
+    }
+    else
+    {
+        unsigned int polls = 0;
+        while (!floppy_irq_received && !floppy_command_done())
+        {
+            if (++polls > FLOPPY_IRQ_TIMEOUT_POLLS)
+            {
+                print("wait_for_interrupt: timeout\n", FLOPPY_PRINT_ATTRIBUTE);
+                return -1;
+            }
+        }
+    }
+    floppy_irq_received = 0;
+    return 0;
+}
+
+/**
+ * Clear the dma buffers
  */
 void floppy_clear_buffer()
 {
-    memset((unsigned char *)floppy_dmabuf, 0, FLOPPY_DMA_LENGTH);
+    memset((unsigned char *)floppy_dma_pool, 0, sizeof(floppy_dma_pool));
 }
 
 /**
- * Installs the floppy driver
+ * Checks that the dma buffers can be reached by ISA DMA: they must lie below
+ * 16MB and must not cross a 64kB boundary.
+ *
+ * @return int 0 if all buffers are usable, -1 otherwise
  */
-void floppy_install()
+static int floppy_check_dma_pool()
 {
-    memset((unsigned char *)floppy_dmabuf, 0, FLOPPY_DMA_LENGTH);
+    for (int i = 0; i < FLOPPY_DMA_BUFFER_COUNT; i++)
+    {
+        unsigned int first = (unsigned long)floppy_dma_pool[i];
+        unsigned int last = first + FLOPPY_DMA_LENGTH - 1;
+        if (last >= FLOPPY_DMA_LIMIT || (first >> 16) != (last >> 16))
+        {
+            print("floppy: dma buffer not usable for ISA DMA\n",
+                  FLOPPY_PRINT_ATTRIBUTE);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Installs the floppy driver. Nothing is installed if the dma buffers can't
+ * be used, transfers would write to the wrong memory.
+ *
+ * @return int 0 on success, -1 if the floppy can't be used
+ */
+int floppy_install()
+{
+    floppy_clear_buffer();
+    if (floppy_check_dma_pool())
+    {
+        return -1;
+    }
+    irq_install_handler(FLOPPY_IRQ, &floppy_irq_callback);
+    timer_install_handler(&floppy_timer_callback);
+    register_command("motor", motor_command);
     floppy_detect_drives();
     floppy_reset(FLOPPY_BASE);
     print("Floppy reset\n", FLOPPY_PRINT_ATTRIBUTE);
     floppy_calibrate(FLOPPY_BASE);
     print("Floppy calibrated\n", FLOPPY_PRINT_ATTRIBUTE);
+    return 0;
 }
\ No newline at end of file
@@ -5,7 +5,7 @@
  *
  * START DATE :     8 Mar 2007
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -16,15 +16,59 @@
 #ifndef FLOPPY_C
 #define FLOPPY_C
 
+#include "bool.h"
+
 /**
- * statically reserve memory for DMA transfer
+ * Time in timer ticks (1/100 seconds) the motor keeps spinning after the last
+ * operation, before it is turned off. Can be changed with 'motor'.
  */
-#define FLOPPY_DMA_LENGTH 0x4000
-extern char floppy_dmabuf[FLOPPY_DMA_LENGTH];
+#define FLOPPY_MOTOR_TIMEOUT 300
+
+/** Size of a sector in bytes */
+#define FLOPPY_SECTOR_SIZE 512
+
+/**
+ * statically reserve memory for DMA transfer. Large enough for a whole
+ * cylinder (2 heads * 18 sectors) of a 1.44MB floppy.
+ */
+#define FLOPPY_DMA_LENGTH 0x4800
+
+/**
+ * Amount of dma buffers. While the controller fills one of them, the data of
+ * the previous transfer can be taken from another one.
+ */
+#define FLOPPY_DMA_BUFFER_COUNT 2
+
+/**
+ * Function consuming the data of a streaming read
+ *
+ * @param lba first sector of the data
+ * @param count amount of sectors
+ * @param data count * FLOPPY_SECTOR_SIZE bytes, only valid during the call
+ * @param context context handed to floppy_stream_read
+ * @return int 0 to continue, -1 to abort the read
+ */
+typedef int (*floppy_stream_consumer)(unsigned int lba, unsigned int count,
+                                      char *data, void *context);
+
+/** Returned by floppy_dma_poll while a transfer is in progress */
+#define FLOPPY_BUSY 1
 
-void floppy_install();
-void floppy_write_buffer(unsigned int index);
-void floppy_read_buffer(unsigned int index);
+int floppy_install();
+int floppy_read_sectors(unsigned int lba, unsigned int count, void *buffer);
+int floppy_write_sectors(unsigned int lba, unsigned int count, void *buffer);
+int floppy_dma_read(unsigned int lba, unsigned int count);
+int floppy_dma_write(unsigned int lba, unsigned int count);
+int floppy_dma_start(unsigned int lba, unsigned int count, bool write,
+                     int buffer);
+int floppy_dma_poll();
+void floppy_sleep();
+char *floppy_dma_buffer(int index);
+int floppy_stream_read(unsigned int lba, unsigned int count,
+                       floppy_stream_consumer consume, void *context);
+unsigned int floppy_sector_count();
+unsigned int floppy_sectors_per_cylinder();
+void floppy_set_motor_timeout(unsigned int ticks);
 void floppy_clear_buffer();
 
 void floppy_reset_and_calibrate();
@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    21 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -53,6 +53,15 @@ void *irq_routines[16] =
         0, 0, 0, 0, 0, 0, 0, 0,
         0, 0, 0, 0, 0, 0, 0, 0};
 
+/** Maximum amount of shared handlers per IRQ */
+#define IRQ_MAX_SHARED 4
+
+/**
+ * Additional handlers of IRQs, which are shared by several PCI devices. All
+ * of them are called, each one checks whether its device raised the IRQ.
+ */
+static void (*irq_shared_routines[16][IRQ_MAX_SHARED])(struct regs *regs);
+
 /**
  * Installs a custom IRQ handler for the given IRQ
  *
@@ -82,6 +91,28 @@ void irq_install_handler(int irq, void (*handler)(struct regs *regs))
     irq_routines[irq] = handler;
 }
 
+/**
+ * Adds a handler for an IRQ, which may be shared with other devices. PCI
+ * interrupts are level triggered, so every device on the line needs its
+ * handler to acknowledge it.
+ *
+ * @param irq Index of the IRQ.
+ * @param handler Function to call when IRQ fires
+ * @return int 0 on success, -1 if the IRQ has too many handlers
+ */
+int irq_install_shared_handler(int irq, void (*handler)(struct regs *regs))
+{
+    for (int i = 0; i < IRQ_MAX_SHARED; i++)
+    {
+        if (!irq_shared_routines[irq][i])
+        {
+            irq_shared_routines[irq][i] = handler;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 /**
  * Clears the handler for a given IRQ
  *
@@ -195,6 +226,14 @@ void irq_handler(struct regs *regs)
     {
         handler(regs);
     }
+    for (int i = 0; i < IRQ_MAX_SHARED; i++)
+    {
+        handler = irq_shared_routines[regs->int_no - 32][i];
+        if (handler)
+        {
+            handler(regs);
+        }
+    }
 
     // If the IDT entry that was invoked was greater than 40
     // (meaning IRQ8 - 15), then we need to send an EOI to
@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    21 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -19,6 +19,7 @@
 #include "low_level.h"
 
 void irq_install_handler(int irq, void (*handler)(struct regs *regs));
+int irq_install_shared_handler(int irq, void (*handler)(struct regs *regs));
 void irq_uninstall_handler(int irq);
 void irq_install();
 
@@ -5,7 +5,7 @@
  *
  * START DATE :     17 Oct 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -24,6 +24,14 @@
 #include "shell.h"
 #include "floppy.h"
 #include "file_system.h"
+#include "cache.h"
+#include "elevator.h"
+#include "block_device.h"
+#include "pci.h"
+#include "ata.h"
+#include "virtio_blk.h"
+#include "ahci.h"
+#include "ramdisk.h"
 
 /**
  * Test shell command.
@@ -77,17 +85,37 @@ void kernel_main(void)
     timer_install();
     keyboard_install();
 
-    floppy_install();
-    print("Floppy installed\n", DEFAULT_COLOR_SCHEME);
-
     start_shell();
     register_command("test", test_command);
     register_command("echo", echo_command);
+    // without the floppy there is no "fd0", a disk can be mounted instead
+    if (floppy_install() == 0)
+    {
+        elevator_install();
+        print("Floppy installed\n", DEFAULT_COLOR_SCHEME);
+    }
+    block_device_install();
+    pci_install();
+    ata_install();
+    virtio_blk_install();
+    ahci_install();
+    cache_install();
+    ramdisk_install();
+    // serve the file system from memory if the floppy could be copied
+    block_device *disk = RAMDISK_AT_BOOT ? ramdisk_load() : 0;
+    cache_attach(disk ? disk : block_device_find("fd0"));
     install_filesystem();
 
-    // looping forever. From here on out everything happens with interrupts
+    // looping forever. From here on out everything happens with interrupts.
+    // Interrupt handlers only record events, the work is done here.
     for (;;)
     {
         asm("hlt");
+        // run the command the user entered
+        shell_run_pending_command();
+        // write changed tracks back every few seconds
+        cache_periodic_flush();
+        // carry on with disk transfers in the background
+        block_poll_all();
     }
 }
\ No newline at end of file
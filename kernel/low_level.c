@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -79,6 +79,62 @@ void port_word_out(unsigned short port, unsigned short data)
             : "a"(data), "d"(port));
 }
 
+/**
+ * Reads a double word from a port.
+ *
+ * @param port port to read from
+ * @return unsigned int double word value read from port
+ */
+unsigned int port_long_in(unsigned short port)
+{
+    unsigned int result;
+    asm volatile("inl %1, %0" : "=a"(result) : "dN"(port));
+    return result;
+}
+
+/**
+ * Writes a double word to a port.
+ *
+ * @param port port to write to
+ * @param data double word to write
+ */
+void port_long_out(unsigned short port, unsigned int data)
+{
+    asm volatile("outl %1, %0" : : "dN"(port), "a"(data));
+}
+
+/**
+ * Reads a string of words from a port, e.g. the data of a disk sector.
+ *
+ * @param port port to read from
+ * @param buffer destination of count words
+ * @param count amount of words
+ */
+void port_words_in(unsigned short port, unsigned short *buffer,
+                   unsigned int count)
+{
+    asm volatile("cld\n\trep insw"
+                 : "+D"(buffer), "+c"(count)
+                 : "d"(port)
+                 : "memory");
+}
+
+/**
+ * Writes a string of words to a port, e.g. the data of a disk sector.
+ *
+ * @param port port to write to
+ * @param buffer source of count words
+ * @param count amount of words
+ */
+void port_words_out(unsigned short port, const unsigned short *buffer,
+                    unsigned int count)
+{
+    asm volatile("cld\n\trep outsw"
+                 : "+S"(buffer), "+c"(count)
+                 : "d"(port)
+                 : "memory");
+}
+
 /**
  * Copy 'count' bytes of data from 'source' to 'destination'. Return 'destination'
  *
@@ -166,3 +222,64 @@ unsigned short *memsetw(unsigned short *destination, unsigned short value, unsig
     }
     return destination;
 }
+
+
+/**
+ * Checks whether the processor currently responds to maskable interrupts.
+ * This is not the case while an interrupt handler is running, as the IDT gates
+ * clear the interrupt flag.
+ *
+ * @return int 1 if the interrupt flag is set, 0 otherwise
+ */
+int interrupts_enabled()
+{
+    unsigned int eflags;
+    asm volatile("pushf\n\tpop %0" : "=r"(eflags));
+    // the interrupt flag is bit 9 of EFLAGS
+    return (eflags >> 9) & 1;
+}
+
+/**
+ * Disables maskable interrupts and returns the previous state of EFLAGS, so
+ * it can be restored with interrupts_restore. Can be nested.
+ *
+ * @return unsigned int EFLAGS before disabling interrupts
+ */
+unsigned int interrupts_disable()
+{
+    unsigned int eflags;
+    asm volatile("pushf\n\tpop %0\n\tcli" : "=r"(eflags));
+    return eflags;
+}
+
+/**
+ * Enables interrupts again, if they were enabled before the matching call to
+ * interrupts_disable.
+ *
+ * @param eflags value returned by interrupts_disable
+ */
+void interrupts_restore(unsigned int eflags)
+{
+    if (eflags & (1 << 9))
+    {
+        asm volatile("sti");
+    }
+}
+
+/**
+ * Halts the processor until the next interrupt
+ */
+void cpu_halt()
+{
+    asm volatile("hlt");
+}
+
+/**
+ * Enables interrupts and halts the processor until the next interrupt. sti
+ * only takes effect after the following instruction, so no interrupt can slip
+ * in between and leave the processor halted.
+ */
+void cpu_enable_interrupts_and_halt()
+{
+    asm volatile("sti\n\thlt");
+}
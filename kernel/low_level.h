@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    21 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -32,11 +32,22 @@ unsigned char port_byte_in(unsigned short port);
 void port_byte_out(unsigned short port, unsigned char data);
 unsigned short port_word_in(unsigned short port);
 void port_word_out(unsigned short port, unsigned short data);
+unsigned int port_long_in(unsigned short port);
+void port_long_out(unsigned short port, unsigned int data);
+void port_words_in(unsigned short port, unsigned short *buffer,
+                   unsigned int count);
+void port_words_out(unsigned short port, const unsigned short *buffer,
+                    unsigned int count);
 unsigned char *memcpy(unsigned char *dest, const unsigned char *src,
                       unsigned int count);
 unsigned char *memset(unsigned char *dest, unsigned char val,
                       unsigned int count);
 unsigned short *memsetw(unsigned short *dest, unsigned short val,
                         unsigned int count);
+int interrupts_enabled();
+unsigned int interrupts_disable();
+void interrupts_restore(unsigned int eflags);
+void cpu_halt();
+void cpu_enable_interrupts_and_halt();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+/**
+ * FILENAME :       lz.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A streaming decoder for LZ compressed files, see lz.h for the format.
+ *  The compressed data is decoded piece by piece as it is read from the
+ *  disk, and the decompressed data is handed on in runs, so neither has to
+ *  be held in memory as a whole.
+ */
+
+#include "lz.h"
+
+/**
+ * Prepares a decoder for a new stream
+ *
+ * @param decoder the decoder
+ */
+void lz_decoder_init(lz_decoder *decoder)
+{
+    decoder->produced = 0;
+    decoder->length = 0;
+    decoder->header_read = 0;
+    decoder->control = 0;
+    decoder->tokens_left = 0;
+    decoder->match_low = -1;
+}
+
+/**
+ * Hands the decompressed bytes in the window from a position up to the
+ * current end to the output. A run wrapping around the end of the window is
+ * handed on in two pieces.
+ *
+ * @param decoder the decoder
+ * @param from amount of decompressed bytes before the run
+ * @param output function receiving the bytes
+ * @param context context for the output function
+ */
+static void lz_flush(lz_decoder *decoder, unsigned int from, lz_output output,
+                     void *context)
+{
+    while (from < decoder->produced)
+    {
+        unsigned int start = from % LZ_WINDOW_SIZE;
+        unsigned int length = decoder->produced - from;
+        if (length > LZ_WINDOW_SIZE - start)
+        {
+            length = LZ_WINDOW_SIZE - start;
+        }
+        output(decoder->window + start, length, context);
+        from += length;
+    }
+}
+
+/**
+ * Decodes a piece of a compressed stream. Bytes following the end of the
+ * stream are ignored.
+ *
+ * @param decoder the decoder, initialized with lz_decoder_init
+ * @param input the next compressed bytes
+ * @param length amount of compressed bytes
+ * @param output function receiving the decompressed bytes
+ * @param context context for the output function
+ * @return int 1 while more input is needed, 0 once the stream is complete,
+ * -1 if it is damaged
+ */
+int lz_decode(lz_decoder *decoder, unsigned char *input, unsigned int length,
+              lz_output output, void *context)
+{
+    unsigned int flushed = decoder->produced;
+    for (unsigned int i = 0; i < length; i++)
+    {
+        unsigned char byte = input[i];
+        if (decoder->header_read < LZ_HEADER_SIZE)
+        {
+            decoder->length |= byte << (8 * decoder->header_read++);
+            continue;
+        }
+        if (decoder->produced >= decoder->length)
+        {
+            break;
+        }
+        if (decoder->match_low >= 0)
+        {
+            // the second byte of a match
+            unsigned int distance = (decoder->match_low | (byte >> 4) << 8) + 1;
+            unsigned int count = (byte & 0x0f) + LZ_MIN_MATCH;
+            decoder->match_low = -1;
+            if (distance > decoder->produced ||
+                count > decoder->length - decoder->produced)
+            {
+                return -1;
+            }
+            // the window would be overwritten before it is handed on
+            if (decoder->produced + count - flushed > LZ_WINDOW_SIZE)
+            {
+                lz_flush(decoder, flushed, output, context);
+                flushed = decoder->produced;
+            }
+            // byte by byte, a match may overlap the bytes it produces
+            for (unsigned int j = 0; j < count; j++)
+            {
+                decoder->window[decoder->produced % LZ_WINDOW_SIZE] =
+                    decoder->window[(decoder->produced - distance) %
+                                    LZ_WINDOW_SIZE];
+                decoder->produced++;
+            }
+            continue;
+        }
+        if (decoder->tokens_left == 0)
+        {
+            decoder->control = byte;
+            decoder->tokens_left = 8;
+            continue;
+        }
+        decoder->tokens_left--;
+        if (decoder->control & 1)
+        {
+            if (decoder->produced + 1 - flushed > LZ_WINDOW_SIZE)
+            {
+                lz_flush(decoder, flushed, output, context);
+                flushed = decoder->produced;
+            }
+            decoder->window[decoder->produced % LZ_WINDOW_SIZE] = byte;
+            decoder->produced++;
+        }
+        else
+        {
+            decoder->match_low = byte;
+        }
+        decoder->control >>= 1;
+    }
+    lz_flush(decoder, flushed, output, context);
+    if (decoder->header_read == LZ_HEADER_SIZE &&
+        decoder->produced >= decoder->length)
+    {
+        return 0;
+    }
+    return 1;
+}
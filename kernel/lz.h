@@ -0,0 +1,74 @@
+/**
+ * FILENAME :       lz.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Format and interface of the LZ decoder for compressed files.
+ *
+ *  A compressed stream starts with the length of the decompressed data as
+ *  32 bit little endian integer. It is followed by groups of up to 8 tokens,
+ *  each group preceded by a control byte. Bit i of the control byte, starting
+ *  at the lowest, describes token i of the group:
+ *  - 1: a literal byte, copied to the output
+ *  - 0: a match of 2 bytes, copying LZ_MIN_MATCH to LZ_MAX_MATCH bytes from
+ *    up to LZ_WINDOW_SIZE bytes back in the output. The first byte holds the
+ *    lower 8 bits of distance - 1, the second byte the upper 4 bits of
+ *    distance - 1 in its high nibble and length - LZ_MIN_MATCH in its low
+ *    nibble.
+ *  The host side compressor in tools/ creates this format.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+/** Size of the header holding the decompressed length */
+#define LZ_HEADER_SIZE 4
+/** Maximum distance of a match */
+#define LZ_WINDOW_SIZE 4096
+/** Shortest and longest match */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 18
+
+/**
+ * Function receiving the decompressed data
+ *
+ * @param data decompressed bytes
+ * @param length amount of bytes
+ * @param context context handed to lz_decode
+ */
+typedef void (*lz_output)(unsigned char *data, unsigned int length,
+                          void *context);
+
+/**
+ * State of a streaming decoder, the compressed data can be handed to it in
+ * pieces of any size
+ */
+typedef struct lz_decoder
+{
+    // the last LZ_WINDOW_SIZE decompressed bytes, a ring buffer
+    unsigned char window[LZ_WINDOW_SIZE];
+    // amount of decompressed bytes so far
+    unsigned int produced;
+    // length of the decompressed data, known once the header is read
+    unsigned int length;
+    // bytes of the header read so far
+    unsigned int header_read;
+    // the current control byte and the amount of its tokens left
+    unsigned char control;
+    unsigned int tokens_left;
+    // first byte of a match whose second byte is still missing, -1 if none
+    int match_low;
+} lz_decoder;
+
+void lz_decoder_init(lz_decoder *decoder);
+int lz_decode(lz_decoder *decoder, unsigned char *input, unsigned int length,
+              lz_output output, void *context);
+
+#endif
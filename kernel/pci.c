@@ -0,0 +1,279 @@
+/**
+ * FILENAME :       pci.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Enumerates the PCI bus through configuration mechanism #1 (ports 0xcf8
+ *  and 0xcfc), so drivers can find their controllers and the resources the
+ *  BIOS assigned to them.
+ */
+
+#include "pci.h"
+#include "low_level.h"
+#include "screen.h"
+#include "shell.h"
+
+/** Configuration mechanism #1 */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/** Functions found by the scan */
+static pci_device pci_devices[PCI_MAX_DEVICES];
+
+/** Amount of functions found */
+static int pci_device_count = 0;
+
+/**
+ * Builds the address of a double word in the configuration space
+ *
+ * @param bus bus number
+ * @param slot device number on the bus
+ * @param function function number of the device
+ * @param offset offset in the configuration space, rounded down to 4
+ * @return unsigned int value for the address port
+ */
+static unsigned int pci_address(unsigned char bus, unsigned char slot,
+                                unsigned char function, unsigned char offset)
+{
+    return 0x80000000 | (bus << 16) | (slot << 11) | (function << 8) |
+           (offset & 0xfc);
+}
+
+/**
+ * Reads a double word from the configuration space of a function
+ *
+ * @param bus bus number
+ * @param slot device number on the bus
+ * @param function function number of the device
+ * @param offset offset in the configuration space, rounded down to 4
+ * @return unsigned int value read
+ */
+static unsigned int pci_read(unsigned char bus, unsigned char slot,
+                             unsigned char function, unsigned char offset)
+{
+    port_long_out(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+    return port_long_in(PCI_CONFIG_DATA);
+}
+
+/**
+ * Reads a double word from the configuration space of a device
+ *
+ * @param device device found by the scan
+ * @param offset offset in the configuration space, rounded down to 4
+ * @return unsigned int value read
+ */
+unsigned int pci_config_read(pci_device *device, unsigned char offset)
+{
+    return pci_read(device->bus, device->slot, device->function, offset);
+}
+
+/**
+ * Writes a double word to the configuration space of a device
+ *
+ * @param device device found by the scan
+ * @param offset offset in the configuration space, rounded down to 4
+ * @param value value to write
+ */
+void pci_config_write(pci_device *device, unsigned char offset,
+                      unsigned int value)
+{
+    port_long_out(PCI_CONFIG_ADDRESS, pci_address(device->bus, device->slot,
+                                                  device->function, offset));
+    port_long_out(PCI_CONFIG_DATA, value);
+}
+
+/**
+ * Remembers a function, if it exists
+ *
+ * @param bus bus number
+ * @param slot device number on the bus
+ * @param function function number of the device
+ * @return int 1 if the function exists, 0 otherwise
+ */
+static int pci_probe(unsigned char bus, unsigned char slot,
+                     unsigned char function)
+{
+    unsigned int id = pci_read(bus, slot, function, 0x00);
+    if ((id & 0xffff) == 0xffff)
+    {
+        return 0;
+    }
+    if (pci_device_count >= PCI_MAX_DEVICES)
+    {
+        return 1;
+    }
+    pci_device *device = &pci_devices[pci_device_count++];
+    unsigned int class = pci_read(bus, slot, function, 0x08);
+    device->bus = bus;
+    device->slot = slot;
+    device->function = function;
+    device->vendor_id = id & 0xffff;
+    device->device_id = id >> 16;
+    device->class_code = class >> 24;
+    device->subclass = (class >> 16) & 0xff;
+    device->prog_if = (class >> 8) & 0xff;
+    device->irq = pci_read(bus, slot, function, PCI_INTERRUPT_LINE) & 0xff;
+    return 1;
+}
+
+/**
+ * Scans all buses for functions
+ */
+static void pci_scan()
+{
+    pci_device_count = 0;
+    for (int bus = 0; bus < 256; bus++)
+    {
+        for (int slot = 0; slot < 32; slot++)
+        {
+            if (!pci_probe(bus, slot, 0))
+            {
+                continue;
+            }
+            // bit 7 of the header type marks multi function devices
+            if (!((pci_read(bus, slot, 0, 0x0c) >> 16) & 0x80))
+            {
+                continue;
+            }
+            for (int function = 1; function < 8; function++)
+            {
+                pci_probe(bus, slot, function);
+            }
+        }
+    }
+}
+
+/**
+ * Finds a device by its class
+ *
+ * @param class_code base class, e.g. 0x01 for mass storage
+ * @param subclass subclass, e.g. 0x01 for IDE
+ * @param index skip this many matching devices
+ * @return pci_device* the device, or 0 if there is none
+ */
+pci_device *pci_find_class(unsigned char class_code, unsigned char subclass,
+                           int index)
+{
+    for (int i = 0; i < pci_device_count; i++)
+    {
+        if (pci_devices[i].class_code == class_code &&
+            pci_devices[i].subclass == subclass && index-- == 0)
+        {
+            return &pci_devices[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Finds a device by its vendor and device id
+ *
+ * @param vendor_id vendor id
+ * @param device_id device id
+ * @param index skip this many matching devices
+ * @return pci_device* the device, or 0 if there is none
+ */
+pci_device *pci_find_device(unsigned short vendor_id, unsigned short device_id,
+                            int index)
+{
+    for (int i = 0; i < pci_device_count; i++)
+    {
+        if (pci_devices[i].vendor_id == vendor_id &&
+            pci_devices[i].device_id == device_id && index-- == 0)
+        {
+            return &pci_devices[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Reads a base address register. The type bits are kept, bit 0 is set for
+ * I/O ports.
+ *
+ * @param device device found by the scan
+ * @param index number of the register, 0 to 5
+ * @return unsigned int content of the register
+ */
+unsigned int pci_bar(pci_device *device, int index)
+{
+    return pci_config_read(device, PCI_BAR0 + index * 4);
+}
+
+/**
+ * Sets bits in the command register of a device, e.g. to let it access
+ * memory as bus master
+ *
+ * @param device device found by the scan
+ * @param command PCI_COMMAND_ bits to set
+ */
+void pci_enable(pci_device *device, unsigned int command)
+{
+    unsigned int value = pci_config_read(device, PCI_COMMAND);
+    // the upper half is the status register, writing ones would clear bits
+    pci_config_write(device, PCI_COMMAND, (value & 0xffff) | command);
+}
+
+/**
+ * Prints a number with a fixed amount of hexadecimal digits
+ *
+ * @param value number to print
+ * @param digits amount of digits
+ */
+static void pci_print_hex(unsigned int value, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        print_char(hex[(value >> (i * 4)) & 0xf], DEFAULT_COLOR_SCHEME);
+    }
+}
+
+/**
+ * Shell command function for listing the PCI devices
+ *
+ * @param args Arguments string. None expected
+ */
+static int pci_command(int argc, char **argv)
+{
+    // surpressing unused parameter warnings
+    (void)(argc);
+    (void)(argv);
+    for (int i = 0; i < pci_device_count; i++)
+    {
+        pci_device *device = &pci_devices[i];
+        pci_print_hex(device->bus, 2);
+        print(":", DEFAULT_COLOR_SCHEME);
+        pci_print_hex(device->slot, 2);
+        print(".", DEFAULT_COLOR_SCHEME);
+        pci_print_hex(device->function, 1);
+        print(" ", DEFAULT_COLOR_SCHEME);
+        pci_print_hex(device->vendor_id, 4);
+        print(":", DEFAULT_COLOR_SCHEME);
+        pci_print_hex(device->device_id, 4);
+        print(" class ", DEFAULT_COLOR_SCHEME);
+        pci_print_hex(device->class_code, 2);
+        pci_print_hex(device->subclass, 2);
+        pci_print_hex(device->prog_if, 2);
+        print(" irq ", DEFAULT_COLOR_SCHEME);
+        print_unsigned_int(device->irq, DEFAULT_COLOR_SCHEME);
+        print("\n", DEFAULT_COLOR_SCHEME);
+    }
+    return 0;
+}
+
+/**
+ * Scans the PCI bus and registers the 'pci' shell command
+ */
+void pci_install()
+{
+    pci_scan();
+    register_command("pci", pci_command);
+}
@@ -0,0 +1,60 @@
+/**
+ * FILENAME :       pci.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for PCI bus enumeration and configuration space access
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+/** Maximum amount of PCI functions remembered by the scan */
+#define PCI_MAX_DEVICES 32
+
+/** Offsets in the configuration space */
+#define PCI_COMMAND 0x04
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3c
+
+/** Bits of the command register */
+#define PCI_COMMAND_IO 0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_BUS_MASTER 0x4
+
+/**
+ * A function found on the PCI bus
+ */
+typedef struct pci_device
+{
+    unsigned char bus;
+    unsigned char slot;
+    unsigned char function;
+    unsigned short vendor_id;
+    unsigned short device_id;
+    unsigned char class_code;
+    unsigned char subclass;
+    unsigned char prog_if;
+    // legacy interrupt line as assigned by the BIOS
+    unsigned char irq;
+} pci_device;
+
+unsigned int pci_config_read(pci_device *device, unsigned char offset);
+void pci_config_write(pci_device *device, unsigned char offset,
+                      unsigned int value);
+pci_device *pci_find_class(unsigned char class_code, unsigned char subclass,
+                           int index);
+pci_device *pci_find_device(unsigned short vendor_id, unsigned short device_id,
+                            int index);
+unsigned int pci_bar(pci_device *device, int index);
+void pci_enable(pci_device *device, unsigned int command);
+void pci_install();
+
+#endif
@@ -0,0 +1,343 @@
+/**
+ * FILENAME :       ramdisk.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A RAM disk holding a copy of the data floppy. When it is loaded, at boot
+ *  if RAMDISK_AT_BOOT is set or with 'ramdisk load', the whole floppy is
+ *  read in one sequential sweep, which takes a few seconds once instead of
+ *  seeking for every command. Afterwards all requests are served from memory.
+ *  Written sectors are remembered and copied back to the floppy only when
+ *  the device is flushed by the 'sync' command, the periodic write back of
+ *  the cache ends in memory. Changes which were not synced are lost when the
+ *  machine is turned off.
+ *  The RAM disk is registered as block device "ram0".
+ */
+
+#include "ramdisk.h"
+#include "floppy.h"
+#include "timer.h"
+#include "screen.h"
+#include "shell.h"
+#include "string.h"
+#include "low_level.h"
+
+/** Memory of the RAM disk */
+static unsigned char *const ramdisk_memory = (unsigned char *)RAMDISK_BASE;
+
+/** One bit per sector, set if the sector changed since the last write back */
+static unsigned int ramdisk_dirty[RAMDISK_MAX_SECTORS / 32];
+
+/** The floppy the RAM disk is a copy of */
+static block_device *ramdisk_backing = 0;
+
+/** The RAM disk as a block device */
+static block_device ramdisk_device;
+
+/** Statistics: sectors read and written by requests, sectors written back */
+static unsigned int ramdisk_reads = 0;
+static unsigned int ramdisk_writes = 0;
+static unsigned int ramdisk_written_back = 0;
+/** Duration of the initial sweep in timer ticks */
+static unsigned int ramdisk_load_ticks = 0;
+
+/**
+ * Tells whether a sector changed since the last write back
+ *
+ * @param sector the sector
+ * @return bool true if it changed
+ */
+static bool ramdisk_is_dirty(unsigned int sector)
+{
+    return (ramdisk_dirty[sector / 32] >> (sector % 32)) & 1;
+}
+
+/**
+ * Marks sectors as changed or unchanged
+ *
+ * @param sector first sector
+ * @param count amount of sectors
+ * @param dirty true if they changed
+ */
+static void ramdisk_set_dirty(unsigned int sector, unsigned int count,
+                              bool dirty)
+{
+    for (unsigned int i = sector; i < sector + count; i++)
+    {
+        if (dirty)
+        {
+            ramdisk_dirty[i / 32] |= 1u << (i % 32);
+        }
+        else
+        {
+            ramdisk_dirty[i / 32] &= ~(1u << (i % 32));
+        }
+    }
+}
+
+/**
+ * Block device operation serving a request. Memory is never busy, so the
+ * request is completed right away.
+ *
+ * @param device the RAM disk
+ * @param request request to serve
+ */
+static void ramdisk_device_submit(block_device *device, block_request *request)
+{
+    (void)(device);
+    unsigned char *sector =
+        ramdisk_memory + request->block * RAMDISK_SECTOR_SIZE;
+    unsigned int length = request->count * RAMDISK_SECTOR_SIZE;
+    if (request->write)
+    {
+        memcpy(sector, request->buffer, length);
+        ramdisk_set_dirty(request->block, request->count, true);
+        ramdisk_writes += request->count;
+    }
+    else
+    {
+        memcpy(request->buffer, sector, length);
+        ramdisk_reads += request->count;
+    }
+    request->status = BLOCK_REQUEST_DONE;
+    if (request->callback)
+    {
+        request->callback(request);
+    }
+}
+
+/**
+ * Block device operation serving queued requests. There never are any.
+ *
+ * @param device the RAM disk
+ * @return int 0, the RAM disk is always idle
+ */
+static int ramdisk_device_poll(block_device *device)
+{
+    (void)(device);
+    return 0;
+}
+
+/**
+ * Block device operation writing the changed sectors back to the floppy.
+ * Consecutive changed sectors are written by a single request.
+ *
+ * @param device the RAM disk
+ * @return int 0 on success, -1 on failure
+ */
+static int ramdisk_device_flush(block_device *device)
+{
+    int result = 0;
+    unsigned int sector = 0;
+    while (sector < device->block_count)
+    {
+        if (!ramdisk_is_dirty(sector))
+        {
+            sector++;
+            continue;
+        }
+        unsigned int count = 1;
+        while (sector + count < device->block_count &&
+               ramdisk_is_dirty(sector + count))
+        {
+            count++;
+        }
+        // sectors changing while they are written stay marked
+        ramdisk_set_dirty(sector, count, false);
+        if (block_write(ramdisk_backing, sector, count,
+                        ramdisk_memory + sector * RAMDISK_SECTOR_SIZE))
+        {
+            ramdisk_set_dirty(sector, count, true);
+            result = -1;
+        }
+        else
+        {
+            ramdisk_written_back += count;
+        }
+        sector += count;
+    }
+    if (block_flush(ramdisk_backing))
+    {
+        result = -1;
+    }
+    return result;
+}
+
+/** Operations of the RAM disk */
+static const block_device_ops ramdisk_device_ops = {
+    ramdisk_device_submit,
+    ramdisk_device_poll,
+    ramdisk_device_flush,
+};
+
+/**
+ * Makes sure addresses above 1MB are usable: the A20 line is enabled and the
+ * memory of the RAM disk exists
+ *
+ * @param size size of the RAM disk in bytes
+ * @return int 0 on success, -1 on failure
+ */
+static int ramdisk_check_memory(unsigned int size)
+{
+    volatile unsigned int *low = (volatile unsigned int *)0;
+    volatile unsigned int *high = (volatile unsigned int *)RAMDISK_BASE;
+    unsigned int saved = *low;
+    *low = 0x12345678;
+    *high = 0x87654321;
+    if (*low != 0x12345678)
+    {
+        // address line 20 is masked and the write wrapped around, try the
+        // fast A20 gate of the system control port
+        *low = saved;
+        port_byte_out(0x92, (port_byte_in(0x92) | 0x02) & ~0x01);
+        *low = 0x12345678;
+        *high = 0x87654321;
+        if (*low != 0x12345678)
+        {
+            *low = saved;
+            print("ramdisk: A20 line disabled\n", DEFAULT_COLOR_SCHEME);
+            return -1;
+        }
+    }
+    *low = saved;
+    volatile unsigned int *last =
+        (volatile unsigned int *)(RAMDISK_BASE + size - 4);
+    *last = 0x5a5aa5a5;
+    if (*last != 0x5a5aa5a5)
+    {
+        print("ramdisk: not enough memory\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Consumer of the initial sweep, copies the sectors into the RAM disk
+ *
+ * @param lba first sector of the data
+ * @param count amount of sectors
+ * @param data the sectors
+ * @param context unused
+ * @return int 0 to continue
+ */
+static int ramdisk_load_consumer(unsigned int lba, unsigned int count,
+                                 char *data, void *context)
+{
+    (void)(context);
+    memcpy(ramdisk_memory + lba * RAMDISK_SECTOR_SIZE, (unsigned char *)data,
+           count * RAMDISK_SECTOR_SIZE);
+    // one dot per cylinder
+    for (unsigned int i = 0; i < count; i += floppy_sectors_per_cylinder())
+    {
+        print_char('.', DEFAULT_COLOR_SCHEME);
+    }
+    return 0;
+}
+
+/**
+ * Shell command function for loading the RAM disk or showing its state
+ *
+ * @param args Arguments string. Expected format:
+ * command_name [load]
+ */
+static int ramdisk_command(int argc, char **argv)
+{
+    bool loaded = ramdisk_device.ops != 0;
+    if (argc > 1 && string_equals(argv[1], "load"))
+    {
+        if (loaded)
+        {
+            print("Error: The RAM disk is loaded already\n",
+                  DEFAULT_COLOR_SCHEME);
+            return 1;
+        }
+        if (!ramdisk_load())
+        {
+            print("Error: Could not load the RAM disk\n", DEFAULT_COLOR_SCHEME);
+            return 1;
+        }
+        print("Use 'mount ram0' to work on it, changes reach the floppy "
+              "only with 'sync'\n",
+              DEFAULT_COLOR_SCHEME);
+        return 0;
+    }
+    if (!loaded)
+    {
+        print("Not loaded, use 'ramdisk load'\n", DEFAULT_COLOR_SCHEME);
+        return 0;
+    }
+    unsigned int dirty = 0;
+    for (unsigned int i = 0; i < ramdisk_device.block_count; i++)
+    {
+        if (ramdisk_is_dirty(i))
+        {
+            dirty++;
+        }
+    }
+    print("Sectors: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ramdisk_device.block_count, DEFAULT_COLOR_SCHEME);
+    // timer ticks are 10ms
+    print(", loaded in ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ramdisk_load_ticks * 10, DEFAULT_COLOR_SCHEME);
+    print(" ms\nRead: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ramdisk_reads, DEFAULT_COLOR_SCHEME);
+    print(", written: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ramdisk_writes, DEFAULT_COLOR_SCHEME);
+    print(", written back: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(ramdisk_written_back, DEFAULT_COLOR_SCHEME);
+    print("\nChanged sectors, lost without 'sync': ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(dirty, DEFAULT_COLOR_SCHEME);
+    print("\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Copies the floppy into the RAM disk in one sweep and registers it as block
+ * device "ram0". The floppy must be installed and registered as "fd0"
+ * already.
+ *
+ * @return block_device* the RAM disk, or 0 if it could not be loaded
+ */
+block_device *ramdisk_load()
+{
+    ramdisk_backing = block_device_find("fd0");
+    unsigned int count = floppy_sector_count();
+    if (!ramdisk_backing || count > RAMDISK_MAX_SECTORS ||
+        ramdisk_check_memory(count * RAMDISK_SECTOR_SIZE))
+    {
+        return 0;
+    }
+    print("Loading RAM disk", DEFAULT_COLOR_SCHEME);
+    unsigned int start = timer_get_ticks();
+    int result = floppy_stream_read(0, count, ramdisk_load_consumer, 0);
+    ramdisk_load_ticks = timer_get_ticks() - start;
+    print("\n", DEFAULT_COLOR_SCHEME);
+    if (result)
+    {
+        print("ramdisk: could not read the floppy\n", DEFAULT_COLOR_SCHEME);
+        return 0;
+    }
+    memset((unsigned char *)ramdisk_dirty, 0, sizeof(ramdisk_dirty));
+    string_copy("ram0", ramdisk_device.name);
+    ramdisk_device.block_size = RAMDISK_SECTOR_SIZE;
+    ramdisk_device.block_count = count;
+    ramdisk_device.ops = &ramdisk_device_ops;
+    ramdisk_device.data = 0;
+    block_device_register(&ramdisk_device);
+    return &ramdisk_device;
+}
+
+/**
+ * Registers the 'ramdisk' shell command, which loads the RAM disk
+ */
+void ramdisk_install()
+{
+    register_command("ramdisk", ramdisk_command);
+}
@@ -0,0 +1,38 @@
+/**
+ * FILENAME :       ramdisk.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the RAM disk holding a copy of the data floppy
+ */
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "block_device.h"
+
+/**
+ * Set to 1 to copy the floppy into memory at boot and serve the file system
+ * from there, 0 to work on the floppy directly. The copy can also be made
+ * later with 'ramdisk load'. Changes reach the floppy only with 'sync'.
+ */
+#define RAMDISK_AT_BOOT 0
+
+/** Address of the RAM disk, the first MB above the real mode memory */
+#define RAMDISK_BASE 0x100000
+/** Size of a sector in bytes */
+#define RAMDISK_SECTOR_SIZE 512
+/** Maximum amount of sectors, enough for a 2.88MB floppy */
+#define RAMDISK_MAX_SECTORS 5760
+
+block_device *ramdisk_load();
+void ramdisk_install();
+
+#endif
@@ -5,18 +5,22 @@
  *
  * START DATE :     3 Dec 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
  * DESCRIPTION :
  *  A primitive shell to allow the user to run commands.
+ *  The keyboard interrupt only collects the input line. Commands are run by
+ *  the kernel's main loop, where interrupts are enabled, so they can wait for
+ *  devices without blocking the rest of the system.
  */
 
 #include "screen.h"
 #include "keyboard.h"
 #include "low_level.h"
 #include "string.h"
+#include "bool.h"
 
 // maximum length of a user input string
 #define COMMAND_BUFFER_SIZE 1024
@@ -40,6 +44,17 @@ char command_buffer[COMMAND_BUFFER_SIZE];
  */
 int command_buffer_pointer = 0;
 
+/**
+ * Input line handed from the keyboard interrupt to the main loop
+ */
+char pending_command[COMMAND_BUFFER_SIZE];
+
+/**
+ * true while a command is waiting in pending_command or running. Input typed
+ * meanwhile is collected for the next command, but not echoed yet.
+ */
+volatile bool shell_busy = false;
+
 /**
  * pointing to the next free index in the command table
  */
@@ -160,6 +175,44 @@ void execute_command(char *command, char *args)
     function(argc, argv);
 }
 
+/**
+ * Runs the command entered last, if there is one. Must be called from outside
+ * of interrupt handlers, usually from the kernel's main loop.
+ */
+void shell_run_pending_command()
+{
+    if (!shell_busy)
+    {
+        return;
+    }
+    char line[COMMAND_BUFFER_SIZE];
+    memcpy((unsigned char *)line, (unsigned char *)pending_command,
+           COMMAND_BUFFER_SIZE);
+    if (line[0] != 0)
+    {
+        char command[MAX_COMMAND_NAME_LENGTH];
+        memset((unsigned char *)command, 0, MAX_COMMAND_NAME_LENGTH);
+        int i = 0;
+        while (line[i] != ' ' && line[i] != 0 &&
+               i < MAX_COMMAND_NAME_LENGTH - 1)
+        {
+            command[i] = line[i];
+            i++;
+        }
+        execute_command(command, line);
+    }
+    print_prompt();
+    // echo what was typed while the command was running. The keyboard
+    // interrupt must not add to the buffer in between.
+    unsigned int eflags = interrupts_disable();
+    for (int i = 0; i < command_buffer_pointer; i++)
+    {
+        print_char(command_buffer[i], INPUT_COLOR_SCHEME);
+    }
+    shell_busy = false;
+    interrupts_restore(eflags);
+}
+
 /**
  * keyboard print function which shall be executed by the keyboar driver
  * whenever a key is supposed to be printed.
@@ -171,41 +224,46 @@ void shell_keyboard_print_function(char key)
     switch (key)
     {
     case '\n':
-        // newline
-        print_char(key, 0);
-        if (command_buffer_pointer > 0)
+        if (shell_busy)
         {
-            char command[MAX_COMMAND_NAME_LENGTH];
-            memset((unsigned char *)command, 0, MAX_COMMAND_NAME_LENGTH);
-            int i = 0;
-            while (command_buffer[i] != ' ' && command_buffer[i] != 0)
-            {
-                command[i] = command_buffer[i];
-                i++;
-            }
-            command[MAX_COMMAND_NAME_LENGTH - 1] = 0;
-            execute_command(command, command_buffer);
+            // the previous command is still running
+            break;
         }
-
+        // newline
+        print_char(key, 0);
+        // hand the line to the main loop
+        memcpy((unsigned char *)pending_command, (unsigned char *)command_buffer,
+               COMMAND_BUFFER_SIZE);
         clear_command_buffer();
-        print_prompt();
+        shell_busy = true;
         break;
     case '\b':
         // backspace
         if (command_buffer_pointer > 0)
         {
-            move_cursor(-1, 0);
-            print_char(0, 0);
-            move_cursor(-1, 0);
+            if (!shell_busy)
+            {
+                move_cursor(-1, 0);
+                print_char(0, 0);
+                move_cursor(-1, 0);
+            }
             command_buffer_pointer--;
             command_buffer[command_buffer_pointer] = 0;
         }
 
         break;
     default:
+        if (command_buffer_pointer >= COMMAND_BUFFER_SIZE - 1)
+        {
+            // keep the terminating 0
+            break;
+        }
         command_buffer[command_buffer_pointer] = key;
         command_buffer_pointer++;
-        print_char(key, INPUT_COLOR_SCHEME);
+        if (!shell_busy)
+        {
+            print_char(key, INPUT_COLOR_SCHEME);
+        }
         break;
     }
 }
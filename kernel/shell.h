@@ -5,7 +5,7 @@
  *
  * START DATE :     3 Dec 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -18,4 +18,5 @@
 
 void start_shell();
 void register_command(char *name, int (*function)(int argc, char **argv));
+void shell_run_pending_command();
 #endif
\ No newline at end of file
@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -151,3 +151,30 @@ int string_first(char *string, char mark)
     }
     return i;
 }
+
+/**
+ * Parses a decimal number
+ *
+ * @param string String containing only digits
+ * @param value where to store the number
+ *
+ * @return 0 on success, -1 if the string is not a number
+ */
+int string_to_unsigned_int(char *string, unsigned int *value)
+{
+    unsigned int result = 0;
+    if (string[0] == 0)
+    {
+        return -1;
+    }
+    for (int i = 0; string[i] != 0; i++)
+    {
+        if (string[i] < '0' || string[i] > '9')
+        {
+            return -1;
+        }
+        result = result * 10 + (string[i] - '0');
+    }
+    *value = result;
+    return 0;
+}
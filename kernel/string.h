@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -24,5 +24,6 @@ void string_copy(char *source, char *destination);
 int string_count_char(char *string, char c);
 void reduce_consecutive_occurrences(char *string, char c);
 int string_first(char *string, char mark);
+int string_to_unsigned_int(char *string, unsigned int *value);
 
 #endif
\ No newline at end of file
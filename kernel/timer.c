@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -34,7 +34,16 @@
  * This will keep track of how many ticks that the system
  * has been running for
  */
-unsigned int timer_ticks = 0;
+volatile unsigned int timer_ticks = 0;
+
+/** Maximum amount of functions which can be called on every tick */
+#define MAX_TIMER_HANDLERS 8
+
+/**
+ * Functions called on every timer tick with the current tick count. A value of
+ * 0 means the slot is free.
+ */
+static void (*timer_handlers[MAX_TIMER_HANDLERS])(unsigned int ticks);
 
 /** Clock speed in MHZ */
 #define CLOCK_SPEED 500
@@ -60,6 +69,18 @@ void timer_sleep(unsigned int ticks)
     }
 }
 
+/**
+ * Returns the number of timer ticks since the timer was installed. One tick
+ * equals 1/TIMER_RATE seconds. The count does not advance while interrupts are
+ * disabled.
+ *
+ * @return unsigned int ticks since installation
+ */
+unsigned int timer_get_ticks()
+{
+    return timer_ticks;
+}
+
 /**
  * Function to be called then a timer interrupt occurrs
  *
@@ -72,6 +93,15 @@ static void timer_callback(struct regs *regs)
     /* Increment our 'tick count' */
     timer_ticks++;
 
+    // let drivers do their time based work
+    for (int i = 0; i < MAX_TIMER_HANDLERS; i++)
+    {
+        if (timer_handlers[i])
+        {
+            timer_handlers[i](timer_ticks);
+        }
+    }
+
     /* Every TIMER_RATE clocks (approximately 1 second), we will
      *  display a message on the screen */
     if (timer_ticks % TIMER_RATE == 0)
@@ -80,6 +110,26 @@ static void timer_callback(struct regs *regs)
     }
 }
 
+/**
+ * Installs a function which is called on every timer tick from within the
+ * timer interrupt, so it has to be short.
+ *
+ * @param handler function taking the current tick count
+ * @return int 0 on success, -1 if all slots are taken
+ */
+int timer_install_handler(void (*handler)(unsigned int ticks))
+{
+    for (int i = 0; i < MAX_TIMER_HANDLERS; i++)
+    {
+        if (!timer_handlers[i])
+        {
+            timer_handlers[i] = handler;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 /**
  * Sets up the timer
  *
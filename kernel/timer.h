@@ -5,7 +5,7 @@
  *
  * START DATE :     19 Nov 2023
  *
- * LAST UPDATE :    07 Jan 2024
+ * LAST UPDATE :    16 Oct 2026
  *
  * PROJECT :        RubenOS
  *
@@ -19,5 +19,7 @@
 void timer_install();
 void timer_phase(int hz);
 void timer_sleep(unsigned int ticks);
+unsigned int timer_get_ticks();
+int timer_install_handler(void (*handler)(unsigned int ticks));
 
 #endif
\ No newline at end of file
@@ -0,0 +1,653 @@
+/**
+ * FILENAME :       virtio_blk.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  A driver for virtio block devices as provided by QEMU, using the legacy
+ *  PCI interface of transitional devices. Requests are placed in a split
+ *  virtqueue: a table of descriptors, the available ring for new requests and
+ *  the used ring for completed ones. Up to VIRTIO_BLK_SLOTS requests are in
+ *  flight at the same time and may complete in any order. Adjacent block
+ *  requests are merged into a single virtio request with a scatter-gather
+ *  list, which is placed in an indirect descriptor table if the device
+ *  supports it. Completion is signalled with the device's PCI interrupt.
+ *  The device is registered as block device "vda".
+ */
+
+#include "virtio_blk.h"
+#include "block_device.h"
+#include "pci.h"
+#include "irq.h"
+#include "screen.h"
+#include "shell.h"
+#include "string.h"
+#include "low_level.h"
+#include "bool.h"
+
+/** PCI ids of a transitional virtio block device */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/** Registers of the legacy interface, relative to the I/O base */
+#define VIRTIO_DEVICE_FEATURES 0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_ADDRESS 0x08
+#define VIRTIO_QUEUE_SIZE 0x0c
+#define VIRTIO_QUEUE_SELECT 0x0e
+#define VIRTIO_QUEUE_NOTIFY 0x10
+#define VIRTIO_DEVICE_STATUS 0x12
+#define VIRTIO_ISR_STATUS 0x13
+// device specific configuration, the capacity in sectors as 64 bit value
+#define VIRTIO_BLK_CAPACITY 0x14
+
+/** Bits of the device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+/** Feature bits */
+#define VIRTIO_BLK_F_RO (1 << 5)
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+#define VIRTIO_F_INDIRECT_DESC (1 << 28)
+
+/** Flags of a descriptor */
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_DESC_F_INDIRECT 4
+
+/** Set by the device in the used ring, if it needs no notifications */
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+/** Request types */
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+/** Status written by the device */
+#define VIRTIO_BLK_S_OK 0
+
+/** Largest queue the driver has memory for */
+#define VIRTQ_MAX_SIZE 256
+
+/** Alignment of the used ring in the legacy layout */
+#define VIRTQ_ALIGN 4096
+
+/** Descriptors needed by a request: header, segments and status */
+#define VIRTIO_BLK_DESCRIPTORS (VIRTIO_BLK_MAX_SEGMENTS + 2)
+
+/** Marks a slot without request */
+#define VIRTIO_BLK_SLOT_FREE 0xff
+
+/**
+ * A buffer descriptor
+ */
+typedef struct virtq_desc
+{
+    // physical address, the lower half suffices here
+    unsigned int address;
+    unsigned int address_high;
+    unsigned int length;
+    unsigned short flags;
+    unsigned short next;
+} __attribute__((packed)) virtq_desc;
+
+/**
+ * Ring of descriptor chains handed to the device
+ */
+typedef struct virtq_avail
+{
+    unsigned short flags;
+    unsigned short index;
+    unsigned short ring[VIRTQ_MAX_SIZE];
+} __attribute__((packed)) virtq_avail;
+
+/**
+ * Element of the used ring
+ */
+typedef struct virtq_used_element
+{
+    // head of the completed descriptor chain
+    unsigned int id;
+    // bytes written into device writable buffers
+    unsigned int length;
+} __attribute__((packed)) virtq_used_element;
+
+/**
+ * Ring of descriptor chains the device is done with
+ */
+typedef struct virtq_used
+{
+    unsigned short flags;
+    unsigned short index;
+    virtq_used_element ring[VIRTQ_MAX_SIZE];
+} __attribute__((packed)) virtq_used;
+
+/**
+ * Header in front of the data of a request
+ */
+typedef struct virtio_blk_header
+{
+    unsigned int type;
+    unsigned int reserved;
+    unsigned int sector;
+    unsigned int sector_high;
+} __attribute__((packed)) virtio_blk_header;
+
+/**
+ * A request handed to the device
+ */
+typedef struct virtio_blk_slot
+{
+    virtio_blk_header header;
+    // indirect descriptor table
+    virtq_desc table[VIRTIO_BLK_DESCRIPTORS] __attribute__((aligned(16)));
+    // merged block requests, their buffers are the segments
+    block_request *requests;
+    // written by the device
+    volatile unsigned char status;
+    // true while the device owns the slot
+    bool busy;
+} virtio_blk_slot;
+
+/**
+ * Memory of the virtqueue in the legacy layout: descriptors, available ring,
+ * then the used ring on the next page
+ */
+static unsigned char virtio_queue_memory[3 * VIRTQ_ALIGN]
+    __attribute__((aligned(VIRTQ_ALIGN)));
+
+/** Parts of the virtqueue */
+static virtq_desc *virtio_desc;
+static virtq_avail *virtio_avail;
+static virtq_used *virtio_used;
+
+/** Size of the virtqueue as chosen by the device */
+static unsigned int virtio_queue_size = 0;
+
+/** Last used ring index handled by the driver */
+static unsigned short virtio_last_used = 0;
+
+/** Requests in flight */
+static virtio_blk_slot virtio_slots[VIRTIO_BLK_SLOTS];
+
+/** Slots usable with the queue, fewer without indirect descriptors */
+static int virtio_slot_count = 0;
+
+/** true if the device accepted indirect descriptors */
+static bool virtio_indirect = false;
+
+/** true if the device needs flush requests */
+static bool virtio_flush = false;
+
+/** true if the device refuses writes */
+static bool virtio_read_only = false;
+
+/** I/O base of the legacy interface */
+static unsigned short virtio_io = 0;
+
+/** Requests not handed to the device yet, sorted by block */
+static block_request *virtio_queue = 0;
+
+/** Statistics */
+static unsigned int virtio_interrupts = 0;
+static unsigned int virtio_requests = 0;
+static unsigned int virtio_merged = 0;
+static unsigned int virtio_max_in_flight = 0;
+
+/** The device */
+static block_device virtio_device;
+
+/**
+ * Keeps the compiler from reordering memory accesses around shared rings.
+ * x86 does not reorder stores, so this is enough.
+ */
+static inline void virtio_barrier()
+{
+    asm volatile("" : : : "memory");
+}
+
+/**
+ * Amount of slots owned by the device
+ *
+ * @return int slots in flight
+ */
+static int virtio_in_flight()
+{
+    int count = 0;
+    for (int i = 0; i < virtio_slot_count; i++)
+    {
+        if (virtio_slots[i].busy)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Fills a descriptor
+ *
+ * @param desc descriptor to fill
+ * @param address start of the buffer
+ * @param length length of the buffer in bytes
+ * @param flags VIRTQ_DESC_F_ flags
+ * @param next index of the following descriptor
+ */
+static void virtio_fill_desc(virtq_desc *desc, void *address,
+                             unsigned int length, unsigned short flags,
+                             unsigned short next)
+{
+    desc->address = (unsigned int)address;
+    desc->address_high = 0;
+    desc->length = length;
+    desc->flags = flags;
+    desc->next = next;
+}
+
+/**
+ * Hands a slot to the device. Its header and requests must be set up.
+ *
+ * @param index index of the slot
+ */
+static void virtio_start_slot(int index)
+{
+    virtio_blk_slot *slot = &virtio_slots[index];
+    bool device_writes = slot->header.type == VIRTIO_BLK_T_IN;
+    // without indirect descriptors, each slot owns a range of the queue
+    virtq_desc *table = virtio_indirect
+                            ? slot->table
+                            : &virtio_desc[index * VIRTIO_BLK_DESCRIPTORS];
+    unsigned short base = virtio_indirect ? 0 : index * VIRTIO_BLK_DESCRIPTORS;
+    unsigned short count = 0;
+
+    virtio_fill_desc(&table[count], &slot->header, sizeof(virtio_blk_header),
+                     VIRTQ_DESC_F_NEXT, base + count + 1);
+    count++;
+    for (block_request *request = slot->requests; request;
+         request = request->next)
+    {
+        virtio_fill_desc(&table[count], request->buffer,
+                         request->count * VIRTIO_BLK_SECTOR_SIZE,
+                         VIRTQ_DESC_F_NEXT |
+                             (device_writes ? VIRTQ_DESC_F_WRITE : 0),
+                         base + count + 1);
+        count++;
+    }
+    slot->status = 0xff;
+    virtio_fill_desc(&table[count], (void *)&slot->status, 1,
+                     VIRTQ_DESC_F_WRITE, 0);
+    count++;
+
+    unsigned short head = base;
+    if (virtio_indirect)
+    {
+        // a single descriptor of the queue points to the slot's table
+        head = index;
+        virtio_fill_desc(&virtio_desc[head], slot->table,
+                         count * sizeof(virtq_desc), VIRTQ_DESC_F_INDIRECT, 0);
+    }
+    slot->busy = true;
+    virtio_avail->ring[virtio_avail->index % virtio_queue_size] = head;
+    virtio_barrier();
+    virtio_avail->index++;
+    virtio_barrier();
+    virtio_requests++;
+    int in_flight = virtio_in_flight();
+    if ((unsigned int)in_flight > virtio_max_in_flight)
+    {
+        virtio_max_in_flight = in_flight;
+    }
+    if (!(virtio_used->flags & VIRTQ_USED_F_NO_NOTIFY))
+    {
+        port_word_out(virtio_io + VIRTIO_QUEUE_NOTIFY, 0);
+    }
+}
+
+/**
+ * Takes the first queued request together with the following requests,
+ * which continue it in the same direction
+ *
+ * @return block_request* list of requests, or 0 if the queue is empty
+ */
+static block_request *virtio_take_requests()
+{
+    block_request *first = virtio_queue;
+    if (!first)
+    {
+        return 0;
+    }
+    block_request *last = first;
+    int segments = 1;
+    while (last->next && segments < VIRTIO_BLK_MAX_SEGMENTS &&
+           last->next->block == last->block + last->count &&
+           last->next->write == first->write)
+    {
+        last = last->next;
+        segments++;
+    }
+    virtio_queue = last->next;
+    last->next = 0;
+    virtio_merged += segments - 1;
+    return first;
+}
+
+/**
+ * Hands queued requests to the device while there are free slots
+ */
+static void virtio_fill_slots()
+{
+    for (int i = 0; i < virtio_slot_count && virtio_queue; i++)
+    {
+        virtio_blk_slot *slot = &virtio_slots[i];
+        if (slot->busy)
+        {
+            continue;
+        }
+        slot->requests = virtio_take_requests();
+        slot->header.type =
+            slot->requests->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        slot->header.reserved = 0;
+        slot->header.sector = slot->requests->block;
+        slot->header.sector_high = 0;
+        virtio_start_slot(i);
+    }
+}
+
+/**
+ * Completes the requests of slots the device is done with
+ */
+static void virtio_collect()
+{
+    while (virtio_last_used != virtio_used->index)
+    {
+        virtio_barrier();
+        unsigned int head =
+            virtio_used->ring[virtio_last_used % virtio_queue_size].id;
+        virtio_last_used++;
+        int index = virtio_indirect ? (int)head
+                                    : (int)head / VIRTIO_BLK_DESCRIPTORS;
+        if (index >= virtio_slot_count)
+        {
+            continue;
+        }
+        virtio_blk_slot *slot = &virtio_slots[index];
+        int status = slot->status == VIRTIO_BLK_S_OK ? BLOCK_REQUEST_DONE
+                                                     : BLOCK_REQUEST_FAILED;
+        block_request *request = slot->requests;
+        slot->requests = 0;
+        slot->busy = false;
+        while (request)
+        {
+            // the callback may reuse the request, so remember the next one
+            block_request *next = request->next;
+            request->next = 0;
+            request->status = status;
+            if (request->callback)
+            {
+                request->callback(request);
+            }
+            request = next;
+        }
+    }
+}
+
+/**
+ * Carries on with the requests without waiting
+ *
+ * @return int 1 while there are requests left, 0 once the device is idle
+ */
+static int virtio_poll()
+{
+    virtio_collect();
+    virtio_fill_slots();
+    return virtio_queue || virtio_in_flight() ? 1 : 0;
+}
+
+/**
+ * Interrupt handler of the device
+ *
+ * @param regs registers as pushed by the assembly code
+ */
+static void virtio_irq_callback(struct regs *regs)
+{
+    // avoid unused parameter warning
+    (void)(regs);
+    // reading the isr status acknowledges the level triggered interrupt
+    if (port_byte_in(virtio_io + VIRTIO_ISR_STATUS) & 1)
+    {
+        virtio_interrupts++;
+    }
+}
+
+/**
+ * Block device operation queueing a request
+ *
+ * @param device the virtio device
+ * @param request request to queue
+ */
+static void virtio_device_submit(block_device *device, block_request *request)
+{
+    (void)(device);
+    if (request->count == 0 || (request->write && virtio_read_only))
+    {
+        // writes to a read-only device fail without reaching it
+        request->status = request->count ? BLOCK_REQUEST_FAILED
+                                         : BLOCK_REQUEST_DONE;
+        if (request->callback)
+        {
+            request->callback(request);
+        }
+        return;
+    }
+    // insert sorted by block, so adjacent requests can be merged
+    block_request **link = &virtio_queue;
+    while (*link && (*link)->block <= request->block)
+    {
+        link = &(*link)->next;
+    }
+    request->next = *link;
+    *link = request;
+    virtio_fill_slots();
+}
+
+/**
+ * Block device operation serving requests
+ *
+ * @param device the virtio device
+ * @return int 1 while requests are being served, 0 once the device is idle
+ */
+static int virtio_device_poll(block_device *device)
+{
+    (void)(device);
+    return virtio_poll();
+}
+
+/**
+ * Block device operation making sure written data reached the medium
+ *
+ * @param device the virtio device
+ * @return int 0 on success, -1 on failure
+ */
+static int virtio_device_flush(block_device *device)
+{
+    (void)(device);
+    if (!virtio_flush)
+    {
+        return 0;
+    }
+    while (virtio_poll())
+    {
+        block_sleep();
+    }
+    // a flush request has no data
+    virtio_blk_slot *slot = &virtio_slots[0];
+    slot->requests = 0;
+    slot->header.type = VIRTIO_BLK_T_FLUSH;
+    slot->header.reserved = 0;
+    slot->header.sector = 0;
+    slot->header.sector_high = 0;
+    virtio_start_slot(0);
+    while (slot->busy)
+    {
+        virtio_collect();
+        if (slot->busy)
+        {
+            block_sleep();
+        }
+    }
+    return slot->status == VIRTIO_BLK_S_OK ? 0 : -1;
+}
+
+/** Operations of the device */
+static const block_device_ops virtio_device_ops = {
+    virtio_device_submit,
+    virtio_device_poll,
+    virtio_device_flush,
+};
+
+/**
+ * Shell command function for showing the device's statistics
+ *
+ * @param args Arguments string. None expected
+ */
+static int virtio_command(int argc, char **argv)
+{
+    // surpressing unused parameter warnings
+    (void)(argc);
+    (void)(argv);
+    print("Queue size: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(virtio_queue_size, DEFAULT_COLOR_SCHEME);
+    print(", slots: ", DEFAULT_COLOR_SCHEME);
+    print_int(virtio_slot_count, DEFAULT_COLOR_SCHEME);
+    print(virtio_indirect ? ", indirect" : ", direct", DEFAULT_COLOR_SCHEME);
+    if (virtio_read_only)
+    {
+        print(", read-only", DEFAULT_COLOR_SCHEME);
+    }
+    print("\nRequests: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(virtio_requests, DEFAULT_COLOR_SCHEME);
+    print(", merged: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(virtio_merged, DEFAULT_COLOR_SCHEME);
+    print(", max in flight: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(virtio_max_in_flight, DEFAULT_COLOR_SCHEME);
+    print(", interrupts: ", DEFAULT_COLOR_SCHEME);
+    print_unsigned_int(virtio_interrupts, DEFAULT_COLOR_SCHEME);
+    print("\n", DEFAULT_COLOR_SCHEME);
+    return 0;
+}
+
+/**
+ * Sets up the virtqueue of the device
+ *
+ * @return int 0 on success, -1 on failure
+ */
+static int virtio_setup_queue()
+{
+    port_word_out(virtio_io + VIRTIO_QUEUE_SELECT, 0);
+    virtio_queue_size = port_word_in(virtio_io + VIRTIO_QUEUE_SIZE);
+    if (virtio_queue_size == 0 || virtio_queue_size > VIRTQ_MAX_SIZE)
+    {
+        // the legacy interface does not allow choosing the size
+        print("virtio: unsupported queue size\n", DEFAULT_COLOR_SCHEME);
+        return -1;
+    }
+    memset(virtio_queue_memory, 0, sizeof(virtio_queue_memory));
+    unsigned int avail_offset = virtio_queue_size * sizeof(virtq_desc);
+    unsigned int used_offset =
+        (avail_offset + 6 + 2 * virtio_queue_size + VIRTQ_ALIGN - 1) &
+        ~(VIRTQ_ALIGN - 1);
+    virtio_desc = (virtq_desc *)virtio_queue_memory;
+    virtio_avail = (virtq_avail *)(virtio_queue_memory + avail_offset);
+    virtio_used = (virtq_used *)(virtio_queue_memory + used_offset);
+    virtio_last_used = 0;
+
+    virtio_slot_count = virtio_indirect
+                            ? VIRTIO_BLK_SLOTS
+                            : (int)virtio_queue_size / VIRTIO_BLK_DESCRIPTORS;
+    if (virtio_slot_count > VIRTIO_BLK_SLOTS)
+    {
+        virtio_slot_count = VIRTIO_BLK_SLOTS;
+    }
+    if (virtio_slot_count > (int)virtio_queue_size)
+    {
+        virtio_slot_count = virtio_queue_size;
+    }
+    for (int i = 0; i < VIRTIO_BLK_SLOTS; i++)
+    {
+        virtio_slots[i].busy = false;
+        virtio_slots[i].requests = 0;
+    }
+    port_long_out(virtio_io + VIRTIO_QUEUE_ADDRESS,
+                  (unsigned int)virtio_queue_memory / VIRTQ_ALIGN);
+    return 0;
+}
+
+/**
+ * Installs the driver: initializes the first virtio block device found on
+ * the PCI bus, registers it as block device "vda" and registers the
+ * 'virtio' shell command. The PCI bus must have been scanned already.
+ */
+void virtio_blk_install()
+{
+    pci_device *pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, 0);
+    if (!pci)
+    {
+        return;
+    }
+    unsigned int bar = pci_bar(pci, 0);
+    if (!(bar & 1))
+    {
+        print("virtio: legacy interface not available\n", DEFAULT_COLOR_SCHEME);
+        return;
+    }
+    virtio_io = bar & 0xfffc;
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    // reset, then tell the device it was found and can be driven
+    port_byte_out(virtio_io + VIRTIO_DEVICE_STATUS, 0);
+    port_byte_out(virtio_io + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    port_byte_out(virtio_io + VIRTIO_DEVICE_STATUS,
+                  VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    unsigned int features = port_long_in(virtio_io + VIRTIO_DEVICE_FEATURES);
+    unsigned int accepted = features & (VIRTIO_F_INDIRECT_DESC |
+                                        VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_RO);
+    port_long_out(virtio_io + VIRTIO_GUEST_FEATURES, accepted);
+    virtio_indirect = (accepted & VIRTIO_F_INDIRECT_DESC) != 0;
+    virtio_flush = (accepted & VIRTIO_BLK_F_FLUSH) != 0;
+    virtio_read_only = (accepted & VIRTIO_BLK_F_RO) != 0;
+
+    if (virtio_setup_queue())
+    {
+        port_byte_out(virtio_io + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+    if (pci->irq < 16)
+    {
+        irq_install_shared_handler(pci->irq, &virtio_irq_callback);
+    }
+    port_byte_out(virtio_io + VIRTIO_DEVICE_STATUS,
+                  VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+                      VIRTIO_STATUS_DRIVER_OK);
+
+    unsigned int capacity = port_long_in(virtio_io + VIRTIO_BLK_CAPACITY);
+    if (port_long_in(virtio_io + VIRTIO_BLK_CAPACITY + 4))
+    {
+        // more than the 32 bit block numbers can reach
+        capacity = 0xffffffff;
+    }
+    string_copy("vda", virtio_device.name);
+    virtio_device.block_size = VIRTIO_BLK_SECTOR_SIZE;
+    virtio_device.block_count = capacity;
+    virtio_device.ops = &virtio_device_ops;
+    virtio_device.data = 0;
+    block_device_register(&virtio_device);
+    register_command("virtio", virtio_command);
+}
@@ -0,0 +1,33 @@
+/**
+ * FILENAME :       virtio_blk.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the virtio block device driver
+ */
+
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+/** Size of a sector in bytes */
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+/** Maximum amount of requests handed to the device at the same time */
+#define VIRTIO_BLK_SLOTS 32
+
+/**
+ * Maximum amount of block requests merged into one virtio request, each of
+ * them is a segment of the scatter-gather list
+ */
+#define VIRTIO_BLK_MAX_SEGMENTS 8
+
+void virtio_blk_install();
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * FILENAME :       lzpack.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Host side compressor for files of the RubenOS file system. It creates the
+ *  LZ format described in kernel/lz.h, which the kernel decompresses while it
+ *  reads the file.
+ *  Usage: lzpack input output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../kernel/lz.h"
+
+/** Amount of hash chain heads, matches are found by their first 3 bytes */
+#define LZ_HASH_SIZE 4096
+/** Maximum amount of candidates tried for a match */
+#define LZ_MAX_CHAIN 256
+
+/**
+ * Hash chains of the positions within the window. The newest position with a
+ * hash is its head, prev links each position to the previous one with the
+ * same hash, -1 ends a chain.
+ */
+static int lz_head[LZ_HASH_SIZE];
+static int lz_prev[LZ_WINDOW_SIZE];
+
+/**
+ * Hashes the 3 bytes at a position
+ *
+ * @param data the bytes
+ * @return unsigned int the hash
+ */
+static unsigned int lz_hash(unsigned char *data)
+{
+    return ((data[0] << 8) ^ (data[1] << 4) ^ data[2]) % LZ_HASH_SIZE;
+}
+
+/**
+ * Adds a position to the hash chains
+ *
+ * @param data the whole input
+ * @param size size of the input
+ * @param position the position
+ */
+static void lz_insert(unsigned char *data, unsigned int size,
+                      unsigned int position)
+{
+    if (position + LZ_MIN_MATCH > size)
+    {
+        return;
+    }
+    unsigned int hash = lz_hash(data + position);
+    lz_prev[position % LZ_WINDOW_SIZE] = lz_head[hash];
+    lz_head[hash] = position;
+}
+
+/**
+ * Finds the longest match for the data at a position within the window
+ *
+ * @param data the whole input
+ * @param size size of the input
+ * @param position position of the data to match
+ * @param distance receives the distance of the match
+ * @return unsigned int length of the match, 0 if there is none
+ */
+static unsigned int find_match(unsigned char *data, unsigned int size,
+                               unsigned int position, unsigned int *distance)
+{
+    if (position + LZ_MIN_MATCH > size)
+    {
+        return 0;
+    }
+    unsigned int best = 0;
+    int candidate = lz_head[lz_hash(data + position)];
+    // the chain runs from the closest to the farthest candidate
+    for (int tries = 0; candidate >= 0 && tries < LZ_MAX_CHAIN &&
+                        position - candidate <= LZ_WINDOW_SIZE;
+         tries++)
+    {
+        unsigned int length = 0;
+        while (length < LZ_MAX_MATCH && position + length < size &&
+               data[candidate + length] == data[position + length])
+        {
+            length++;
+        }
+        if (length > best)
+        {
+            best = length;
+            *distance = position - candidate;
+        }
+        if (best == LZ_MAX_MATCH)
+        {
+            break;
+        }
+        candidate = lz_prev[candidate % LZ_WINDOW_SIZE];
+    }
+    return best >= LZ_MIN_MATCH ? best : 0;
+}
+
+/**
+ * Compresses data into the LZ format
+ *
+ * @param data the input
+ * @param size size of the input
+ * @param output receives the compressed data, 9/8 of the input plus
+ * LZ_HEADER_SIZE + 1 bytes are enough
+ * @return unsigned int size of the compressed data
+ */
+unsigned int lz_compress(unsigned char *data, unsigned int size,
+                         unsigned char *output)
+{
+    unsigned int out = 0;
+    for (int i = 0; i < LZ_HEADER_SIZE; i++)
+    {
+        output[out++] = (size >> (8 * i)) & 0xff;
+    }
+    for (int i = 0; i < LZ_HASH_SIZE; i++)
+    {
+        lz_head[i] = -1;
+    }
+    unsigned int control = 0;
+    int tokens = 8;
+    for (unsigned int position = 0; position < size;)
+    {
+        if (tokens == 8)
+        {
+            control = out++;
+            output[control] = 0;
+            tokens = 0;
+        }
+        unsigned int distance = 0;
+        unsigned int length = find_match(data, size, position, &distance);
+        if (length)
+        {
+            output[out++] = (distance - 1) & 0xff;
+            output[out++] =
+                ((distance - 1) >> 8) << 4 | (length - LZ_MIN_MATCH);
+            while (length--)
+            {
+                lz_insert(data, size, position++);
+            }
+        }
+        else
+        {
+            output[control] |= 1 << tokens;
+            output[out++] = data[position];
+            lz_insert(data, size, position++);
+        }
+        tokens++;
+    }
+    return out;
+}
+
+#ifndef LZPACK_NO_MAIN
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s input output\n", argv[0]);
+        return 1;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    unsigned int size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = malloc(size + 1);
+    unsigned char *output = malloc(size + size / 8 + LZ_HEADER_SIZE + 1);
+    if (!data || !output || fread(data, 1, size, file) != size)
+    {
+        fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(file);
+    unsigned int compressed = lz_compress(data, size, output);
+    file = fopen(argv[2], "wb");
+    if (!file || fwrite(output, 1, compressed, file) != compressed)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    fclose(file);
+    return 0;
+}
+#endif
@@ -0,0 +1,713 @@
+/**
+ * FILENAME :       mkfloppy.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Host side image builder for the RubenOS file system. It formats a floppy
+ *  image or updates an existing one, imports files into it and verifies the
+ *  result. The image is built in memory with the structures of
+ *  kernel/file_system.h and written in one pass.
+ *  Files are stored with a terminating zero, LZ compressed if that makes them
+ *  smaller and inside their directory entry if they are tiny. A file with the
+ *  name of an existing one replaces it.
+ *  Without files, the image is only verified and its files are listed.
+ *  Usage: mkfloppy [-n] [-u] image [file ...]
+ *    -n  create a new image, even if the image exists
+ *    -u  store the files uncompressed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../kernel/file_system.h"
+#define LZPACK_NO_MAIN
+#include "lzpack.c"
+#include "../kernel/lz.c"
+
+/** Amount of blocks of a new image, a 1.44MB floppy */
+#define NEW_IMAGE_BLOCKS 2880
+
+/** The image while it is built */
+static unsigned char *image;
+static unsigned int image_blocks;
+static superblock *super;
+static unsigned char *bitmap;
+static file_entry *directory;
+
+/**
+ * Returns a block of the image
+ *
+ * @param block number of the block
+ * @return unsigned char* the block
+ */
+static unsigned char *image_block(unsigned int block)
+{
+    return image + block * FS_BLOCK_SIZE;
+}
+
+/**
+ * Points the superblock, bitmap and directory into the image
+ */
+static void image_attach()
+{
+    super = (superblock *)image_block(FS_SUPERBLOCK);
+    bitmap = image_block(super->bitmap_start);
+    directory = (file_entry *)image_block(super->directory_start);
+}
+
+/**
+ * Checks whether a block is marked as used in the bitmap
+ *
+ * @param block the block
+ * @return int 1 if it is used
+ */
+static int block_used(unsigned int block)
+{
+    return (bitmap[block / 8] >> (block % 8)) & 1;
+}
+
+/**
+ * Marks blocks as used or free in the bitmap
+ *
+ * @param start first block
+ * @param count amount of blocks
+ * @param used 1 to mark them as used, 0 to mark them as free
+ */
+static void mark_blocks(unsigned int start, unsigned int count, int used)
+{
+    for (unsigned int block = start; block < start + count; block++)
+    {
+        if (used)
+        {
+            bitmap[block / 8] |= 1 << (block % 8);
+        }
+        else
+        {
+            bitmap[block / 8] &= ~(1 << (block % 8));
+        }
+    }
+}
+
+/**
+ * Creates an empty file system in the image, with the layout the kernel's
+ * 'format' command creates
+ */
+static void image_format()
+{
+    memset(image, 0, image_blocks * FS_BLOCK_SIZE);
+    super = (superblock *)image_block(FS_SUPERBLOCK);
+    super->magic = FS_MAGIC;
+    super->block_count = image_blocks;
+    super->bitmap_start = FS_SUPERBLOCK + 1;
+    super->bitmap_blocks =
+        (image_blocks + FS_BITS_PER_BLOCK - 1) / FS_BITS_PER_BLOCK;
+    super->directory_start = super->bitmap_start + super->bitmap_blocks;
+    super->directory_blocks = FS_DIRECTORY_BLOCKS;
+    super->data_start = super->directory_start + super->directory_blocks;
+    image_attach();
+    mark_blocks(FS_SUPERBLOCK, super->data_start, 1);
+}
+
+/**
+ * Reads an image file into memory
+ *
+ * @param path path of the image
+ * @return int 0 on success, -1 if it does not exist, -2 if it is not
+ * formatted
+ */
+static int image_load(char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    image_blocks = size / FS_BLOCK_SIZE;
+    image = malloc(image_blocks * FS_BLOCK_SIZE);
+    if (!image || image_blocks <= FS_SUPERBLOCK ||
+        fread(image, FS_BLOCK_SIZE, image_blocks, file) != image_blocks)
+    {
+        fclose(file);
+        return -2;
+    }
+    fclose(file);
+    super = (superblock *)image_block(FS_SUPERBLOCK);
+    if (super->magic != FS_MAGIC || super->block_count > image_blocks ||
+        super->data_start > super->block_count)
+    {
+        return -2;
+    }
+    image_attach();
+    return 0;
+}
+
+/**
+ * Writes the image to a file
+ *
+ * @param path path of the image
+ * @return int 0 on success, -1 on failure
+ */
+static int image_store(char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file ||
+        fwrite(image, FS_BLOCK_SIZE, image_blocks, file) != image_blocks)
+    {
+        perror(path);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * Finds a file in the directory
+ *
+ * @param name name of the file
+ * @return int index of its entry, -1 if there is none
+ */
+static int find_file(char *name)
+{
+    for (int i = 0; i < super->file_count; i++)
+    {
+        if (!strcmp(directory[i].name, name))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Frees the blocks of a file
+ *
+ * @param entry the file
+ */
+static void free_file(file_entry *entry)
+{
+    if (!(entry->flags & FILE_FLAG_INLINE))
+    {
+        for (int i = 0; i < entry->extent_count; i++)
+        {
+            mark_blocks(entry->extents[i].start, entry->extents[i].count, 0);
+        }
+    }
+    // a replaced program keeps its execute count
+    unsigned int executions =
+        entry->flags & FILE_FLAG_INLINE ? 0 : entry->execute_count;
+    memset(entry->inline_data, 0, sizeof(entry->inline_data));
+    entry->execute_count = executions;
+    entry->extent_count = 0;
+    entry->flags = 0;
+    entry->data_length = 0;
+}
+
+/**
+ * Allocates the blocks for a file. A single run of consecutive blocks is
+ * preferred, otherwise the first free runs are used.
+ *
+ * @param entry the file, receives the extents
+ * @param blocks amount of blocks
+ * @return int 0 on success, -1 if there is not enough space
+ */
+static int allocate(file_entry *entry, unsigned int blocks)
+{
+    // the first free run which is long enough
+    unsigned int run = 0;
+    for (unsigned int block = super->data_start; block < super->block_count;
+         block++)
+    {
+        run = block_used(block) ? 0 : run + 1;
+        if (run == blocks)
+        {
+            entry->extents[0].start = block + 1 - blocks;
+            entry->extents[0].count = blocks;
+            entry->extent_count = 1;
+            mark_blocks(block + 1 - blocks, blocks, 1);
+            return 0;
+        }
+    }
+    // pieced together from the first free runs
+    unsigned int left = blocks;
+    entry->extent_count = 0;
+    for (unsigned int block = super->data_start;
+         block < super->block_count && left; block++)
+    {
+        if (block_used(block))
+        {
+            continue;
+        }
+        if (entry->extent_count == FILE_MAX_EXTENTS)
+        {
+            break;
+        }
+        extent *piece = &entry->extents[entry->extent_count++];
+        piece->start = block;
+        piece->count = 0;
+        while (block < super->block_count && !block_used(block) && left)
+        {
+            piece->count++;
+            left--;
+            block++;
+        }
+    }
+    if (left)
+    {
+        entry->extent_count = 0;
+        return -1;
+    }
+    for (int i = 0; i < entry->extent_count; i++)
+    {
+        mark_blocks(entry->extents[i].start, entry->extents[i].count, 1);
+    }
+    return 0;
+}
+
+/**
+ * Stores data as the content of a file
+ *
+ * @param entry the file, without any blocks
+ * @param data the data
+ * @param length amount of bytes
+ * @return int 0 on success, -1 if there is not enough space
+ */
+static int store_data(file_entry *entry, unsigned char *data,
+                      unsigned int length)
+{
+    entry->data_length = length;
+    if (length <= FILE_INLINE_DATA_SIZE)
+    {
+        entry->flags |= FILE_FLAG_INLINE;
+        memcpy(entry->inline_data, data, length);
+        return 0;
+    }
+    unsigned int blocks = (length + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    if (allocate(entry, blocks))
+    {
+        return -1;
+    }
+    for (int i = 0; i < entry->extent_count; i++)
+    {
+        unsigned int size = entry->extents[i].count * FS_BLOCK_SIZE;
+        unsigned char *destination = image_block(entry->extents[i].start);
+        memset(destination, 0, size);
+        memcpy(destination, data, length < size ? length : size);
+        data += size;
+        length -= length < size ? length : size;
+    }
+    return 0;
+}
+
+/**
+ * Destination of decompressed data
+ */
+typedef struct buffer
+{
+    unsigned char *data;
+    unsigned int length;
+    unsigned int capacity;
+} buffer;
+
+/**
+ * Output function of lz_decode appending to a buffer
+ *
+ * @param data decompressed bytes
+ * @param length amount of bytes
+ * @param context the buffer
+ */
+static void buffer_output(unsigned char *data, unsigned int length,
+                          void *context)
+{
+    buffer *target = (buffer *)context;
+    if (length <= target->capacity - target->length)
+    {
+        memcpy(target->data + target->length, data, length);
+    }
+    target->length += length;
+}
+
+/**
+ * Reads the content of a file as the kernel sees it, decompressing it if
+ * needed
+ *
+ * @param entry the file
+ * @param length receives the amount of bytes
+ * @return unsigned char* the content, to be freed, 0 if it is damaged
+ */
+static unsigned char *load_file(file_entry *entry, unsigned int *length)
+{
+    unsigned char *stored = malloc(entry->data_length + 1);
+    if (!stored)
+    {
+        return 0;
+    }
+    if (entry->flags & FILE_FLAG_INLINE)
+    {
+        memcpy(stored, entry->inline_data, entry->data_length);
+    }
+    else
+    {
+        unsigned int offset = 0;
+        for (int i = 0; i < entry->extent_count; i++)
+        {
+            unsigned int size = entry->extents[i].count * FS_BLOCK_SIZE;
+            unsigned int left = entry->data_length - offset;
+            memcpy(stored + offset, image_block(entry->extents[i].start),
+                   left < size ? left : size);
+            offset += left < size ? left : size;
+        }
+    }
+    if (!(entry->flags & FILE_FLAG_COMPRESSED))
+    {
+        *length = entry->data_length;
+        return stored;
+    }
+    static lz_decoder decoder;
+    lz_decoder_init(&decoder);
+    // the header tells the decompressed length
+    unsigned int capacity = 0;
+    for (int i = 0; i < LZ_HEADER_SIZE && i < (int)entry->data_length; i++)
+    {
+        capacity |= stored[i] << (8 * i);
+    }
+    buffer output = {malloc(capacity + 1), 0, capacity};
+    if (!output.data || lz_decode(&decoder, stored, entry->data_length,
+                                  buffer_output, &output) != 0 ||
+        output.length != capacity)
+    {
+        free(stored);
+        free(output.data);
+        return 0;
+    }
+    free(stored);
+    *length = output.length;
+    return output.data;
+}
+
+/**
+ * Checks the consistency of the file system in the image: the layout, the
+ * directory entries, that no block belongs to two files and that the bitmap
+ * marks exactly the blocks in use
+ *
+ * @return int amount of problems found
+ */
+static int verify()
+{
+    int problems = 0;
+    if (super->bitmap_start <= FS_SUPERBLOCK ||
+        super->bitmap_blocks * FS_BITS_PER_BLOCK < super->block_count ||
+        super->directory_start < super->bitmap_start + super->bitmap_blocks ||
+        super->directory_blocks != FS_DIRECTORY_BLOCKS ||
+        super->data_start < super->directory_start + super->directory_blocks ||
+        super->file_count > MAX_FILE_COUNT)
+    {
+        fprintf(stderr, "Error: The superblock is damaged\n");
+        return 1;
+    }
+    // the owner of each block, 0 for metadata, file index + 1 for data
+    int *owner = malloc(super->block_count * sizeof(int));
+    for (unsigned int block = 0; block < super->block_count; block++)
+    {
+        owner[block] = block < super->data_start ? 0 : -1;
+    }
+    for (int i = 0; i < super->file_count; i++)
+    {
+        file_entry *entry = &directory[i];
+        int found = problems;
+        if (!entry->name[0] ||
+            memchr(entry->name, 0, MAX_FILENAME_LENGTH) == 0 ||
+            find_file(entry->name) != i)
+        {
+            fprintf(stderr, "Error: Entry %d has a bad or duplicate name\n", i);
+            problems++;
+            continue;
+        }
+        unsigned int capacity = 0;
+        if (entry->flags & FILE_FLAG_INLINE)
+        {
+            capacity = FILE_INLINE_DATA_SIZE;
+        }
+        else if (entry->extent_count > FILE_MAX_EXTENTS)
+        {
+            fprintf(stderr, "Error: %s has too many extents\n", entry->name);
+            problems++;
+        }
+        else
+        {
+            for (int j = 0; j < entry->extent_count; j++)
+            {
+                extent *piece = &entry->extents[j];
+                for (unsigned int block = piece->start;
+                     block < piece->start + piece->count; block++)
+                {
+                    if (block < super->data_start ||
+                        block >= super->block_count || owner[block] != -1)
+                    {
+                        fprintf(stderr,
+                                "Error: Block %u of %s is not available\n",
+                                block, entry->name);
+                        problems++;
+                        break;
+                    }
+                    owner[block] = i + 1;
+                }
+                capacity += piece->count * FS_BLOCK_SIZE;
+            }
+        }
+        if (entry->data_length > capacity)
+        {
+            fprintf(stderr, "Error: The data of %s does not fit its blocks\n",
+                    entry->name);
+            problems++;
+        }
+        // the data can only be read from valid blocks
+        if (problems != found)
+        {
+            continue;
+        }
+        unsigned int length;
+        unsigned char *content = load_file(entry, &length);
+        if (!content)
+        {
+            fprintf(stderr, "Error: The compressed data of %s is damaged\n",
+                    entry->name);
+            problems++;
+        }
+        free(content);
+    }
+    for (unsigned int block = 0; block < super->block_count; block++)
+    {
+        if (block_used(block) != (owner[block] != -1))
+        {
+            fprintf(stderr, "Error: Block %u is wrongly marked as %s\n", block,
+                    block_used(block) ? "used" : "free");
+            problems++;
+        }
+    }
+    free(owner);
+    return problems;
+}
+
+/**
+ * Reads a whole host file, with a terminating zero appended
+ *
+ * @param path path of the file
+ * @param length receives the amount of bytes including the zero
+ * @return unsigned char* the data, to be freed, 0 on failure
+ */
+static unsigned char *read_host_file(char *path, unsigned int *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror(path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    unsigned int size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = malloc(size + 1);
+    if (!data || fread(data, 1, size, file) != size)
+    {
+        fprintf(stderr, "Error: Could not read %s\n", path);
+        fclose(file);
+        free(data);
+        return 0;
+    }
+    fclose(file);
+    data[size] = 0;
+    *length = size + 1;
+    return data;
+}
+
+/**
+ * Derives the name of a file in the image from a host path: the base name
+ * without its suffix
+ *
+ * @param path the host path
+ * @param name receives the name
+ * @return int 0 on success, -1 if the name is empty or too long
+ */
+static int file_name(char *path, char *name)
+{
+    char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    char *suffix = strrchr(base, '.');
+    unsigned int length = suffix && suffix != base ? (unsigned int)(suffix - base)
+                                                   : strlen(base);
+    if (length == 0 || length >= MAX_FILENAME_LENGTH)
+    {
+        fprintf(stderr, "Error: %s does not make a valid file name\n", path);
+        return -1;
+    }
+    memcpy(name, base, length);
+    name[length] = 0;
+    return 0;
+}
+
+/**
+ * Imports a host file into the image, replacing a file with the same name
+ *
+ * @param path path of the host file
+ * @param compress 1 to store it compressed if that makes it smaller
+ * @return int 0 on success, -1 on failure
+ */
+static int import_file(char *path, int compress)
+{
+    char name[MAX_FILENAME_LENGTH];
+    unsigned int length;
+    if (file_name(path, name))
+    {
+        return -1;
+    }
+    unsigned char *data = read_host_file(path, &length);
+    if (!data)
+    {
+        return -1;
+    }
+    int index = find_file(name);
+    if (index < 0)
+    {
+        if (super->file_count == MAX_FILE_COUNT)
+        {
+            fprintf(stderr, "Error: No room in the directory for %s\n", name);
+            free(data);
+            return -1;
+        }
+        index = super->file_count++;
+        memset(&directory[index], 0, sizeof(file_entry));
+        strcpy(directory[index].name, name);
+    }
+    file_entry *entry = &directory[index];
+    free_file(entry);
+    unsigned char *stored = data;
+    unsigned int stored_length = length;
+    unsigned char *packed = 0;
+    // tiny files are kept inline and uncompressed, to be read in place
+    if (compress && length > FILE_INLINE_DATA_SIZE)
+    {
+        packed = malloc(length + length / 8 + LZ_HEADER_SIZE + 1);
+        unsigned int packed_length = lz_compress(data, length, packed);
+        if (packed_length < length)
+        {
+            stored = packed;
+            stored_length = packed_length;
+            entry->flags |= FILE_FLAG_COMPRESSED;
+        }
+    }
+    int result = store_data(entry, stored, stored_length);
+    if (result)
+    {
+        fprintf(stderr, "Error: Not enough space for %s\n", name);
+    }
+    else
+    {
+        // read it back the way the kernel would
+        unsigned int check_length;
+        unsigned char *check = load_file(entry, &check_length);
+        if (!check || check_length != length || memcmp(check, data, length))
+        {
+            fprintf(stderr, "Error: %s does not read back correctly\n", name);
+            result = -1;
+        }
+        free(check);
+    }
+    free(packed);
+    free(data);
+    return result;
+}
+
+/**
+ * Prints the files of the image and the free space, like the kernel's 'list'
+ * command
+ */
+static void list_files()
+{
+    unsigned int free_blocks = 0;
+    for (unsigned int block = super->data_start; block < super->block_count;
+         block++)
+    {
+        free_blocks += !block_used(block);
+    }
+    for (int i = 0; i < super->file_count; i++)
+    {
+        printf("%s (%u bytes%s%s)\n", directory[i].name,
+               directory[i].data_length,
+               directory[i].flags & FILE_FLAG_COMPRESSED ? ", compressed" : "",
+               directory[i].flags & FILE_FLAG_INLINE ? ", inline" : "");
+    }
+    printf("%u of %u blocks free\n", free_blocks, super->block_count);
+}
+
+int main(int argc, char **argv)
+{
+    int create = 0;
+    int compress = 1;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-'; first++)
+    {
+        if (!strcmp(argv[first], "-n"))
+        {
+            create = 1;
+        }
+        else if (!strcmp(argv[first], "-u"))
+        {
+            compress = 0;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (first >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-n] [-u] image [file ...]\n", argv[0]);
+        return 1;
+    }
+    char *path = argv[first++];
+    int loaded = create ? -1 : image_load(path);
+    if (loaded == -2)
+    {
+        fprintf(stderr, "Error: %s is not formatted, use -n\n", path);
+        return 1;
+    }
+    if (loaded)
+    {
+        free(image);
+        image_blocks = NEW_IMAGE_BLOCKS;
+        image = malloc(image_blocks * FS_BLOCK_SIZE);
+        image_format();
+    }
+    else if (verify())
+    {
+        fprintf(stderr, "Error: %s is damaged, use -n\n", path);
+        return 1;
+    }
+    int failed = 0;
+    for (int i = first; i < argc; i++)
+    {
+        failed |= import_file(argv[i], compress) != 0;
+    }
+    if (failed || verify())
+    {
+        fprintf(stderr, "Error: The image was not written\n");
+        return 1;
+    }
+    // a new image is written even without files
+    if ((loaded || first < argc) && image_store(path))
+    {
+        return 1;
+    }
+    list_files();
+    return 0;
+}
@@ -0,0 +1,693 @@
+/**
+ * FILENAME :       fdc.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Model of the floppy disk controller, channel 2 of the ISA DMA controller,
+ *  the CMOS drive type and a 1.44MB drive, at the level of their ports.
+ *  The controller understands the commands the driver uses: specify, sense
+ *  interrupt, recalibrate, seek, read data and write data. Every operation
+ *  costs simulated time:
+ *  - seeking costs the step rate programmed with specify per cylinder, plus
+ *    the settle time of the heads
+ *  - a transfer waits for the motor to get up to speed and for the heads to
+ *    load, then for the first sector to come around, and then takes the time
+ *    its sectors pass under the head
+ *  The data is moved when a transfer completes, to the memory the DMA
+ *  channel was programmed with. The kernel is linked at low addresses, so
+ *  the physical addresses the driver programs are the host addresses of its
+ *  buffers.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "fdc.h"
+
+/** Ports of the floppy disk controller */
+#define FDC_DOR 0x3f2
+#define FDC_MSR 0x3f4
+#define FDC_FIFO 0x3f5
+#define FDC_CCR 0x3f7
+
+/** Ports of channel 2 of the DMA controller */
+#define DMA_ADDRESS 0x04
+#define DMA_COUNT 0x05
+#define DMA_MASK 0x0a
+#define DMA_MODE 0x0b
+#define DMA_FLIP_FLOP 0x0c
+#define DMA_PAGE 0x81
+
+/** Ports of the CMOS */
+#define CMOS_INDEX 0x70
+#define CMOS_DATA 0x71
+/** CMOS register holding the floppy drive types, drive 0 is a 1.44MB drive */
+#define CMOS_FLOPPY_TYPES 0x10
+#define CMOS_FLOPPY_1440K 0x40
+
+/** IRQ of the controller */
+#define FDC_IRQ 6
+
+/** Commands */
+#define FDC_SPECIFY 3
+#define FDC_WRITE_DATA 5
+#define FDC_READ_DATA 6
+#define FDC_RECALIBRATE 7
+#define FDC_SENSE_INTERRUPT 8
+#define FDC_SEEK 15
+
+/** Phases of the controller */
+#define FDC_PHASE_RESET 0
+#define FDC_PHASE_COMMAND 1
+#define FDC_PHASE_EXECUTION 2
+#define FDC_PHASE_RESULT 3
+
+/** Kinds of the pending event */
+#define FDC_EVENT_RESET 0
+#define FDC_EVENT_SEEK 1
+#define FDC_EVENT_TRANSFER 2
+
+/** Time a sector takes to pass under the head, including the gaps */
+#define FDC_SECTOR_US (FDC_ROTATION_US / FDC_SECTORS)
+/** Time for the controller to come out of a reset */
+#define FDC_RESET_US 10
+
+/** Bounds of the host memory DMA can reach, set by the linker */
+extern char __data_start[], _end[];
+
+/** The disk image */
+static unsigned char *fdc_disk;
+static fdc_stats fdc_statistics;
+/** Amount of transfers which still fail on purpose */
+static unsigned int fdc_errors_to_inject = 0;
+
+static unsigned char fdc_dor = 0;
+static unsigned int fdc_rate_kbps = 500;
+/** Times programmed with specify */
+static sim_time fdc_step_us = 8000;
+static sim_time fdc_head_load_us = 2000;
+static sim_time fdc_head_unload_us = 240000;
+
+static int fdc_phase = FDC_PHASE_RESET;
+static unsigned char fdc_command[9];
+static int fdc_command_length = 0;
+static unsigned char fdc_result[7];
+static int fdc_result_length = 0;
+static int fdc_result_position = 0;
+
+/** Status for the next sense interrupt command */
+static int fdc_sense_pending = 0;
+static unsigned char fdc_sense_st0 = 0;
+
+/** Cylinder the heads are over and the one a seek moves them to */
+static int fdc_cylinder = 0;
+static int fdc_seeking = 0;
+static int fdc_seek_target = 0;
+/** Time the motor was turned on, and the heads were used the last time */
+static sim_time fdc_motor_on_since = 0;
+static sim_time fdc_head_idle_since = 0;
+static int fdc_head_loaded = 0;
+
+/** The pending event */
+static sim_time fdc_event_time = SIM_NEVER;
+static int fdc_event_kind = 0;
+
+/**
+ * The transfer in execution
+ */
+static struct
+{
+    int write;
+    unsigned int lba;
+    unsigned int count;
+    unsigned char *memory;
+} fdc_transfer;
+
+/** Registers of DMA channel 2 */
+static unsigned int dma_address = 0;
+static unsigned int dma_count = 0;
+static unsigned char dma_page = 0;
+static unsigned char dma_mode = 0;
+static int dma_masked = 1;
+static int dma_flip_flop = 0;
+
+static unsigned char cmos_index = 0;
+
+/**
+ * Schedules the event of the controller
+ *
+ * @param kind one of the FDC_EVENT_ kinds
+ * @param time when it happens
+ */
+static void fdc_schedule(int kind, sim_time time)
+{
+    fdc_event_kind = kind;
+    fdc_event_time = time;
+}
+
+/**
+ * Raises the interrupt of the controller, if interrupts are enabled in the
+ * digital output register
+ */
+static void fdc_interrupt()
+{
+    if (fdc_dor & 0x08)
+    {
+        machine_raise_irq(FDC_IRQ);
+    }
+}
+
+/**
+ * Makes bytes available as the result of a command
+ *
+ * @param bytes the result bytes
+ * @param length amount of bytes
+ */
+static void fdc_set_result(unsigned char *bytes, int length)
+{
+    memcpy(fdc_result, bytes, length);
+    fdc_result_length = length;
+    fdc_result_position = 0;
+    fdc_phase = FDC_PHASE_RESULT;
+}
+
+/**
+ * Starts moving the heads. The controller takes the next command right
+ * away, the interrupt signals the end of the seek.
+ *
+ * @param target cylinder to move to
+ * @param head head selected by the command
+ */
+static void fdc_start_seek(int target, int head)
+{
+    if (target >= FDC_CYLINDERS)
+    {
+        // the drive stops at its last cylinder
+        target = FDC_CYLINDERS - 1;
+    }
+    int distance = target > fdc_cylinder ? target - fdc_cylinder
+                                         : fdc_cylinder - target;
+    sim_time duration = distance * fdc_step_us;
+    if (distance)
+    {
+        duration += FDC_SETTLE_US;
+        fdc_statistics.seeks++;
+        fdc_statistics.cylinders += distance;
+    }
+    fdc_statistics.seek_time += duration;
+    fdc_seeking = 1;
+    fdc_seek_target = target;
+    fdc_sense_st0 = 0x20 | head << 2;
+    fdc_phase = FDC_PHASE_COMMAND;
+    fdc_schedule(FDC_EVENT_SEEK, machine_now() + duration + 1);
+}
+
+/**
+ * Ends a transfer with an error after some time, without moving data
+ *
+ * @param time when the controller gives up
+ * @param st0 status registers of the result
+ * @param st1
+ * @param st2
+ */
+static void fdc_fail_transfer(sim_time time, unsigned char st0,
+                              unsigned char st1, unsigned char st2)
+{
+    unsigned char result[7] = {st0, st1, st2, fdc_command[2], fdc_command[3],
+                               fdc_command[4], fdc_command[5]};
+    memcpy(fdc_result, result, sizeof(result));
+    fdc_transfer.count = 0;
+    fdc_phase = FDC_PHASE_EXECUTION;
+    fdc_schedule(FDC_EVENT_TRANSFER, time);
+}
+
+/**
+ * Starts a read or write command. The data moves when the last sector has
+ * passed under the head.
+ *
+ * @param write 1 for a write command
+ */
+static void fdc_start_transfer(int write)
+{
+    int multitrack = fdc_command[0] & 0x80;
+    int head = (fdc_command[1] >> 2) & 1;
+    int cylinder = fdc_command[2];
+    int sector = fdc_command[4];
+    int size = fdc_command[5];
+    int end_of_track = fdc_command[6];
+    unsigned char st0 = head << 2;
+    sim_time time = machine_now();
+
+    fdc_transfer.write = write;
+    if (!(fdc_dor & 0x10))
+    {
+        fdc_statistics.errors++;
+        fdc_fail_transfer(time + 1, st0 | 0x48, 0, 0);
+        return;
+    }
+    // the motor has to get up to speed and the heads have to load
+    sim_time ready = fdc_motor_on_since + FDC_SPIN_UP_US;
+    if (time < ready)
+    {
+        fdc_statistics.spin_up_time += ready - time;
+        time = ready;
+    }
+    if (!fdc_head_loaded || time - fdc_head_idle_since > fdc_head_unload_us)
+    {
+        fdc_statistics.spin_up_time += fdc_head_load_us;
+        time += fdc_head_load_us;
+    }
+    if (cylinder != fdc_cylinder || fdc_command[3] != head || size != 2 ||
+        sector < 1 || sector > FDC_SECTORS || end_of_track > FDC_SECTORS)
+    {
+        // the sector is never found, the controller gives up after the
+        // index hole passed twice
+        fdc_statistics.errors++;
+        fdc_fail_transfer(time + 2 * FDC_ROTATION_US, st0 | 0x40, 0x04,
+                          cylinder != fdc_cylinder ? 0x10 : 0);
+        return;
+    }
+    // the transfer ends with the dma count or at the end of the cylinder
+    unsigned int left = end_of_track - sector + 1;
+    if (multitrack && head == 0)
+    {
+        left += end_of_track;
+    }
+    unsigned int dma_sectors = (dma_count + 1) / FDC_SECTOR_SIZE;
+    unsigned int count = dma_sectors < left ? dma_sectors : left;
+    unsigned int length = count * FDC_SECTOR_SIZE;
+    uintptr_t physical = (uintptr_t)dma_page << 16 | dma_address;
+    char *error = 0;
+    if (dma_masked || (dma_mode & 3) != 2)
+    {
+        error = "channel 2 is not ready";
+    }
+    else if (((dma_mode >> 2) & 3) != (write ? 2 : 1))
+    {
+        error = "channel 2 is set to the wrong direction";
+    }
+    else if (count == 0)
+    {
+        error = "the count is below a sector";
+    }
+    else if (dma_address + length > 0x10000)
+    {
+        error = "the transfer crosses a 64kB boundary";
+    }
+    else if (physical < (uintptr_t)__data_start ||
+             physical + length > (uintptr_t)_end)
+    {
+        error = "the address is outside of the kernel's memory";
+    }
+    if (error)
+    {
+        // the controller doesn't get its data in time
+        fprintf(stderr, "fdc: dma failed, %s\n", error);
+        fdc_statistics.errors++;
+        fdc_fail_transfer(time + FDC_ROTATION_US, st0 | 0x40, 0x10, 0);
+        return;
+    }
+    // wait for the first sector to come around
+    sim_time start = (sector - 1) * (sim_time)FDC_SECTOR_US;
+    sim_time wait = (start + FDC_ROTATION_US - time % FDC_ROTATION_US) %
+                    FDC_ROTATION_US;
+    fdc_statistics.rotation_time += wait;
+    time += wait;
+    fdc_statistics.commands++;
+    if (fdc_errors_to_inject)
+    {
+        // a data error in the first sector
+        fdc_errors_to_inject--;
+        fdc_statistics.injected_errors++;
+        fdc_statistics.transfer_time += FDC_SECTOR_US;
+        fdc_fail_transfer(time + FDC_SECTOR_US, st0 | 0x40, 0x20, 0x20);
+        return;
+    }
+    fdc_statistics.transfer_time += count * (sim_time)FDC_SECTOR_US;
+    time += count * (sim_time)FDC_SECTOR_US;
+    if (write)
+    {
+        fdc_statistics.sectors_written += count;
+    }
+    else
+    {
+        fdc_statistics.sectors_read += count;
+    }
+    fdc_transfer.lba =
+        (cylinder * FDC_HEADS + head) * FDC_SECTORS + sector - 1;
+    fdc_transfer.count = count;
+    fdc_transfer.memory = (unsigned char *)physical;
+    // the address of the sector following the transfer
+    unsigned int next = fdc_transfer.lba + count;
+    unsigned char st1 = 0;
+    if (dma_sectors > left)
+    {
+        // the end of the cylinder came before the terminal count
+        st0 |= 0x40;
+        st1 = 0x80;
+    }
+    unsigned char result[7] = {st0,
+                               st1,
+                               0,
+                               next / (FDC_HEADS * FDC_SECTORS),
+                               (next / FDC_SECTORS) % FDC_HEADS,
+                               next % FDC_SECTORS + 1,
+                               size};
+    memcpy(fdc_result, result, sizeof(result));
+    dma_address += length;
+    dma_count = 0xffff;
+    fdc_phase = FDC_PHASE_EXECUTION;
+    fdc_schedule(FDC_EVENT_TRANSFER, time);
+}
+
+/**
+ * Executes a command once all its bytes were written
+ */
+static void fdc_execute()
+{
+    unsigned char invalid = 0x80;
+    switch (fdc_command[0] & 0x1f)
+    {
+    case FDC_SPECIFY:
+    {
+        unsigned int step = fdc_command[1] >> 4;
+        unsigned int unload = fdc_command[1] & 0x0f;
+        unsigned int load = fdc_command[2] >> 1;
+        fdc_step_us = (16 - step) * 500000ULL / fdc_rate_kbps;
+        fdc_head_unload_us = (unload ? unload : 16) * 8000000ULL / fdc_rate_kbps;
+        fdc_head_load_us = (load ? load : 128) * 1000000ULL / fdc_rate_kbps;
+        fdc_phase = FDC_PHASE_COMMAND;
+        break;
+    }
+    case FDC_SENSE_INTERRUPT:
+        if (fdc_sense_pending)
+        {
+            unsigned char result[2] = {fdc_sense_st0, fdc_cylinder};
+            fdc_sense_pending = 0;
+            fdc_set_result(result, 2);
+        }
+        else
+        {
+            fdc_set_result(&invalid, 1);
+        }
+        break;
+    case FDC_RECALIBRATE:
+        fdc_start_seek(0, 0);
+        break;
+    case FDC_SEEK:
+        fdc_start_seek(fdc_command[2], (fdc_command[1] >> 2) & 1);
+        break;
+    case FDC_READ_DATA:
+        fdc_start_transfer(0);
+        break;
+    case FDC_WRITE_DATA:
+        fdc_start_transfer(1);
+        break;
+    default:
+        fdc_set_result(&invalid, 1);
+    }
+}
+
+/**
+ * Amount of bytes of a command, known from its first byte
+ *
+ * @param command first byte of the command
+ * @return int amount of bytes
+ */
+static int fdc_command_bytes(unsigned char command)
+{
+    switch (command & 0x1f)
+    {
+    case FDC_SPECIFY:
+    case FDC_SEEK:
+        return 3;
+    case FDC_RECALIBRATE:
+        return 2;
+    case FDC_READ_DATA:
+    case FDC_WRITE_DATA:
+        return 9;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * Handles a write to the digital output register: resets, motor and
+ * interrupt enable
+ *
+ * @param value the new value
+ */
+static void fdc_write_dor(unsigned char value)
+{
+    if (!(value & 0x04))
+    {
+        // held in reset, whatever was going on is lost
+        fdc_phase = FDC_PHASE_RESET;
+        fdc_event_time = SIM_NEVER;
+        if (fdc_seeking)
+        {
+            fdc_cylinder = fdc_seek_target;
+            fdc_seeking = 0;
+        }
+        fdc_sense_pending = 0;
+        fdc_command_length = 0;
+    }
+    else if (fdc_phase == FDC_PHASE_RESET)
+    {
+        fdc_schedule(FDC_EVENT_RESET, machine_now() + FDC_RESET_US);
+    }
+    if ((value & 0x10) && !(fdc_dor & 0x10))
+    {
+        fdc_motor_on_since = machine_now();
+    }
+    if (!(value & 0x10))
+    {
+        fdc_head_loaded = 0;
+    }
+    fdc_dor = value;
+}
+
+/**
+ * Handles a write to the data FIFO, collecting the bytes of a command
+ *
+ * @param value the byte
+ */
+static void fdc_write_fifo(unsigned char value)
+{
+    if (fdc_phase != FDC_PHASE_COMMAND)
+    {
+        return;
+    }
+    fdc_command[fdc_command_length++] = value;
+    if (fdc_command_length == fdc_command_bytes(fdc_command[0]))
+    {
+        fdc_command_length = 0;
+        fdc_execute();
+    }
+}
+
+/**
+ * Reads the main status register
+ *
+ * @return unsigned char its value
+ */
+static unsigned char fdc_read_msr()
+{
+    switch (fdc_phase)
+    {
+    case FDC_PHASE_COMMAND:
+        return 0x80 | (fdc_command_length ? 0x10 : 0) | (fdc_seeking ? 1 : 0);
+    case FDC_PHASE_EXECUTION:
+        return 0x10;
+    case FDC_PHASE_RESULT:
+        return 0xd0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Handles a read from a port of one of the modelled devices
+ *
+ * @param port the port
+ * @param value receives the value
+ * @return int 1 if the port belongs to the model
+ */
+static int fdc_port_in(unsigned short port, unsigned char *value)
+{
+    switch (port)
+    {
+    case FDC_MSR:
+        *value = fdc_read_msr();
+        return 1;
+    case FDC_FIFO:
+        *value = 0;
+        if (fdc_phase == FDC_PHASE_RESULT)
+        {
+            *value = fdc_result[fdc_result_position++];
+            if (fdc_result_position == fdc_result_length)
+            {
+                fdc_phase = FDC_PHASE_COMMAND;
+            }
+        }
+        return 1;
+    case CMOS_DATA:
+        *value = cmos_index == CMOS_FLOPPY_TYPES ? CMOS_FLOPPY_1440K : 0;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Handles a write to a port of one of the modelled devices
+ *
+ * @param port the port
+ * @param value the value
+ * @return int 1 if the port belongs to the model
+ */
+static int fdc_port_out(unsigned short port, unsigned char value)
+{
+    // data rates selected by the configuration control register
+    static const unsigned int rates[4] = {500, 300, 250, 1000};
+    switch (port)
+    {
+    case FDC_DOR:
+        fdc_write_dor(value);
+        return 1;
+    case FDC_FIFO:
+        fdc_write_fifo(value);
+        return 1;
+    case FDC_CCR:
+        fdc_rate_kbps = rates[value & 3];
+        return 1;
+    case DMA_ADDRESS:
+        dma_address = dma_flip_flop ? (dma_address & 0xff) | value << 8
+                                    : (dma_address & 0xff00) | value;
+        dma_flip_flop ^= 1;
+        return 1;
+    case DMA_COUNT:
+        dma_count = dma_flip_flop ? (dma_count & 0xff) | value << 8
+                                  : (dma_count & 0xff00) | value;
+        dma_flip_flop ^= 1;
+        return 1;
+    case DMA_MASK:
+        if ((value & 3) == 2)
+        {
+            dma_masked = (value >> 2) & 1;
+        }
+        return 1;
+    case DMA_MODE:
+        if ((value & 3) == 2)
+        {
+            dma_mode = value;
+        }
+        return 1;
+    case DMA_FLIP_FLOP:
+        dma_flip_flop = 0;
+        return 1;
+    case DMA_PAGE:
+        dma_page = value;
+        return 1;
+    case CMOS_INDEX:
+        cmos_index = value & 0x7f;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Time of the pending event of the controller
+ *
+ * @return sim_time the time, SIM_NEVER if there is none
+ */
+static sim_time fdc_next_event()
+{
+    return fdc_event_time;
+}
+
+/**
+ * Carries out the pending event of the controller: the end of a reset, a
+ * seek or a transfer
+ */
+static void fdc_run_event()
+{
+    fdc_event_time = SIM_NEVER;
+    switch (fdc_event_kind)
+    {
+    case FDC_EVENT_RESET:
+        fdc_phase = FDC_PHASE_COMMAND;
+        fdc_sense_pending = 1;
+        fdc_sense_st0 = 0xc0;
+        break;
+    case FDC_EVENT_SEEK:
+        fdc_seeking = 0;
+        fdc_cylinder = fdc_seek_target;
+        fdc_sense_pending = 1;
+        break;
+    case FDC_EVENT_TRANSFER:
+    {
+        unsigned char *sectors = fdc_disk + fdc_transfer.lba * FDC_SECTOR_SIZE;
+        unsigned int length = fdc_transfer.count * FDC_SECTOR_SIZE;
+        if (fdc_transfer.write)
+        {
+            memcpy(sectors, fdc_transfer.memory, length);
+        }
+        else
+        {
+            memcpy(fdc_transfer.memory, sectors, length);
+        }
+        fdc_head_loaded = 1;
+        fdc_head_idle_since = machine_now();
+        fdc_result_length = 7;
+        fdc_result_position = 0;
+        fdc_phase = FDC_PHASE_RESULT;
+        break;
+    }
+    }
+    fdc_interrupt();
+}
+
+/** The model as a device of the machine */
+static sim_device fdc_device = {fdc_port_in, fdc_port_out, fdc_next_event,
+                                fdc_run_event};
+
+/**
+ * Attaches the model to the machine
+ *
+ * @param disk the disk image, FDC_DISK_SIZE bytes
+ */
+void fdc_install(unsigned char *disk)
+{
+    fdc_disk = disk;
+    machine_attach(&fdc_device);
+}
+
+/**
+ * Returns what the controller did so far
+ *
+ * @param stats receives the statistics
+ */
+void fdc_get_stats(fdc_stats *stats)
+{
+    *stats = fdc_statistics;
+}
+
+/**
+ * Lets the next transfers fail with a data error, to exercise the retries of
+ * the driver
+ *
+ * @param count amount of transfers
+ */
+void fdc_inject_errors(unsigned int count)
+{
+    fdc_errors_to_inject = count;
+}
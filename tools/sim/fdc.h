@@ -0,0 +1,64 @@
+/**
+ * FILENAME :       fdc.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the model of the floppy disk controller, the ISA DMA
+ *  controller and the 1.44MB drive attached to them
+ */
+
+#ifndef FDC_H
+#define FDC_H
+
+#include "machine.h"
+
+/** Geometry of the simulated 1.44MB disk */
+#define FDC_CYLINDERS 80
+#define FDC_HEADS 2
+#define FDC_SECTORS 18
+#define FDC_SECTOR_SIZE 512
+#define FDC_DISK_SIZE (FDC_CYLINDERS * FDC_HEADS * FDC_SECTORS * FDC_SECTOR_SIZE)
+
+/** Time for one revolution of the disk, it spins at 300 rpm */
+#define FDC_ROTATION_US 200000
+/** Time for the heads to settle after they were moved */
+#define FDC_SETTLE_US 15000
+/** Time for the motor to get up to speed */
+#define FDC_SPIN_UP_US 300000
+
+/**
+ * What the drive and controller did, with the time spent on it
+ */
+typedef struct fdc_stats
+{
+    // read and write commands
+    unsigned int commands;
+    // seeks and recalibrations moving the heads, and the cylinders stepped
+    unsigned int seeks;
+    unsigned int cylinders;
+    unsigned int sectors_read;
+    unsigned int sectors_written;
+    // commands failed on purpose, see fdc_inject_errors
+    unsigned int injected_errors;
+    // failed commands, e.g. because of a bad dma setup
+    unsigned int errors;
+    // time moving the heads, waiting for the motor and the head to load,
+    // waiting for the sector to come around and transferring data
+    sim_time seek_time;
+    sim_time spin_up_time;
+    sim_time rotation_time;
+    sim_time transfer_time;
+} fdc_stats;
+
+void fdc_install(unsigned char *disk);
+void fdc_get_stats(fdc_stats *stats);
+void fdc_inject_errors(unsigned int count);
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ * FILENAME :       fssim.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Runs the kernel's file system, cache, elevator and floppy driver on the
+ *  host against the simulated controller, and replays a trace on them. After
+ *  every line of the trace the simulated time it took and what the drive did
+ *  are reported, so changes can be measured without booting the system.
+ *  Everything is simulated, so a run always gives the same results.
+ *
+ *  A trace has one entry per line:
+ *    command args     a shell command, e.g. 'list' or 'print fibonacci'
+ *    @sleep ms        lets the main loop run for a while, e.g. for the cache
+ *                     to write back changes
+ *    @read lba count  reads sectors from the floppy, bypassing the cache
+ *    @write lba count writes sectors to the floppy, bypassing the cache,
+ *                     with the data they already hold
+ *    @fail count      lets the next transfers fail with a data error
+ *    # comment
+ *  The sectors the floppy is asked for can be recorded as a trace of @read
+ *  and @write lines, to be replayed against a changed driver.
+ *
+ *  Usage: fssim [-q] [-w] [-r record] [-a strategy] image [trace]
+ *    -q           don't print the kernel's output
+ *    -w           write the disk back to the image at the end
+ *    -r record    record the requests to the floppy to a trace file
+ *    -a strategy  place new files with an allocation strategy of the file
+ *                 system, see the 'alloc' command
+ *  Without a trace, the trace is read from the standard input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include "machine.h"
+#include "fdc.h"
+#include "block_device.h"
+#include "cache.h"
+#include "elevator.h"
+#include "floppy.h"
+#include "file_system.h"
+#include "screen.h"
+
+/** The disk in the simulated drive */
+static unsigned char sim_disk_image[FDC_DISK_SIZE];
+/** Buffer for @read and @write */
+static unsigned char sim_buffer[FDC_DISK_SIZE];
+
+/** The floppy as a block device and its operations */
+static block_device *sim_disk;
+static const block_device_ops *sim_disk_ops;
+/** Where requests are recorded, 0 if they are not */
+static FILE *sim_record;
+
+/** Where 'execute' continues once the program failed to run on the host */
+static sigjmp_buf sim_execute_return;
+
+/**
+ * Records a request to the floppy and hands it on to the driver
+ *
+ * @param device the floppy
+ * @param request the request
+ */
+static void sim_record_submit(block_device *device, block_request *request)
+{
+    fprintf(sim_record, "@%s %u %u\n", request->write ? "write" : "read",
+            request->block, request->count);
+    sim_disk_ops->submit(device, request);
+}
+
+static int sim_record_poll(block_device *device)
+{
+    return sim_disk_ops->poll(device);
+}
+
+static int sim_record_flush(block_device *device)
+{
+    return sim_disk_ops->flush ? sim_disk_ops->flush(device) : 0;
+}
+
+/** Operations of the floppy, recording its requests */
+static const block_device_ops sim_record_ops = {
+    sim_record_submit, sim_record_poll, sim_record_flush};
+
+/**
+ * Called when the program of 'execute' is started, as the host can't run
+ * 32 bit code from the kernel's memory
+ *
+ * @param signal the signal
+ */
+static void sim_execute_fault(int signal)
+{
+    (void)(signal);
+    siglongjmp(sim_execute_return, 1);
+}
+
+/**
+ * Runs a shell command. Programs started by 'execute' are loaded, but they
+ * can't run on the host, so loading them is all that is measured.
+ *
+ * @param line the command line
+ */
+static void sim_command(char *line)
+{
+    if (strncmp(line, "execute", 7) || (line[7] && line[7] != ' '))
+    {
+        machine_run_command(line);
+        return;
+    }
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sim_execute_fault;
+    action.sa_flags = SA_NODEFER;
+    sigaction(SIGSEGV, &action, &previous);
+    if (!sigsetjmp(sim_execute_return, 1))
+    {
+        machine_run_command(line);
+    }
+    else
+    {
+        print("(the program is not run on the host)\n", DEFAULT_COLOR_SCHEME);
+    }
+    sigaction(SIGSEGV, &previous, 0);
+}
+
+/**
+ * Lets the main loop run for a while
+ *
+ * @param ms time in milliseconds
+ */
+static void sim_sleep(unsigned int ms)
+{
+    sim_time until = machine_now() + ms * 1000ULL;
+    while (machine_now() < until)
+    {
+        machine_main_loop_step();
+    }
+}
+
+/**
+ * Reads or writes sectors of the floppy directly
+ *
+ * @param write 1 to write
+ * @param lba first sector
+ * @param count amount of sectors
+ */
+static void sim_transfer(int write, unsigned int lba, unsigned int count)
+{
+    if (lba + count > FDC_DISK_SIZE / FDC_SECTOR_SIZE || lba + count < lba)
+    {
+        fprintf(stderr, "sim: sectors %u to %u are out of range\n", lba,
+                lba + count);
+        return;
+    }
+    unsigned char *sectors = sim_disk_image + lba * FDC_SECTOR_SIZE;
+    if (write)
+    {
+        // the disk keeps its content, only the time matters
+        memcpy(sim_buffer, sectors, count * FDC_SECTOR_SIZE);
+        block_write(sim_disk, lba, count, sim_buffer);
+    }
+    else
+    {
+        block_read(sim_disk, lba, count, sim_buffer);
+    }
+}
+
+/**
+ * Carries out a line of a trace
+ *
+ * @param line the line, without its newline
+ */
+static void sim_run_line(char *line)
+{
+    unsigned int a, b;
+    if (line[0] != '@')
+    {
+        sim_command(line);
+    }
+    else if (sscanf(line, "@sleep %u", &a) == 1)
+    {
+        sim_sleep(a);
+    }
+    else if (sscanf(line, "@read %u %u", &a, &b) == 2)
+    {
+        sim_transfer(0, a, b);
+    }
+    else if (sscanf(line, "@write %u %u", &a, &b) == 2)
+    {
+        sim_transfer(1, a, b);
+    }
+    else if (sscanf(line, "@fail %u", &a) == 1)
+    {
+        fdc_inject_errors(a);
+    }
+    else
+    {
+        fprintf(stderr, "sim: unknown trace entry '%s'\n", line);
+    }
+}
+
+/**
+ * Prints what happened since a point, as one row of the report
+ *
+ * @param start time at the point
+ * @param before statistics at the point
+ * @param name what happened
+ */
+static void sim_report(sim_time start, fdc_stats *before, char *name)
+{
+    fdc_stats after;
+    fdc_get_stats(&after);
+    printf("sim> %10.3f %5u %5u %6u %6u %9.3f %9.3f %9.3f  %s\n",
+           (machine_now() - start) / 1000.0, after.seeks - before->seeks,
+           after.cylinders - before->cylinders,
+           after.sectors_read - before->sectors_read,
+           after.sectors_written - before->sectors_written,
+           (after.seek_time - before->seek_time) / 1000.0,
+           (after.rotation_time - before->rotation_time) / 1000.0,
+           (after.spin_up_time - before->spin_up_time) / 1000.0, name);
+}
+
+/**
+ * Boots the parts of the kernel needed for the file system, in the order
+ * the kernel does
+ *
+ * @return int 0 on success, -1 if the floppy driver refused to start
+ */
+static int sim_boot()
+{
+    if (floppy_install())
+    {
+        fprintf(stderr, "sim: the dma buffers are not reachable\n");
+        return -1;
+    }
+    elevator_install();
+    block_device_install();
+    cache_install();
+    sim_disk = block_device_find("fd0");
+    if (sim_record)
+    {
+        sim_disk_ops = sim_disk->ops;
+        sim_disk->ops = &sim_record_ops;
+    }
+    cache_attach(sim_disk);
+    install_filesystem();
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int write_back = 0;
+    char *record = 0;
+    char *strategy = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (!strcmp(argv[i], "-q"))
+        {
+            machine_set_output(0);
+        }
+        else if (!strcmp(argv[i], "-w"))
+        {
+            write_back = 1;
+        }
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+        {
+            record = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+        {
+            strategy = argv[++i];
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (i >= argc || argc - i > 2)
+    {
+        fprintf(stderr,
+                "Usage: %s [-q] [-w] [-r record] [-a strategy] image [trace]\n",
+                argv[0]);
+        return 1;
+    }
+    char *image = argv[i];
+    FILE *file = fopen(image, "rb");
+    if (!file)
+    {
+        perror(image);
+        return 1;
+    }
+    if (fread(sim_disk_image, 1, FDC_DISK_SIZE, file) != FDC_DISK_SIZE)
+    {
+        fprintf(stderr, "sim: %s is smaller than 1.44MB, padded with zeros\n",
+                image);
+    }
+    fclose(file);
+    FILE *trace = i + 1 < argc ? fopen(argv[i + 1], "r") : stdin;
+    if (!trace)
+    {
+        perror(argv[i + 1]);
+        return 1;
+    }
+    if (record && !(sim_record = fopen(record, "w")))
+    {
+        perror(record);
+        return 1;
+    }
+    // the kernel's output goes right between the rows of the report
+    setvbuf(stdout, 0, _IONBF, 0);
+
+    fdc_install(sim_disk_image);
+    printf("sim> %10s %5s %5s %6s %6s %9s %9s %9s  %s\n", "ms", "seeks",
+           "cyls", "read", "write", "seek ms", "rotate ms", "spinup ms",
+           "trace");
+    fdc_stats start_stats, before;
+    fdc_get_stats(&start_stats);
+    before = start_stats;
+    sim_time start = machine_now();
+    if (sim_boot())
+    {
+        return 1;
+    }
+    sim_report(start, &before, "(boot)");
+    if (strategy)
+    {
+        char line[SIM_MAX_LINE];
+        snprintf(line, sizeof(line), "alloc %s", strategy);
+        if (machine_run_command(line))
+        {
+            return 1;
+        }
+    }
+
+    char *trace_name = i + 1 < argc ? argv[i + 1] : "stdin";
+    // one more for the newline
+    char line[SIM_MAX_LINE + 1];
+    for (unsigned int number = 1; fgets(line, sizeof(line), trace); number++)
+    {
+        if (!strchr(line, '\n') && !feof(trace))
+        {
+            // the rest of the line would be taken for another entry
+            fprintf(stderr, "sim: %s:%u: line longer than %d characters\n",
+                    trace_name, number, SIM_MAX_LINE - 1);
+            return 1;
+        }
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0] || line[0] == '#')
+        {
+            continue;
+        }
+        if (sim_record && line[0] != '@')
+        {
+            fprintf(sim_record, "# %s\n", line);
+        }
+        sim_time line_start = machine_now();
+        fdc_get_stats(&before);
+        sim_run_line(line);
+        sim_report(line_start, &before, line);
+    }
+    if (write_back)
+    {
+        sim_time line_start = machine_now();
+        fdc_get_stats(&before);
+        cache_sync();
+        sim_report(line_start, &before, "(sync)");
+        file = fopen(image, "wb");
+        if (!file ||
+            fwrite(sim_disk_image, 1, FDC_DISK_SIZE, file) != FDC_DISK_SIZE)
+        {
+            perror(image);
+            return 1;
+        }
+        fclose(file);
+    }
+    sim_report(start, &start_stats, "(total)");
+    fdc_stats total;
+    fdc_get_stats(&total);
+    printf("sim> %u transfers, %u failed, %u failed on purpose, "
+           "%.3f ms transferring\n",
+           total.commands, total.errors, total.injected_errors,
+           total.transfer_time / 1000.0);
+    if (sim_record)
+    {
+        fclose(sim_record);
+    }
+    return 0;
+}
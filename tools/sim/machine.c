@@ -0,0 +1,453 @@
+/**
+ * FILENAME :       machine.c
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  The simulated machine. It replaces the parts of the kernel which touch the
+ *  real hardware: port access, the interrupt flag, hlt, the timer, the IRQ
+ *  handlers, the screen and the shell's command table.
+ *  Time only passes in the simulation: every port access costs
+ *  SIM_PORT_ACCESS_US, hlt skips ahead to the next event and timer_sleep
+ *  skips the time it would wait. Interrupts are delivered between port
+ *  accesses while the interrupt flag is set, like on the real processor, so
+ *  the driver runs exactly the code it runs in the kernel.
+ *  This file is compiled with the kernel's names for memcpy and friends
+ *  renamed, so it must not include the C library's string.h.
+ */
+
+#include <stdio.h>
+#include "machine.h"
+#include "low_level.h"
+#include "irq.h"
+#include "timer.h"
+#include "screen.h"
+#include "shell.h"
+#include "cache.h"
+#include "block_device.h"
+#include "string.h"
+
+/** Maximum amount of attached devices */
+#define SIM_MAX_DEVICES 4
+/** Maximum amount of shell commands */
+#define SIM_MAX_COMMANDS 64
+/** Maximum amount of timer handlers, like the kernel's timer */
+#define SIM_MAX_TIMER_HANDLERS 8
+
+/** Current simulated time */
+static sim_time sim_now = 0;
+/** Time of the next timer interrupt */
+static sim_time sim_next_tick = SIM_TICK_US;
+/** Timer ticks since the start */
+static unsigned int sim_ticks = 0;
+/** The interrupt flag, set as the kernel runs with interrupts enabled */
+static int sim_interrupt_flag = 1;
+/** Raised interrupts waiting for the interrupt flag, one bit per IRQ */
+static unsigned int sim_pending_irqs = 0;
+/** Set while hlt was executed with interrupts disabled, to warn once */
+static int sim_halt_warned = 0;
+
+static sim_device *sim_devices[SIM_MAX_DEVICES];
+static int sim_device_count = 0;
+
+static void (*sim_irq_handlers[16])(struct regs *regs);
+static void (*sim_timer_handlers[SIM_MAX_TIMER_HANDLERS])(unsigned int ticks);
+
+static char *sim_command_names[SIM_MAX_COMMANDS];
+static int (*sim_command_functions[SIM_MAX_COMMANDS])(int argc, char **argv);
+static int sim_command_count = 0;
+
+/** Whether the kernel's output is printed */
+static int sim_output = 1;
+
+/**
+ * Attaches a device model to the machine
+ *
+ * @param device the device
+ */
+void machine_attach(sim_device *device)
+{
+    if (sim_device_count < SIM_MAX_DEVICES)
+    {
+        sim_devices[sim_device_count++] = device;
+    }
+}
+
+/**
+ * Returns the current simulated time
+ *
+ * @return sim_time microseconds since the start
+ */
+sim_time machine_now()
+{
+    return sim_now;
+}
+
+/**
+ * Raises an interrupt line. The handler runs as soon as the interrupt flag
+ * is set.
+ *
+ * @param irq the IRQ
+ */
+void machine_raise_irq(int irq)
+{
+    sim_pending_irqs |= 1 << irq;
+}
+
+/**
+ * Runs the handlers of pending interrupts, if the interrupt flag is set. The
+ * flag is cleared while a handler runs, like the IDT gates do.
+ */
+static void machine_deliver()
+{
+    while (sim_interrupt_flag && sim_pending_irqs)
+    {
+        int irq = __builtin_ctz(sim_pending_irqs);
+        sim_pending_irqs &= ~(1 << irq);
+        sim_interrupt_flag = 0;
+        if (irq == 0)
+        {
+            sim_ticks++;
+            for (int i = 0; i < SIM_MAX_TIMER_HANDLERS; i++)
+            {
+                if (sim_timer_handlers[i])
+                {
+                    sim_timer_handlers[i](sim_ticks);
+                }
+            }
+        }
+        else if (sim_irq_handlers[irq])
+        {
+            struct regs regs = {0};
+            regs.int_no = 32 + irq;
+            sim_irq_handlers[irq](&regs);
+        }
+        sim_interrupt_flag = 1;
+    }
+}
+
+/**
+ * Time of the next event of the timer or of a device
+ *
+ * @return sim_time time of the event
+ */
+static sim_time machine_next_event()
+{
+    sim_time next = sim_next_tick;
+    for (int i = 0; i < sim_device_count; i++)
+    {
+        sim_time event = sim_devices[i]->next_event();
+        if (event < next)
+        {
+            next = event;
+        }
+    }
+    return next;
+}
+
+/**
+ * Lets the simulated time pass up to a point, carrying out the events in
+ * between in order
+ *
+ * @param until the point in time
+ */
+void machine_advance(sim_time until)
+{
+    sim_time next;
+    while ((next = machine_next_event()) <= until)
+    {
+        if (next > sim_now)
+        {
+            sim_now = next;
+        }
+        if (sim_next_tick <= sim_now)
+        {
+            sim_next_tick += SIM_TICK_US;
+            machine_raise_irq(0);
+        }
+        for (int i = 0; i < sim_device_count; i++)
+        {
+            if (sim_devices[i]->next_event() <= sim_now)
+            {
+                sim_devices[i]->run_event();
+            }
+        }
+        machine_deliver();
+    }
+    if (until > sim_now)
+    {
+        sim_now = until;
+    }
+    machine_deliver();
+}
+
+/**
+ * One pass of the kernel's main loop, without the shell: waiting for the
+ * next interrupt, writing back changed tracks and serving disk requests
+ */
+void machine_main_loop_step()
+{
+    cpu_halt();
+    cache_periodic_flush();
+    block_poll_all();
+}
+
+/**
+ * Enables or disables printing the kernel's output
+ *
+ * @param enabled 1 to print it
+ */
+void machine_set_output(int enabled)
+{
+    sim_output = enabled;
+}
+
+/**
+ * Runs a command line like the shell does: consecutive spaces are reduced
+ * to one and the words are handed to the command as arguments
+ *
+ * @param line the command line
+ * @return int result of the command, -1 if it is unknown
+ */
+int machine_run_command(char *line)
+{
+    char args[SIM_MAX_LINE];
+    char *argv[SIM_MAX_LINE / 2 + 1];
+    int argc = 0;
+    int i = 0;
+    for (; line[i]; i++)
+    {
+        if (i == SIM_MAX_LINE - 1)
+        {
+            // the shell doesn't take longer lines either
+            fprintf(stderr, "sim: command line longer than %d characters\n",
+                    SIM_MAX_LINE - 1);
+            return -1;
+        }
+        args[i] = line[i];
+    }
+    args[i] = 0;
+    reduce_consecutive_occurrences(args, ' ');
+    for (char *word = args; *word;)
+    {
+        if (*word == ' ')
+        {
+            *word++ = 0;
+            continue;
+        }
+        argv[argc++] = word;
+        while (*word && *word != ' ')
+        {
+            word++;
+        }
+    }
+    argv[argc] = 0;
+    if (argc == 0)
+    {
+        return 0;
+    }
+    for (int j = 0; j < sim_command_count; j++)
+    {
+        if (string_equals(sim_command_names[j], argv[0]))
+        {
+            return sim_command_functions[j](argc, argv);
+        }
+    }
+    print("Could not find command: '", DEFAULT_COLOR_SCHEME);
+    print(argv[0], DEFAULT_COLOR_SCHEME);
+    print("'\n", DEFAULT_COLOR_SCHEME);
+    return -1;
+}
+
+// the hardware access of low_level.c
+
+unsigned char port_byte_in(unsigned short port)
+{
+    machine_advance(sim_now + SIM_PORT_ACCESS_US);
+    unsigned char value = 0xff;
+    for (int i = 0; i < sim_device_count; i++)
+    {
+        if (sim_devices[i]->port_in(port, &value))
+        {
+            break;
+        }
+    }
+    return value;
+}
+
+void port_byte_out(unsigned short port, unsigned char data)
+{
+    machine_advance(sim_now + SIM_PORT_ACCESS_US);
+    for (int i = 0; i < sim_device_count; i++)
+    {
+        if (sim_devices[i]->port_out(port, data))
+        {
+            break;
+        }
+    }
+}
+
+unsigned char *memcpy(unsigned char *destination, const unsigned char *source,
+                      unsigned int count)
+{
+    return __builtin_memcpy(destination, source, count);
+}
+
+unsigned char *memset(unsigned char *destination, unsigned char value,
+                      unsigned int count)
+{
+    return __builtin_memset(destination, value, count);
+}
+
+unsigned short *memsetw(unsigned short *destination, unsigned short value,
+                        unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        destination[i] = value;
+    }
+    return destination;
+}
+
+int interrupts_enabled()
+{
+    return sim_interrupt_flag;
+}
+
+unsigned int interrupts_disable()
+{
+    unsigned int eflags = sim_interrupt_flag << 9;
+    sim_interrupt_flag = 0;
+    return eflags;
+}
+
+void interrupts_restore(unsigned int eflags)
+{
+    if (eflags & (1 << 9))
+    {
+        sim_interrupt_flag = 1;
+        machine_deliver();
+    }
+}
+
+void cpu_halt()
+{
+    if (!sim_interrupt_flag)
+    {
+        // the real processor would never wake up again
+        if (!sim_halt_warned)
+        {
+            fprintf(stderr, "sim: hlt with interrupts disabled\n");
+            sim_halt_warned = 1;
+        }
+        return;
+    }
+    machine_advance(machine_next_event());
+}
+
+void cpu_enable_interrupts_and_halt()
+{
+    sim_interrupt_flag = 1;
+    cpu_halt();
+}
+
+// the interrupt handlers of irq.c and the timer of timer.c
+
+void irq_install_handler(int irq, void (*handler)(struct regs *regs))
+{
+    sim_irq_handlers[irq] = handler;
+}
+
+unsigned int timer_get_ticks()
+{
+    return sim_ticks;
+}
+
+void timer_sleep(unsigned int ticks)
+{
+    // the kernel counts instructions instead of ticks, so interrupts being
+    // disabled don't matter
+    machine_advance(sim_now + (sim_time)ticks * SIM_TICK_US);
+}
+
+int timer_install_handler(void (*handler)(unsigned int ticks))
+{
+    for (int i = 0; i < SIM_MAX_TIMER_HANDLERS; i++)
+    {
+        if (!sim_timer_handlers[i])
+        {
+            sim_timer_handlers[i] = handler;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// the screen of screen.c, printed to the standard output
+
+void print(char *message, unsigned char attribute_byte)
+{
+    (void)(attribute_byte);
+    if (sim_output)
+    {
+        fputs(message, stdout);
+    }
+}
+
+void print_char(char character, unsigned char attribute_byte)
+{
+    (void)(attribute_byte);
+    if (!sim_output)
+    {
+        return;
+    }
+    // control characters are shown escaped, so the output stays text
+    unsigned char byte = (unsigned char)character;
+    if (byte == '\n' || byte == '\t' || (byte >= ' ' && byte < 0x7f))
+    {
+        putchar(character);
+    }
+    else if (byte == 0)
+    {
+        fputs("\\0", stdout);
+    }
+    else
+    {
+        printf("\\x%02x", byte);
+    }
+}
+
+void print_int(int input, unsigned char attribute_byte)
+{
+    (void)(attribute_byte);
+    if (sim_output)
+    {
+        printf("%d", input);
+    }
+}
+
+void print_unsigned_int(unsigned int input, unsigned char attribute_byte)
+{
+    (void)(attribute_byte);
+    if (sim_output)
+    {
+        printf("%u", input);
+    }
+}
+
+// the command table of shell.c
+
+void register_command(char *name, int (*function)(int argc, char **argv))
+{
+    if (sim_command_count < SIM_MAX_COMMANDS)
+    {
+        sim_command_names[sim_command_count] = name;
+        sim_command_functions[sim_command_count++] = function;
+    }
+}
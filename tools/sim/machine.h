@@ -0,0 +1,60 @@
+/**
+ * FILENAME :       machine.h
+ *
+ * AUTHOR :         Ruben Lohberg
+ *
+ * START DATE :     16 Oct 2026
+ *
+ * LAST UPDATE :    16 Oct 2026
+ *
+ * PROJECT :        RubenOS
+ *
+ * DESCRIPTION :
+ *  Interface for the simulated machine the kernel's file system and floppy
+ *  driver run on when they are compiled for the host. It keeps a simulated
+ *  clock and the interrupt flag, delivers the timer and floppy interrupts
+ *  and dispatches port accesses to the device models.
+ *  Only includes kernel headers which don't clash with the C library.
+ */
+
+#ifndef MACHINE_H
+#define MACHINE_H
+
+/** Simulated time in microseconds */
+typedef unsigned long long sim_time;
+
+/** Time of an event which never happens */
+#define SIM_NEVER (~0ULL)
+
+/** Length of a timer tick, the kernel's timer runs at 100 Hz */
+#define SIM_TICK_US 10000
+
+/** Time a port access takes, roughly one microsecond on the ISA bus */
+#define SIM_PORT_ACCESS_US 1
+
+/** Maximum length of a command line, like the kernel shell's buffer */
+#define SIM_MAX_LINE 1024
+
+/**
+ * A device model attached to the machine
+ */
+typedef struct sim_device
+{
+    // handles port accesses, returns 1 if the port belongs to the device
+    int (*port_in)(unsigned short port, unsigned char *value);
+    int (*port_out)(unsigned short port, unsigned char value);
+    // time of the next internal event of the device, SIM_NEVER if none
+    sim_time (*next_event)();
+    // carries out the internal events due at the current time
+    void (*run_event)();
+} sim_device;
+
+void machine_attach(sim_device *device);
+sim_time machine_now();
+void machine_advance(sim_time until);
+void machine_raise_irq(int irq);
+int machine_run_command(char *line);
+void machine_set_output(int enabled);
+void machine_main_loop_step();
+
+#endif